@@ -9,24 +9,133 @@
 #include <mutex>
 #include <condition_variable>
 #include <chrono>
+#include <deque>
+#include <set>
+#include <unordered_map>
+#include <cstdint>
 
 #include "dp/graph.h"
-#include "dp/util/pool.h"
+#include "dp/util/queue.h"
 
 namespace dp {
     using graph_handle_func = ::std::function<void(graph*)>;
+    // builds a new graph, owned by the caller.
+    using graph_factory_func = ::std::function<graph*()>;
 
     struct session {
         graph_handle_func initializer;
         graph_handle_func finalizer;
-        session() { }
-        session(const graph_handle_func& init) : initializer(init) { }
-        session(const graph_handle_func& init, const graph_handle_func& fini) : initializer(init), finalizer(fini) { }
+        // called instead of initializer and finalizer when the
+        // dispatcher discards the session, or instead of the finalizer
+        // when the session completes too late to keep its order.
+        ::std::function<void()> dropped;
+        // identifies the producer of the frame, e.g. a camera,
+        // seq orders the frames from the same source.
+        ::std::string source;
+        uint64_t seq;
+        // when the frame arrived, see frame_latency::received,
+        // 0 to take the time of dispatch.
+        int64_t received;
+        // set by graph_dispatcher.
+        int64_t dispatched;
+
+        session() : seq(0), received(0), dispatched(0) { }
+        session(const graph_handle_func& init) : initializer(init), seq(0), received(0), dispatched(0) { }
+        session(const graph_handle_func& init, const graph_handle_func& fini) : initializer(init), finalizer(fini), seq(0), received(0), dispatched(0) { }
     };
 
     struct dispatcher {
         virtual ~dispatcher() { }
         virtual bool dispatch(const session&, bool nowait = false) = 0;
+        // dispatches without blocking, false only if the session is
+        // refused and still the caller's, to retry or drop.
+        virtual bool offer(const session& s) { return dispatch(s, true); }
+        // the sessions running and waiting per slot, over 1 when
+        // sessions wait for a slot, 0 if unknown.
+        virtual double load() const { return 0; }
+    };
+
+    // overflow_policy decides what dispatch does with a session
+    // when all slots are busy and the pending queue is full.
+    enum class overflow_policy {
+        // wait for a free slot or queue entry.
+        block,
+        // discard the incoming session.
+        drop_newest,
+        // discard the oldest queued session.
+        drop_oldest,
+        // an incoming session replaces the queued one from the same
+        // source even if the queue is not full, otherwise drop_oldest.
+        latest_per_source,
+    };
+
+    overflow_policy parse_overflow_policy(const ::std::string&);
+    const char* overflow_policy_name(overflow_policy);
+
+    struct dispatch_stats {
+        // sessions handed to an idle slot right away.
+        uint64_t dispatched;
+        // sessions entering the pending queue.
+        uint64_t queued;
+        // dispatch calls which had to wait (block).
+        uint64_t blocked;
+        // nowait dispatch calls refused (block).
+        uint64_t rejected;
+        // incoming sessions discarded (drop_newest).
+        uint64_t dropped_newest;
+        // queued sessions discarded (drop_oldest, latest_per_source).
+        uint64_t dropped_oldest;
+        // queued sessions superseded by the same source (latest_per_source).
+        uint64_t replaced;
+        // high-water mark of the pending queue.
+        size_t max_depth;
+        // sessions whose finalizer waited for earlier ones.
+        uint64_t reordered;
+        // sessions completing after later ones were finalized.
+        uint64_t late;
+        // replicas added and removed by scaling.
+        uint64_t grown;
+        uint64_t shrunk;
+        // queued sessions a slot left for a faster busy slot.
+        uint64_t yielded;
+
+        dispatch_stats()
+        : dispatched(0), queued(0), blocked(0), rejected(0),
+          dropped_newest(0), dropped_oldest(0), replaced(0), max_depth(0),
+          reordered(0), late(0), grown(0), shrunk(0), yielded(0) { }
+    };
+
+    // the stages of the finalized sessions, see frame_latency.
+    struct latency_stats {
+        // from receive to dispatch, e.g. reassembly and decoding.
+        latency_histogram ingress;
+        // from dispatch until a slot started on it.
+        latency_histogram wait;
+        // running the graph.
+        latency_histogram exec;
+        // waiting for earlier frames of the source, see set_order.
+        latency_histogram order;
+        latency_histogram finalize;
+        // from receive to the end of the finalizer.
+        latency_histogram total;
+    };
+
+    // scaling_policy lets graph_dispatcher add replicas built by factory
+    // while sessions wait for a slot, and remove them once they stay idle,
+    // keeping the number of slots within [min_slots, max_slots].
+    // Slots added by add_graph are never removed.
+    struct scaling_policy {
+        size_t min_slots;
+        size_t max_slots;
+        graph_factory_func factory;
+        // how often the load is sampled.
+        ::std::chrono::milliseconds interval;
+        // a replica is removed after some slot stayed idle this many intervals.
+        size_t idle_intervals;
+
+        scaling_policy()
+        : min_slots(0), max_slots(0),
+          interval(200), idle_intervals(25) { }
     };
 
     class graph_dispatcher : public dispatcher {
@@ -34,25 +143,159 @@ namespace dp {
         graph_dispatcher();
         virtual ~graph_dispatcher();
 
-        size_t add_graph(graph* g);
+        // bounds the sessions waiting for a slot to capacity,
+        // and selects what happens beyond it.
+        // The default is no queue with the block policy.
+        void set_queue(size_t capacity, overflow_policy policy);
+
+        size_t queue_capacity() const { return m_capacity; }
+        overflow_policy policy() const { return m_policy; }
+
+        // runs the finalizers of each source in seq order: a completed
+        // session waits for the earlier ones of its source still running,
+        // unless more than window sessions of the source are waiting or
+        // it waited for timeout. Those earlier sessions are then late and
+        // get dropped instead of finalized. window = 0 disables ordering.
+        // A waiting session holds its slot, so a late frame keeps up to
+        // window graphs of the source idle for up to timeout.
+        // Only the finalizers and the completion hook are ordered,
+        // ops publishing from inside the graph are not.
+        // Call before dispatching.
+        void set_order(size_t window, ::std::chrono::milliseconds timeout);
+
+        // fn runs for every session right before its finalizer,
+        // so it observes the sessions in order when ordering is on.
+        void set_completion(const graph_handle_func& fn) { m_completion = fn; }
+
+        // starts a thread which grows and shrinks the slots within
+        // the bounds of the policy, may be called only once.
+        void set_scaling(const scaling_policy&);
+
+        dispatch_stats stats() const;
+        latency_stats latency() const;
+
+        // adds a slot for g, plus frames-1 slots for forks of g
+        // to keep up to frames frames in flight through its ops.
+        // Safe to call while dispatching.
+        void add_graph(graph* g, size_t frames = 1);
+
+        // the current number of slots.
+        size_t size() const;
+
+        // the recent service time of each slot in milliseconds,
+        // 0 for slots which have not run yet.
+        ::std::vector<double> service_times() const;
 
         bool dispatch(const session&, bool nowait = false);
+        bool offer(const session&);
+        double load() const;
 
     private:
+        // weight of the latest sample in a slot's service time.
+        static constexpr double ewma_alpha = 0.2;
+        // a slot leaves a queued session to a busy slot only if that
+        // is expected to complete it within this share of its own time.
+        static constexpr double yield_margin = 0.8;
+
+        // a slot owns a worker thread for its graph,
+        // which waits for sessions handed off by dispatch.
         struct slot {
             graph *g;
-            size_t index;
-            volatile ::std::thread *worker;
-            ::std::mutex worker_mutex;
+            // set for forks and replicas.
+            ::std::unique_ptr<graph> owned;
+            // added by scaling, may be removed again.
+            bool replica;
+            ::std::thread worker;
+            ring<session> inbox;
+
+            // these are guarded by the dispatcher mutex.
+            bool busy;
+            // when the current session was handed to the slot.
+            ::std::chrono::steady_clock::time_point started;
+            // EWMA of the time taken by a session.
+            double service_ms;
+
+            slot(graph_dispatcher*, graph *_g, graph *_owned = nullptr, bool _replica = false);
+            ~slot();
+
+            void run(session&&);
 
-            slot(graph *_g, size_t idx) : g(_g), index(idx), worker(nullptr) { }
-            ~slot() { }
+        private:
+            void work(graph_dispatcher*);
+            // returns the milliseconds taken to run the graph.
+            double exec(graph_dispatcher*, const session&);
+        };
 
-            void run(graph_dispatcher*, const session&);
+        struct order_state {
+            // dispatched and not yet finalized.
+            ::std::multiset<uint64_t> inflight;
+            // completed and waiting for their turn.
+            ::std::multiset<uint64_t> done;
+            // given up on while still running.
+            ::std::multiset<uint64_t> late;
         };
 
+        size_t m_capacity;
+        overflow_policy m_policy;
+
+        mutable ::std::mutex m_mutex;
+        ::std::condition_variable m_cv;
+        // wakes up slots leaving a queued session to a faster one.
+        ::std::condition_variable m_yield_cv;
         ::std::vector<::std::unique_ptr<slot>> m_slots;
-        index_pool m_pool;
+        // the idle slots and the queue are guarded by m_mutex instead of
+        // an index_pool: the overflow policies take a free slot or a queue
+        // entry, or replace a queued session, in one step. Sessions still
+        // reach a slot's worker through its ring inbox.
+        ::std::vector<slot*> m_idle;
+        ::std::deque<session> m_pending;
+        // dispatch calls blocked for a slot.
+        size_t m_waiting;
+        dispatch_stats m_stats;
+        latency_stats m_latency;
+
+        scaling_policy m_scaling;
+        ::std::thread m_scaler;
+        ::std::condition_variable m_scaler_cv;
+        bool m_stopping;
+        size_t m_idle_ticks;
+        uint64_t m_last_overflow;
+
+        size_t m_order_window;
+        ::std::chrono::milliseconds m_order_timeout;
+        ::std::condition_variable m_order_cv;
+        ::std::unordered_map<::std::string, order_state> m_order;
+        graph_handle_func m_completion;
+
+        // called by a slot which finished a session in ms (< 0 if it was
+        // only woken up), returns the next pending session for it or
+        // puts the slot back to idle.
+        bool next(slot*, session&, double ms);
+        // picks the idle slot with the lowest service time.
+        slot* take_idle();
+        // marks sl busy with s.
+        void start(slot* sl);
+        // when sl should leave queued sessions to faster busy slots,
+        // returns true and the time they are expected to have completed one.
+        bool should_yield(const slot* sl, size_t queued, ::std::chrono::steady_clock::time_point& until) const;
+        static void drop(const session&);
+        // refused is set when nowait and s is left to the caller.
+        bool submit(session&& s, bool nowait, bool& refused);
+
+        // hands the new slot the next pending session, or makes it idle.
+        void add_slot(::std::unique_ptr<slot>&&);
+        void scale();
+        // adjusts by one replica, called with m_mutex held.
+        void scale_once(::std::unique_lock<::std::mutex>&);
+
+        // these are called with m_mutex held.
+        void track(const session&);
+        void untrack(const session&);
+        void skip_before(order_state&, uint64_t seq);
+
+        // blocks until s may be finalized, false if it is late.
+        bool await_turn(const session& s);
+        void finalized(const session& s, const frame_latency&);
 
         friend class slot;
     };
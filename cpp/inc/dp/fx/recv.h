@@ -7,6 +7,7 @@
 #include <vector>
 #include <string>
 #include "dp/types.h"
+#include "dp/util/chunk.h"
 
 namespace dp::fx {
     typedef ::std::function<void(void*, size_t)> recv_handler;
@@ -31,24 +32,32 @@ namespace dp::fx {
 
         int socket_fd() const { return m_socket; }
         void* buf_ptr() { return &m_buf[0]; }
+        // grows the buffer for frames over max_buf_size.
+        void reserve(size_t size) { if (m_buf.size() < size) m_buf.resize(size); }
 
     private:
         int m_socket;
         ::std::vector<uint8_t> m_buf;
     };
 
+    // tcp_recv reads frames prefixed as by encode_stream_prefix.
     class tcp_recv : public socket_recv {
     public:
         tcp_recv(const ::std::string& host, int port = cast_port);
         void run(recv_handler);
+    private:
+        void recv_all(void* buf, size_t size);
     };
 
+    // udp_recv takes a frame per datagram, or reassembles chunks.
+
     class udp_recv : public socket_recv {
     public:
         udp_recv(const ::std::string& host, int port = cast_port);
         void run(recv_handler);
     private:
         sockaddr_in m_remote;
+        reassembler m_chunks;
     };
 }
 
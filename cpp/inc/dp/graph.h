@@ -5,13 +5,24 @@
 #include <string>
 #include <vector>
 #include <list>
+#include <deque>
 #include <unordered_map>
 #include <unordered_set>
 #include <functional>
 #include <stdexcept>
 #include <typeinfo>
+#include <type_traits>
+#include <cstddef>
+#include <new>
+#include <exception>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#include "dp/latency.h"
 
 namespace dp {
+    class executor;
 
     class graph {
     private:
@@ -22,24 +33,43 @@ namespace dp {
         public:
             struct val_base {
                 virtual ~val_base() {}
-                virtual ::std::string type() const = 0;
             };
 
+            // values up to this size which are trivially copyable
+            // are stored in place without allocation.
+            static constexpr size_t inline_size = 32;
+
+            template<typename T>
+            struct fits_inline : ::std::integral_constant<bool,
+                ::std::is_trivially_copyable<T>::value &&
+                sizeof(T) <= inline_size &&
+                alignof(T) <= alignof(::std::max_align_t)> { };
+
             variable(const ::std::string& name);
+            variable(variable&&);
+            variable(const variable&) = delete;
             virtual ~variable();
 
             const ::std::string& name() const { return m_name; }
-            bool is_set() const { return m_val != nullptr; }
-            void set_val(val_base*);
-            val_base* val() const { return m_val; }
-            void clear();
+            bool is_set() const { return m_type != nullptr; }
+            // type of the current value, nullptr if not set.
+            const ::std::type_info* type() const { return m_type; }
+            // marks the variable unset, a value stored out of place
+            // is kept to be reused by the next set of the same type.
+            void clear() { m_type = nullptr; }
 
             variable* must_set();
             const variable* must_set() const;
 
         private:
             ::std::string m_name;
-            val_base* m_val;
+            const ::std::type_info* m_type;
+            typename ::std::aligned_storage<inline_size, alignof(::std::max_align_t)>::type m_inline;
+            val_base* m_heap;
+            const ::std::type_info* m_heap_type;
+
+            template<typename T, bool = fits_inline<T>::value>
+            struct storage;
 
         public:
             class type_error : public ::std::logic_error {
@@ -63,101 +93,263 @@ namespace dp {
 
             template<typename T>
             T& as() const {
-                auto p = dynamic_cast<graph::val<T>*>(const_cast<variable*>(must_set())->m_val);
-                if (p == nullptr) {
-                    throw type_error(m_name, m_val->type(), graph::val<T>().type());
+                auto self = const_cast<variable*>(must_set());
+                if (*m_type != typeid(T)) {
+                    throw type_error(m_name, m_type->name(), typeid(T).name());
                 }
-                return p->value;
+                return storage<T>::get(self);
+            }
+
+            // unchecked access, for vars whose type is
+            // declared by an op_sig and verified by the graph.
+            template<typename T>
+            T& get() const {
+                return storage<T>::get(const_cast<variable*>(this));
             }
 
             template<typename T>
             void set(const T& v) {
-                auto p = new graph::val<T>();
-                p->value = v;
-                set_val(p);
+                storage<T>::assign(this, v);
+                m_type = &typeid(T);
             }
 
             template<typename T>
             void set(T&& v) {
-                auto p = new graph::val<T>();
-                p->value = ::std::move(v);
-                set_val(p);
+                using V = typename ::std::decay<T>::type;
+                storage<V>::assign(this, ::std::forward<T>(v));
+                m_type = &typeid(V);
             }
         };
 
         template<typename T>
         struct val : public variable::val_base {
             T value;
-            virtual ::std::string type() const {
-                return typeid(val).name();
-            }
         };
 
         class ctx {
         public:
             const ::std::string& name() const { return m_op->name; }
-            const ::std::vector<variable*>& in() const { return m_op->params; }
-            const ::std::vector<variable*>& out() const { return m_op->results; }
+            size_t in_size() const { return m_op->params.size(); }
+            size_t out_size() const { return m_op->results.size(); }
 
-            variable* in(size_t at) const { return in()[at]; }
-            variable* out(size_t at) const { return out()[at]; }
+            variable* in(size_t at) const { return &m_graph->m_vars[m_op->params[at]]; }
+            variable* out(size_t at) const { return &m_graph->m_vars[m_op->results[at]]; }
+
+            // unchecked access to params of typed ops.
+            template<typename T>
+            T& in(size_t at) const { return in(at)->get<T>(); }
+
+            // the timing of the current frame so far, see graph::latency.
+            const frame_latency& latency() const { return m_graph->m_latency; }
+            // the name of an op by its index into frame_latency.
+            const ::std::string& op_name(size_t index) const { return m_graph->m_prog->ops[index].name; }
 
             ::std::function<void()> defer();
 
         private:
+            graph *m_graph;
             const op *m_op;
             ::std::function<void()> *m_done_ptr;
 
-            ctx(op *op, ::std::function<void()> *done_ptr)
-            : m_op(op), m_done_ptr(done_ptr) { }
+            ctx(graph *g, const op *op, ::std::function<void()> *done_ptr)
+            : m_graph(g), m_op(op), m_done_ptr(done_ptr) { }
 
-            friend class op;
+            friend class graph;
         };
 
         using op_func = ::std::function<void(ctx)>;
 
+        // types of the params and results of an op,
+        // a nullptr entry accepts any type.
+        // An empty signature leaves the op untyped.
+        struct op_sig {
+            ::std::vector<const ::std::type_info*> in;
+            ::std::vector<const ::std::type_info*> out;
+
+            op_sig() { }
+            op_sig(const ::std::vector<const ::std::type_info*>& i,
+                const ::std::vector<const ::std::type_info*>& o)
+            : in(i), out(o) { }
+
+            bool empty() const { return in.empty() && out.empty(); }
+        };
+
+        template<typename T>
+        static const ::std::type_info* type_of() { return &typeid(T); }
+
+        template<typename... T> struct inputs { };
+        template<typename... T> struct outputs { };
+
+        // base of ops declaring their signature as template parameters,
+        // e.g. typed_op<inputs<buf_ref>, outputs<image_id>>,
+        // void declares a param or result of any type.
+        template<typename In, typename Out>
+        struct typed_op;
+
         graph(const ::std::string& name = ::std::string());
 
         const ::std::string& name() const { return m_name; }
 
         variable* def_var(const ::std::string& name);
         void def_vars(const ::std::vector<::std::string>& names);
+        // the types in sig are checked against the other ops using
+        // the same vars, then enforced on the values set at runtime.
         void add_op(const ::std::string& name,
             const ::std::vector<::std::string>& inputs,
             const ::std::vector<::std::string>& outputs,
-            const op_func& fn);
+            const op_func& fn, const op_sig& sig = op_sig());
+
+        template<typename Op>
+        auto add_op(const ::std::string& name,
+            const ::std::vector<::std::string>& inputs,
+            const ::std::vector<::std::string>& outputs,
+            const Op& fn) -> decltype(Op::signature(), void()) {
+            add_op(name, inputs, outputs, op_func(fn), Op::signature());
+        }
+
+        // freezes the ops into index based successor lists,
+        // called by exec if the graph changed since last compile.
+        void compile();
 
         variable* find_var(const ::std::string& name) const noexcept;
         variable* var(const ::std::string& name) const;
+        // clears the vars and the latency record.
         void reset();
-        void exec(size_t concurrency = 4);
+        // runs all ready ops on the executor (the shared one if null),
+        // returns when no more ops can be activated.
+        void exec(executor* ex = nullptr);
+
+        // creates a graph sharing the ops of this one with its own vars,
+        // so several frames can be in flight through the same ops.
+        // Each op runs one frame at a time across all the forks, in the
+        // order the frames become ready for it.
+        // The graph can't be modified once forked.
+        graph* fork() const;
+
+        // exec records when each op runs, the dispatcher
+        // the stages around it.
+        frame_latency& latency() { return m_latency; }
+        const frame_latency& latency() const { return m_latency; }
 
     private:
+        static constexpr size_t none = (size_t)(-1);
+
         struct op {
             ::std::string name;
             op_func fn;
-            ::std::vector<variable*> params;
-            ::std::vector<variable*> results;
-            bool activated;
+            // indices into the vars.
+            ::std::vector<size_t> params;
+            ::std::vector<size_t> results;
+            // params not produced by any op, set by the initializer.
+            ::std::vector<size_t> sources;
+            // indices into the ops consuming the results,
+            // once per consuming param.
+            ::std::vector<size_t> successors;
+            // number of params produced by other ops.
+            size_t deps;
 
             op(const ::std::string& _name, const op_func& _fn)
-            : name(_name), fn(_fn), activated(false) { }
+            : name(_name), fn(_fn), deps(0) { }
+        };
 
-            bool ready() const {
-                for (auto& v : params) {
-                    if (!v->is_set()) return false;
-                }
-                return true;
-            }
+        // serializes one op across the forks of a graph.
+        struct op_lane {
+            ::std::mutex mutex;
+            bool busy;
+            ::std::deque<graph*> waiting;
 
-            void run(::std::function<void()>);
+            op_lane() : busy(false) { }
+        };
+
+        // ops and var names shared by a graph and its forks.
+        struct program {
+            ::std::vector<op> ops;
+            ::std::vector<::std::string> vars;
+            // index of the op producing each var, or none.
+            ::std::vector<size_t> producers;
+            // declared type of each var, or nullptr.
+            ::std::vector<const ::std::type_info*> types;
+            // typed vars not produced by any op.
+            ::std::vector<size_t> typed_sources;
+            bool compiled;
+            bool forked;
+            ::std::unique_ptr<op_lane[]> lanes;
+
+            // only used for building and lookup.
+            ::std::unordered_map<::std::string, size_t> var_names;
+            ::std::unordered_map<::std::string, size_t> op_names;
+
+            program() : compiled(false), forked(false) { }
         };
 
         ::std::string m_name;
+        ::std::shared_ptr<program> m_prog;
+
+        // indexed by the program, and in a deque so the
+        // pointers returned by def_var stay valid.
+        ::std::deque<variable> m_vars;
+        // deps not yet satisfied in the current exec, per op.
+        ::std::unique_ptr<::std::atomic<size_t>[]> m_pending;
+        frame_latency m_latency;
+
+        executor* m_executor;
+        ::std::atomic<size_t> m_active;
+        ::std::atomic<bool> m_failed;
+        ::std::exception_ptr m_error;
+        // set under m_exec_mutex by the last completion, which may
+        // touch nothing else of the graph after exec saw it.
+        bool m_done;
+        ::std::mutex m_exec_mutex;
+        ::std::condition_variable m_exec_cv;
+
+        program* build_prog();
+        void activate(size_t);
+        void release(size_t);
+        void run(size_t);
+        void complete(size_t, ::std::exception_ptr);
+        bool check_type(size_t var, ::std::exception_ptr&) const;
+    };
+
+    template<>
+    inline const ::std::type_info* graph::type_of<void>() { return nullptr; }
+
+    template<typename... In, typename... Out>
+    struct graph::typed_op<graph::inputs<In...>, graph::outputs<Out...>> {
+        static op_sig signature() {
+            return op_sig({ type_of<In>()... }, { type_of<Out>()... });
+        }
+    };
 
-        ::std::unordered_map<::std::string, ::std::unique_ptr<variable> > m_vars;
-        ::std::unordered_map<::std::string, ::std::unique_ptr<op> > m_ops;
-        ::std::unordered_map<::std::string, ::std::string> m_out_vars;
+    template<typename T>
+    struct graph::variable::storage<T, true> {
+        static T& get(variable* v) {
+            return *reinterpret_cast<T*>(&v->m_inline);
+        }
+
+        template<typename U>
+        static void assign(variable* v, U&& value) {
+            new (&v->m_inline) T(::std::forward<U>(value));
+        }
+    };
+
+    template<typename T>
+    struct graph::variable::storage<T, false> {
+        static T& get(variable* v) {
+            return static_cast<graph::val<T>*>(v->m_heap)->value;
+        }
+
+        template<typename U>
+        static void assign(variable* v, U&& value) {
+            if (v->m_heap_type == nullptr || *v->m_heap_type != typeid(T)) {
+                v->m_type = nullptr;
+                v->m_heap_type = nullptr;
+                delete v->m_heap;
+                v->m_heap = nullptr;
+                v->m_heap = new graph::val<T>();
+                v->m_heap_type = &typeid(T);
+            }
+            get(v) = ::std::forward<U>(value);
+        }
     };
 }
 
@@ -15,11 +15,27 @@ namespace dp {
     public:
         using params = ::std::unordered_map<::std::string, ::std::string>;
 
+        // helpers for factories reading params, a missing or empty param
+        // gets the default, a value not parsed or out of [min, max]
+        // throws invalid_argument.
+        static ::std::string param(const params&, const ::std::string& key);
+        static long int_param(const params&, const ::std::string& key,
+            long def, long min, long max);
+        static double real_param(const params&, const ::std::string& key,
+            double def, double min);
+        // true for "true" or "1".
+        static bool bool_param(const params&, const ::std::string& key);
+
         struct op_factory {
             virtual ~op_factory() { }
             virtual graph::op_func create_op(
                 const ::std::string& name,
                 const ::std::string& type, const params&) = 0;
+            // types of the vars the op uses, checked when the graph is built.
+            virtual graph::op_sig signature(
+                const ::std::string& type, const params&) {
+                return graph::op_sig();
+            }
         };
 
         struct ingress_factory {
@@ -39,6 +55,10 @@ namespace dp {
                 const ::std::string& type,
                 const params&);
 
+            virtual graph::op_sig signature(
+                const ::std::string& type,
+                const params&);
+
             void add_factory(const ::std::string& name, op_factory*);
             op_factory* get_factory(const ::std::string& name) const;
 
@@ -105,6 +125,8 @@ namespace dp {
 
         graph_def& select_graph(const ::std::string& name);
 
+        // the env builds its replicas from this graph_def,
+        // which must outlive it.
         exec_env& build_env(exec_env&, const params& args) const;
 
         ::std::vector<::std::string> graph_names() const;
@@ -20,6 +20,18 @@ namespace dp {
 
         virtual void stop() { m_running = false; }
 
+        // an ingress with a poll_fd can share a thread with others, see
+        // runner::set_multiplex. The fd is readable when poll may have
+        // sessions to dispatch, and poll dispatches them without blocking.
+        // poll returns false when it stalled, e.g. out of buffers, to be
+        // polled again shortly instead of when the fd is readable.
+        virtual int poll_fd() const { return -1; }
+        virtual bool poll(dispatcher*);
+
+        // a one-line summary of the counters of the ingress for the
+        // log, empty when it keeps none.
+        virtual ::std::string stats_line() { return ::std::string(); }
+
     protected:
         ::std::string m_input_var;
         volatile bool m_running;
@@ -35,6 +47,14 @@ namespace dp {
 
             void add(ingress*);
 
+            // with multiplex, the ingresses with a poll_fd all run on one
+            // epoll thread, the others still get a thread each. Sessions
+            // the dispatcher can't take right away are held and retried,
+            // and their ingress isn't polled until they are taken. Should
+            // epoll fail, the thread logs it, drops the held sessions and
+            // polls no more.
+            void set_multiplex(bool multiplex) { m_multiplex = multiplex; }
+
             void start(dispatcher*);
             void stop();
             void join();
@@ -42,14 +62,43 @@ namespace dp {
         private:
             ::std::vector<ingress*> m_ingresses;
             ::std::vector<::std::unique_ptr<::std::thread>> m_threads;
+            bool m_multiplex;
+            // wakes the epoll thread on stop.
+            int m_wake;
+            // what the polled ingresses dispatch to, kept as long as the
+            // runner since an ingress may still use it, e.g. for load.
+            ::std::vector<::std::unique_ptr<dispatcher>> m_polled;
+
+            void poll_all(const ::std::vector<ingress*>&, dispatcher*);
         };
     };
 
     struct exec_env {
-        graph_dispatcher dispatcher;
-        ingress::runner runner;
         ::std::list<::std::unique_ptr<graph>> graphs;
         ::std::list<::std::unique_ptr<ingress>> ingresses;
+        // after the graphs and ingresses, so its workers are
+        // joined before the sessions lose what they work on.
+        graph_dispatcher dispatcher;
+        ingress::runner runner;
+        // frames in flight through each graph.
+        size_t frames;
+        // sessions waiting for a free graph, and what to do beyond.
+        size_t queue_size;
+        overflow_policy overflow;
+        // finalize frames in per-source order, see graph_dispatcher::set_order,
+        // the ops of the graphs still run and publish out of order.
+        size_t order_window;
+        ::std::chrono::milliseconds order_timeout;
+        // grows up to max_graphs graph instances under load by
+        // adding replicas from replicate, 0 disables scaling.
+        size_t max_graphs;
+        graph_factory_func replicate;
+        // runs pollable ingresses on one thread, see runner::set_multiplex.
+        bool multiplex;
+
+        exec_env()
+        : frames(1), queue_size(0), overflow(overflow_policy::block),
+          order_window(0), order_timeout(0), max_graphs(0), multiplex(false) { }
 
         void build();
 
@@ -0,0 +1,63 @@
+#ifndef __DP_INGRESS_PCAP_H
+#define __DP_INGRESS_PCAP_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <netinet/in.h>
+
+#include "dp/ingress.h"
+#include "dp/util/pool.h"
+#include "dp/util/chunk.h"
+
+namespace dp::in {
+    // pcap replays the camera datagrams of a capture file (classic pcap,
+    // Ethernet, raw IP or Linux cooked captures) sent to port, and turns
+    // them into sessions as dp.udp would, chunks and image ids included.
+    // IPv4 fragments are put back together when the file is loaded.
+    // Datagrams are sent at their captured times divided by speed, so
+    // bursts keep their shape; speed = 0 replays as fast as possible.
+    class pcap : public ingress {
+    public:
+        pcap(const ::std::string& path, uint16_t port = 2052,
+            double speed = 1, bool loop = false, size_t buf_count = 8,
+            size_t frame_size = max_frame_size);
+        virtual ~pcap();
+
+        size_t datagrams() const { return m_datagrams.size(); }
+
+        static void register_factory();
+
+    protected:
+        virtual bool prepare_session(session&, bool nowait);
+
+    private:
+        struct datagram {
+            const char *ptr;
+            size_t len;
+            sockaddr_in from;
+            // since the first datagram in the capture.
+            ::std::chrono::nanoseconds time;
+        };
+
+        void *m_map;
+        size_t m_map_len;
+        uint16_t m_port;
+        double m_speed;
+        bool m_loop;
+        ::std::vector<datagram> m_datagrams;
+        // datagrams put back together from fragments.
+        ::std::vector<::std::vector<char>> m_defragged;
+        size_t m_pos;
+        ::std::chrono::steady_clock::time_point m_start;
+        index_pool m_pool;
+        ::std::vector<::std::unique_ptr<char[]>> m_bufs;
+        reassembler m_chunks;
+
+        void load(const ::std::string& path);
+        void pace(const datagram&);
+    };
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef __DP_INGRESS_REPLAY_H
+#define __DP_INGRESS_REPLAY_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+
+#include "dp/ingress.h"
+#include "dp/util/pool.h"
+
+namespace dp::in {
+    // replay feeds recorded frames for benchmarking, as dp.udp would
+    // receive them. The path is a JPEG file, a directory of JPEG files
+    // replayed in name order, or a file of frames each prefixed by a
+    // 32-bit length in network byte order, as dp.tcp receives them.
+    // Files are mapped, and every frame is copied into a pooled buffer.
+    // fps = 0 replays as fast as the graphs take frames. Frames without
+    // an image id get one from source, by default the base name of path.
+    // With loop, the seq of frames carrying an id is raised every lap past
+    // the ones before, so per-source ordering doesn't hold them back as
+    // repeats. The id in the frame itself keeps the recorded seq.
+    class replay : public ingress {
+    public:
+        replay(const ::std::string& path, double fps = 0, bool loop = false,
+            const ::std::string& source = ::std::string(), size_t buf_count = 8);
+        virtual ~replay();
+
+        size_t frames() const { return m_frames.size(); }
+
+        static void register_factory();
+
+    protected:
+        virtual bool prepare_session(session&, bool nowait);
+
+    private:
+        struct mapping {
+            void *ptr;
+            size_t len;
+        };
+
+        struct frame {
+            const char *ptr;
+            size_t len;
+        };
+
+        bool m_loop;
+        ::std::string m_source;
+        ::std::chrono::steady_clock::duration m_period;
+        ::std::chrono::steady_clock::time_point m_next;
+        ::std::vector<mapping> m_maps;
+        ::std::vector<frame> m_frames;
+        size_t m_pos;
+        uint64_t m_seq;
+        // added to the recorded seqs in this lap, and the largest of them.
+        uint64_t m_seq_offset;
+        uint64_t m_lap_max;
+        size_t m_buf_size;
+        index_pool m_pool;
+        ::std::vector<::std::unique_ptr<char[]>> m_bufs;
+
+        void load(const ::std::string& path);
+        void pace();
+    };
+}
+
+#endif
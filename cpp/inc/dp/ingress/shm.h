@@ -0,0 +1,66 @@
+#ifndef __DP_INGRESS_SHM_H
+#define __DP_INGRESS_SHM_H
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <unordered_map>
+
+#include "dp/ingress.h"
+#include "dp/util/shm.h"
+#include "dp/util/chunk.h"
+
+namespace dp::in {
+    // shm serves producers on the same host, e.g. camera agents, which
+    // connect to the Unix socket at path and get a shm_channel of their
+    // own. Frames are worked on in place in the shared slots: encoded
+    // ones as a buf_ref, raw ones as a cv::Mat, and a slot goes back to
+    // its producer once the session is done. publish sends results back
+    // to all the producers of a bus, see dp.shm_pub. It can be polled
+    // by a runner.
+    class shm : public ingress {
+    public:
+        shm(const ::std::string& path, size_t slots = 8,
+            size_t slot_size = max_frame_size);
+        virtual ~shm();
+
+        virtual void run(dispatcher*);
+        virtual int poll_fd() const { return m_epoll; }
+        virtual bool poll(dispatcher*);
+
+        // returns the number of producers msg went to.
+        static size_t publish(const ::std::string& path, const ::std::string& msg);
+
+        static void register_factory();
+
+    private:
+        struct producer {
+            ::std::shared_ptr<shm_channel> channel;
+            ::std::string source;
+            uint64_t seq;
+        };
+
+        ::std::string m_path;
+        int m_socket;
+        int m_epoll;
+        size_t m_slots;
+        size_t m_slot_size;
+        size_t m_connected;
+        // by socket and by ready_fd, guarded for publish.
+        ::std::unordered_map<int, ::std::shared_ptr<producer>> m_producers;
+        ::std::mutex m_mutex;
+        // sockets accepted but not sent their hello yet, by deadline.
+        ::std::unordered_map<int, ::std::chrono::steady_clock::time_point> m_handshakes;
+
+        void wait(dispatcher*, int timeout_ms);
+        void accept_producers();
+        void handshake(int fd);
+        void expire_handshakes();
+        void close_producer(const ::std::shared_ptr<producer>&);
+        void receive(producer&, dispatcher*);
+        size_t broadcast(const ::std::string& msg);
+    };
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef __DP_INGRESS_TCP_H
+#define __DP_INGRESS_TCP_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <atomic>
+
+#include "dp/ingress.h"
+#include "dp/util/pool.h"
+#include "dp/util/chunk.h"
+
+namespace dp::in {
+    // tcp accepts any number of connections, each carrying frames
+    // prefixed by a 32-bit length in network byte order. A zero length
+    // is a keepalive. One epoll loop serves all connections: it reads
+    // in large chunks, parses every frame a read holds, and receives
+    // the rest of a large frame straight into its pooled buffer.
+    // While all buffers are in the graphs, connections with a new frame
+    // stop being read, which holds back the cameras by flow control.
+    // The loop never blocks on the graphs, so it can be polled by a runner.
+    class tcp : public ingress {
+    public:
+        static constexpr uint16_t default_port = 2052;
+
+        tcp(uint16_t port = default_port, size_t buf_count = 16,
+            size_t frame_size = max_frame_size);
+        virtual ~tcp();
+
+        virtual void run(dispatcher*);
+        virtual int poll_fd() const { return m_epoll; }
+        virtual bool poll(dispatcher*);
+
+        static void register_factory();
+
+    private:
+        struct conn {
+            int fd;
+            ::std::string source;
+            ::std::vector<char> buf;
+            size_t head, tail;
+            // the frame being received into a pooled buffer.
+            size_t slot;
+            size_t frame_len, frame_got;
+            bool paused;
+        };
+
+        int m_socket;
+        int m_epoll;
+        // signaled when a buffer comes back to paused connections.
+        int m_wake;
+        ::std::atomic<bool> m_starved;
+        ::std::vector<int> m_paused;
+        size_t m_frame_size;
+        index_pool m_pool;
+        ::std::vector<::std::unique_ptr<char[]>> m_bufs;
+        ::std::unordered_map<int, ::std::unique_ptr<conn>> m_conns;
+
+        void wait(dispatcher*, int timeout_ms);
+        void accept_conns();
+        void read(conn&, dispatcher*);
+        // false if the connection has to be closed.
+        bool parse(conn&, dispatcher*);
+        void close_conn(conn&);
+        void pause(conn&);
+        void resume(dispatcher*);
+        size_t take_buf();
+        void release(size_t slot);
+        void deliver(conn&, size_t slot, size_t len, dispatcher*);
+    };
+}
+
+#endif
@@ -1,26 +1,176 @@
 #ifndef __DP_INGRESS_UDP_H
 #define __DP_INGRESS_UDP_H
 
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <netinet/in.h>
+
 #include "dp/ingress.h"
 #include "dp/util/pool.h"
+#include "dp/util/uring.h"
+#include "dp/util/chunk.h"
+#include "dp/util/fair_queue.h"
 
 namespace dp::in {
+    // udp receives one image per datagram. With threads > 1 it opens
+    // that many SO_REUSEPORT sockets on the port, each drained by its
+    // own thread, and every recvmmsg call takes up to batch datagrams.
+    // With use_uring, a single io_uring loop drives all the sockets
+    // with multishot receives into kernel-selected buffers, and sessions
+    // work on those buffers in place. It falls back to threads when
+    // io_uring isn't available.
+    // Datagrams carrying a chunk_header are reassembled into frames
+    // of up to frame_size, one datagram per frame otherwise. Each is
+    // received into a buffer of datagram_size bytes, which can be far
+    // smaller than a datagram when the sources send chunks.
+    // Sessions carry the SO_TIMESTAMPNS receive time of the datagram
+    // completing their frame, see frame_latency.
+    // With set_fairness, frames wait in a fair_queue per source instead
+    // of being dispatched by the receiving thread: a thread of their own
+    // dispatches them round-robin, and a source sending faster than its
+    // share is coalesced to its latest frames. Out of buffers, the oldest
+    // frame of the source with the most waiting makes room.
+    // With one thread, no io_uring and no fairness, it can be polled by
+    // a runner.
+    // get_stats counts what is lost on the way: datagrams the kernel
+    // dropped (SO_RXQ_OVFL) and waits for a free buffer, which can't be
+    // told apart by source, and per source the datagrams larger than
+    // datagram_size, frames refused by a nowait dispatch, e.g. when
+    // polled by a runner, and frames coalesced away.
+    // With set_feedback, a thread sends a rate_feedback back to the
+    // address each source sends from every interval while the load of
+    // the dispatcher or the frames it loses call for a lower rate. A
+    // source which goes quiet gets none, and comes back unlimited.
     class udp : public ingress {
     public:
         static constexpr uint16_t default_port = 2052;
+        // takes any UDP payload.
+        static constexpr size_t default_datagram_size = 0x10000;
+
+        struct source_stats {
+            uint64_t frames;
+            // datagrams larger than a buffer, dropped.
+            uint64_t truncated;
+            // frames refused by a nowait dispatch, dropped.
+            uint64_t rejected;
+            // frames displaced or evicted by fairness.
+            uint64_t coalesced;
+
+            source_stats() : frames(0), truncated(0), rejected(0), coalesced(0) { }
+        };
+
+        struct stats {
+            uint64_t datagrams;
+            uint64_t kernel_drops;
+            uint64_t pool_waits;
+            // rate_feedback datagrams sent.
+            uint64_t feedback;
+            reassembler::stats chunks;
+            // by image_id source, or the sender address when a datagram
+            // has none. Past 1024 sources the rest are counted under "*".
+            ::std::unordered_map<::std::string, source_stats> sources;
 
-        udp(uint16_t port = default_port, size_t buf_count = 8);
+            stats() : datagrams(0), kernel_drops(0), pool_waits(0), feedback(0) { }
+        };
+
+        udp(uint16_t port = default_port, size_t buf_count = 8,
+            size_t threads = 1, size_t batch = 1, bool use_uring = false,
+            size_t frame_size = max_frame_size,
+            size_t datagram_size = default_datagram_size);
         virtual ~udp();
 
+        virtual void run(dispatcher*);
+        virtual void stop();
+        virtual int poll_fd() const;
+        virtual bool poll(dispatcher*);
+
+        // lets up to depth frames per source wait, see fair_queue,
+        // before run. 0 dispatches right away.
+        void set_fairness(size_t depth, const ::std::unordered_map<::std::string, size_t>& weights = {});
+        // sets SO_RCVBUF of the sockets, or SO_RCVBUFFORCE when permitted,
+        // warning when the kernel caps it.
+        void set_receive_buffer(size_t bytes);
+        // sends rate feedback to the sources every interval,
+        // before run. 0 disables it.
+        void set_feedback(::std::chrono::milliseconds interval);
+
+        stats get_stats();
+        virtual ::std::string stats_line();
+
         static void register_factory();
 
     protected:
         virtual bool prepare_session(session&, bool nowait);
 
     private:
-        int m_socket;
+        ::std::vector<int> m_sockets;
+        size_t m_batch;
+        size_t m_buf_size;
         void* m_bufs;
         index_pool m_pool;
+        reassembler m_chunks;
+
+        ::std::unique_ptr<uring> m_io;
+        uring::buffer_group *m_group;
+        dispatcher *m_disp;
+        // receives on the loop thread stopped by -ENOBUFS or errors.
+        ::std::vector<bool> m_armed;
+        ::std::atomic<size_t> m_held;
+        ::std::atomic<bool> m_starved;
+        ::std::unique_ptr<fair_queue<session>> m_fair;
+
+        ::std::atomic<uint64_t> m_datagrams;
+        ::std::atomic<uint64_t> m_kernel_drops;
+        ::std::atomic<uint64_t> m_pool_waits;
+        // the SO_RXQ_OVFL count last seen per socket.
+        ::std::vector<uint32_t> m_drop_marks;
+        ::std::unordered_map<::std::string, source_stats> m_sources;
+        // the address each source sent its latest frame from,
+        // kept with feedback, guarded by m_stats_mutex.
+        ::std::unordered_map<::std::string, sockaddr_in> m_addrs;
+        ::std::mutex m_stats_mutex;
+
+        ::std::chrono::milliseconds m_feedback_interval;
+        ::std::thread m_feedback;
+        ::std::mutex m_feedback_mutex;
+        ::std::condition_variable m_feedback_cv;
+        ::std::atomic<uint64_t> m_feedback_sent;
+
+        // counts a datagram received on the socket at index, drops is
+        // what the socket dropped so far.
+        void count_received(size_t index, uint32_t drops);
+        void count_truncated(const sockaddr_in&);
+        // the entry of a source, with m_stats_mutex held.
+        source_stats& source(const ::std::string&);
+
+        void receive(size_t index, dispatcher*);
+        // dispatches s received from sa, or queues it with fairness.
+        void deliver(session& s, const sockaddr_in& sa, dispatcher*, bool nowait = false);
+        // starts the feedback thread once, if enabled.
+        void start_feedback(dispatcher*);
+        void feedback(dispatcher*);
+        // drains the fair queue into the dispatcher.
+        void forward(dispatcher*);
+        // a free buffer, making room in the fair queue when out of them.
+        size_t take_buffer();
+        // drops the queued frame of the source with the most waiting.
+        bool evict();
+        void arm(size_t index);
+        void rearm();
+        void release(uint16_t bid);
+        // fills the session for the datagram received into buf at
+        // received, release is called once the session is done with it.
+        // Returns false for a chunk which doesn't complete a frame.
+        bool make_session(session&, void* buf, size_t len, size_t cap,
+            const sockaddr_in&, int64_t received, ::std::function<void()> release);
     };
 }
 
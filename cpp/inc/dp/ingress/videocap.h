@@ -1,12 +1,30 @@
 #ifndef __DP_INGRESS_VIDEOCAP_H
 #define __DP_INGRESS_VIDEOCAP_H
 
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <opencv2/videoio/videoio.hpp>
 #include "dp/ingress.h"
+#include "dp/util/pool.h"
 
 namespace dp::in {
+    // video_capture grabs frames on its own thread while running, so the
+    // camera is drained even when dispatch blocks. Only the latest frame
+    // is kept for the next session, older ones go back to the buffers.
+    // A frame stays in its buffer until the session is done with it,
+    // and buffers are reused without reallocating. With no free buffer,
+    // frames are grabbed and discarded without decoding.
+    // A video file plays at its own frame rate like a camera would, and
+    // the frames the graphs can't take are skipped the same way.
+    // Failed reads are retried with a growing delay, capturing stops at
+    // the end of a file or after max_read_failures in a row.
     class video_capture : public ingress {
     public:
+        static constexpr int max_read_failures = 20;
+
         video_capture();
         video_capture(const ::std::string&);
         video_capture(int);
@@ -20,9 +38,15 @@ namespace dp::in {
         void close();
 
         void set_frame_size(int w, int h);
+        void set_fps(double fps);
+        // at least 3: one being captured, the latest and one in a graph.
+        void set_buffers(size_t n);
 
         void show_to(const ::std::string& name) { m_show_name = name; }
 
+        virtual void run(dispatcher*);
+        virtual void stop();
+
         static void register_factory();
 
     protected:
@@ -31,6 +55,17 @@ namespace dp::in {
     private:
         ::cv::VideoCapture m_cap;
         ::std::string m_show_name;
+
+        ::std::vector<::cv::Mat> m_frames;
+        index_pool m_free;
+        // the latest captured frame not taken yet, or none.
+        size_t m_latest;
+        bool m_capturing;
+        ::std::mutex m_mutex;
+        ::std::condition_variable m_cv;
+
+        void capture();
+        void wait_until(::std::chrono::steady_clock::time_point);
     };
 }
 
@@ -0,0 +1,91 @@
+#ifndef __DP_LATENCY_H
+#define __DP_LATENCY_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+
+namespace dp {
+    // frame_latency records the way of a frame from its arrival to the
+    // end of its finalizer. Times are steady_clock nanoseconds since
+    // its epoch, 0 for the stages the frame didn't go through (yet).
+    struct frame_latency {
+        // ops may read the spans of ops still running.
+        struct span {
+            ::std::atomic<int64_t> begin, end;
+            span() : begin(0), end(0) { }
+        };
+
+        // when the frame arrived, the kernel receive time if the
+        // ingress has it, otherwise when it was dispatched.
+        int64_t received;
+        // when it was handed to dispatch, and when a slot started on it.
+        int64_t dispatched;
+        int64_t started;
+        // when the last op completed.
+        int64_t executed;
+        span finalizer;
+
+        frame_latency() : received(0), dispatched(0), started(0), executed(0), m_op_count(0) { }
+
+        // indexed like the ops of the graph, see graph::ctx::op_name.
+        size_t op_count() const { return m_op_count; }
+        span& op(size_t at) { return m_ops[at]; }
+        const span& op(size_t at) const { return m_ops[at]; }
+
+        void resize(size_t op_count);
+        void clear();
+
+        static int64_t now() {
+            return ::std::chrono::duration_cast<::std::chrono::nanoseconds>(
+                ::std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        // converts a CLOCK_REALTIME time, e.g. SO_TIMESTAMPNS,
+        // assuming it is not far in the past.
+        static int64_t from_realtime(const timespec&);
+
+    private:
+        ::std::unique_ptr<span[]> m_ops;
+        size_t m_op_count;
+    };
+
+    // latency_histogram counts durations in log-linear buckets, so
+    // percentiles are within 1/sub_buckets of the true value.
+    class latency_histogram {
+    public:
+        static constexpr size_t sub_bits = 4;
+        static constexpr size_t sub_buckets = 1 << sub_bits;
+
+        latency_histogram();
+
+        void add(int64_t ns);
+        void merge(const latency_histogram&);
+
+        uint64_t count() const { return m_count; }
+        int64_t max() const { return m_max; }
+        double mean() const { return m_count > 0 ? (double)m_sum / m_count : 0; }
+        // p in [0, 1], 0 if nothing was added.
+        int64_t percentile(double p) const;
+
+        // e.g. "n=100 mean=1.2ms p50=1.1ms p90=1.6ms p99=2.3ms max=2.5ms".
+        ::std::string summary() const;
+
+    private:
+        static constexpr size_t bucket_count = (64 - sub_bits + 1) * sub_buckets;
+
+        ::std::vector<uint64_t> m_buckets;
+        uint64_t m_count;
+        int64_t m_sum;
+        int64_t m_max;
+
+        static size_t bucket(uint64_t ns);
+        static uint64_t lower_bound(size_t bucket);
+    };
+}
+
+#endif
@@ -2,10 +2,15 @@
 #define __DP_OPERATORS_H
 
 #include <string>
+#include <vector>
 
 #include "dp/graph.h"
 #include "dp/types.h"
 
+namespace cv {
+    class Mat;
+}
+
 namespace dp::op {
     struct wrap {
         graph::op_func fn;
@@ -13,15 +18,15 @@ namespace dp::op {
         void operator() (graph::ctx ctx) { fn(ctx); }
     };
 
-    struct image_id {
+    struct image_id : graph::typed_op<graph::inputs<buf_ref>, graph::outputs<dp::image_id>> {
         void operator() (graph::ctx);
     };
 
-    struct decode_image {
+    struct decode_image : graph::typed_op<graph::inputs<buf_ref>, graph::outputs<::cv::Mat, image_size>> {
         void operator() (graph::ctx);
     };
 
-    struct save_image {
+    struct save_image : graph::typed_op<graph::inputs<buf_ref, dp::image_id>, graph::outputs<>> {
         ::std::string prefix, suffix;
         save_image(const ::std::string& _prefix = "img",
             const ::std::string& _suffix = ".jpg")
@@ -29,11 +34,27 @@ namespace dp::op {
         void operator() (graph::ctx);
     };
 
-    struct detect_boxes_json {
+    // with latency, the json has a latency_us breakdown
+    // of the frame so far, see frame_latency.
+    struct detect_boxes_json : graph::typed_op<
+        graph::inputs<image_size, dp::image_id, ::std::vector<detect_box>>, graph::outputs<::std::string>> {
+        bool latency;
+        detect_boxes_json(bool _latency = false) : latency(_latency) { }
+        void operator() (graph::ctx);
+
+    private:
+        static ::std::string latency_json(graph::ctx);
+    };
+
+    // sends results back to the producers of the dp.shm bus at path.
+    struct shm_pub : graph::typed_op<graph::inputs<::std::string>, graph::outputs<>> {
+        ::std::string path;
+        shm_pub(const ::std::string& _path) : path(_path) { }
         void operator() (graph::ctx);
     };
 
-    struct sensitivity {
+    struct sensitivity : graph::typed_op<
+        graph::inputs<image_size, void, ::std::vector<detect_box>>, graph::outputs<::std::vector<float>>> {
         struct mat : public ::std::vector<float> {
             // dimensions:
             // w_weight, a, b, c
@@ -0,0 +1,116 @@
+#ifndef __DP_UTIL_CHUNK_H
+#define __DP_UTIL_CHUNK_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <chrono>
+
+#include "dp/util/pool.h"
+
+namespace dp {
+    // frames larger than a datagram travel as chunks, each one
+    // a datagram starting with a chunk_header in network byte order.
+    // The magic never starts a JPEG (0xffd8), so chunked and whole
+    // frames can share a socket.
+    struct chunk_header {
+        static constexpr uint16_t magic = 0x4450;
+        static constexpr uint8_t version = 1;
+        static constexpr size_t size = 20;
+
+        uint32_t frame;
+        uint16_t index;
+        uint16_t count;
+        // the size of the whole frame, and where this chunk goes.
+        uint32_t frame_size;
+        uint32_t offset;
+
+        void encode(void* buf) const;
+        // false if buf doesn't start with a valid header.
+        static bool decode(const void* buf, size_t len, chunk_header&);
+    };
+
+    // largest frame accepted from chunks or streams.
+    constexpr size_t max_frame_size = 4 << 20;
+    // a datagram which won't be fragmented on usual links.
+    constexpr size_t default_chunk_size = 1400;
+    // largest payload of a UDP datagram.
+    constexpr size_t max_datagram_size = 65507;
+
+    // encodes the chunks of a frame into out, back to back, every one
+    // chunk_size bytes including its header, except the last.
+    // Returns the number of chunks, throws if over 0xffff.
+    size_t encode_chunks(uint32_t frame, const void* data, size_t size,
+        size_t chunk_size, ::std::vector<uint8_t>& out);
+
+    // streams prefix every frame by its size: a 16-bit size, or
+    // 0xffff followed by a 32-bit size, both in host byte order.
+    constexpr size_t max_stream_prefix = 6;
+    size_t encode_stream_prefix(size_t size, void* buf);
+
+    // reassembler puts chunked frames back together into a fixed set
+    // of slots, each up to max_frame_size and allocated on first use.
+    // Chunks must be laid out as encode_chunks does, so a complete frame
+    // covers every byte of its slot exactly once.
+    // A frame not complete within the timeout is dropped. When all slots
+    // are taken, the oldest incomplete frame makes room for a new one.
+    // It's safe to feed from several threads.
+    class reassembler {
+    public:
+        struct stats {
+            size_t completed;
+            // incomplete frames dropped on timeout, or to make room.
+            size_t expired;
+            size_t evicted;
+            // chunks which are invalid, or found no free slot.
+            size_t dropped;
+
+            stats() : completed(0), expired(0), evicted(0), dropped(0) { }
+        };
+
+        reassembler(size_t slots, size_t frame_size = max_frame_size,
+            ::std::chrono::milliseconds timeout = ::std::chrono::milliseconds(500));
+
+        size_t capacity() const { return m_frame_size; }
+        void* buf(size_t slot) const { return m_bufs[slot].get(); }
+
+        // feeds a chunk received from src, which tells senders apart.
+        // Returns the slot holding the frame it completes, of len bytes,
+        // or index_pool::none. The slot is the caller's until release.
+        size_t feed(uint64_t src, const void* data, size_t len, size_t& frame_len);
+        void release(size_t slot);
+
+        stats get_stats();
+
+    private:
+        using clock = ::std::chrono::steady_clock;
+
+        struct partial {
+            size_t slot;
+            size_t frame_size;
+            size_t received;
+            // the payload of every chunk but the last, once seen,
+            // and the bytes of the received chunks.
+            size_t chunk_payload;
+            size_t bytes;
+            ::std::vector<bool> got;
+            clock::time_point deadline;
+        };
+
+        size_t m_frame_size;
+        ::std::chrono::milliseconds m_timeout;
+        index_pool m_pool;
+        ::std::vector<::std::unique_ptr<char[]>> m_bufs;
+        ::std::map<::std::pair<uint64_t, uint32_t>, partial> m_partials;
+        stats m_stats;
+        ::std::mutex m_mutex;
+
+        void expire(clock::time_point now);
+        size_t take_slot();
+    };
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef __DP_UTIL_EVENTCOUNT_H
+#define __DP_UTIL_EVENTCOUNT_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace dp {
+    // event_count lets lock-free structures block on a condition
+    // without a mutex. A waiter calls prepare_wait, re-checks the
+    // condition, then either cancel_wait or wait with the key.
+    // A notifier changes the state first, then calls notify_*,
+    // which costs only an atomic load when nobody waits.
+    class event_count {
+    public:
+        event_count() : m_epoch(0), m_waiters(0) { }
+
+        uint32_t prepare_wait() {
+            m_waiters.fetch_add(1);
+            ::std::atomic_thread_fence(::std::memory_order_seq_cst);
+            return m_epoch.load(::std::memory_order_acquire);
+        }
+
+        void cancel_wait() {
+            m_waiters.fetch_sub(1);
+        }
+
+        // blocks until notified after prepare_wait returned key.
+        void wait(uint32_t key);
+
+        void notify_one() { notify(false); }
+        void notify_all() { notify(true); }
+
+    private:
+        ::std::atomic<uint32_t> m_epoch;
+        ::std::atomic<uint32_t> m_waiters;
+
+        void notify(bool all);
+    };
+}
+
+#endif
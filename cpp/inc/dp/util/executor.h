@@ -0,0 +1,60 @@
+#ifndef __DP_UTIL_EXECUTOR_H
+#define __DP_UTIL_EXECUTOR_H
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+
+#include "dp/util/queue.h"
+#include "dp/util/eventcount.h"
+
+namespace dp {
+    // executor runs tasks on a fixed set of worker threads.
+    // Every worker owns a deque of tasks: it pops its own tasks
+    // from the back and steals from the front of other workers'
+    // deques when it runs out of work.
+    // Tasks submitted from a worker thread go to that worker's deque,
+    // others go to a shared lock-free inbox, or round-robin to the
+    // workers when the inbox is full.
+    class executor {
+    public:
+        using task = ::std::function<void()>;
+
+        // threads = 0 sizes the executor to the number of cores.
+        executor(size_t threads = 0);
+        virtual ~executor();
+
+        size_t size() const { return m_workers.size(); }
+
+        void submit(task&&);
+        void submit(const task& t) { submit(task(t)); }
+
+        // the process-wide executor shared by all graphs.
+        static executor* get();
+
+    private:
+        struct worker {
+            ::std::mutex mutex;
+            ::std::deque<task> tasks;
+            ::std::thread thread;
+        };
+
+        static constexpr size_t inbox_size = 1024;
+
+        ::std::vector<::std::unique_ptr<worker>> m_workers;
+        ring<task> m_inbox;
+        ::std::atomic<size_t> m_next;
+        ::std::atomic<size_t> m_pending;
+        ::std::atomic<bool> m_stopping;
+        event_count m_idle;
+
+        void run(size_t index);
+        bool pop(size_t index, task&);
+    };
+}
+
+#endif
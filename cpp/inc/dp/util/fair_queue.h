@@ -0,0 +1,186 @@
+#ifndef __DP_UTIL_FAIR_QUEUE_H
+#define __DP_UTIL_FAIR_QUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+
+namespace dp {
+    // fair_queue keeps a queue of up to depth items per key, e.g. per
+    // camera, and get takes them round-robin across the keys, up to the
+    // weight of a key (default 1) in a row. Putting to a full key
+    // displaces its oldest item, so with depth 1 only the latest item
+    // of every key waits. Displaced and evicted items are handed back
+    // to the caller, which still owns what they hold.
+    template<typename T>
+    class fair_queue {
+    public:
+        struct stats {
+            // items displaced by a newer one of the same key.
+            uint64_t displaced;
+            // items taken out by evict.
+            uint64_t evicted;
+            // the most items waiting at once.
+            size_t max_size;
+
+            stats() : displaced(0), evicted(0), max_size(0) { }
+        };
+
+        fair_queue(size_t depth = 1)
+        : m_depth(depth > 0 ? depth : 1), m_size(0), m_closed(false) { }
+
+        void set_weight(const ::std::string& key, size_t weight) {
+            ::std::unique_lock<::std::mutex> lock(m_mutex);
+            m_weights[key] = weight > 0 ? weight : 1;
+        }
+
+        // returns true and sets displaced when v
+        // took the place of an older item of key.
+        bool put(const ::std::string& key, T&& v, T& displaced) {
+            ::std::unique_lock<::std::mutex> lock(m_mutex);
+            auto& l = m_lanes[key];
+            bool idle = l.items.empty();
+            bool full = l.items.size() >= m_depth;
+            if (full) {
+                displaced = ::std::move(l.items.front());
+                l.items.pop_front();
+                m_size --;
+                m_stats.displaced ++;
+            }
+            // before v, key may be part of it.
+            if (idle) {
+                l.credit = weight(key);
+                m_active.push_back(key);
+            }
+            l.items.push_back(::std::move(v));
+            m_size ++;
+            if (m_size > m_stats.max_size) m_stats.max_size = m_size;
+            m_cv.notify_one();
+            return full;
+        }
+
+        // blocks until an item is taken, false once closed and empty.
+        bool get(T& v) {
+            ::std::unique_lock<::std::mutex> lock(m_mutex);
+            while (m_active.empty() && !m_closed) m_cv.wait(lock);
+            return take(v);
+        }
+
+        bool try_get(T& v) {
+            ::std::unique_lock<::std::mutex> lock(m_mutex);
+            return take(v);
+        }
+
+        // takes the oldest item of the key with the most waiting,
+        // to free what it holds, false if empty.
+        bool evict(T& v) {
+            ::std::unique_lock<::std::mutex> lock(m_mutex);
+            auto longest = m_lanes.end();
+            for (auto it = m_lanes.begin(); it != m_lanes.end(); it ++) {
+                if (longest == m_lanes.end() ||
+                    it->second.items.size() > longest->second.items.size()) {
+                    longest = it;
+                }
+            }
+            if (longest == m_lanes.end() || longest->second.items.empty()) {
+                return false;
+            }
+            v = ::std::move(longest->second.items.front());
+            longest->second.items.pop_front();
+            m_size --;
+            m_stats.evicted ++;
+            if (longest->second.items.empty()) {
+                deactivate(longest->first);
+                m_lanes.erase(longest);
+            }
+            return true;
+        }
+
+        // wakes up get, which then returns what is left and false.
+        void close() {
+            ::std::unique_lock<::std::mutex> lock(m_mutex);
+            m_closed = true;
+            m_cv.notify_all();
+        }
+
+        size_t depth() const { return m_depth; }
+
+        size_t size() const {
+            ::std::unique_lock<::std::mutex> lock(m_mutex);
+            return m_size;
+        }
+
+        // the items of key waiting.
+        size_t size(const ::std::string& key) const {
+            ::std::unique_lock<::std::mutex> lock(m_mutex);
+            auto it = m_lanes.find(key);
+            return it == m_lanes.end() ? 0 : it->second.items.size();
+        }
+
+        stats get_stats() const {
+            ::std::unique_lock<::std::mutex> lock(m_mutex);
+            return m_stats;
+        }
+
+    private:
+        struct lane {
+            ::std::deque<T> items;
+            // items left to take in a row.
+            size_t credit;
+
+            lane() : credit(0) { }
+        };
+
+        size_t m_depth;
+        // lanes are removed once empty.
+        ::std::unordered_map<::std::string, lane> m_lanes;
+        ::std::unordered_map<::std::string, size_t> m_weights;
+        // the keys with items, in turn order.
+        ::std::deque<::std::string> m_active;
+        size_t m_size;
+        bool m_closed;
+        stats m_stats;
+        mutable ::std::mutex m_mutex;
+        ::std::condition_variable m_cv;
+
+        size_t weight(const ::std::string& key) const {
+            auto it = m_weights.find(key);
+            return it == m_weights.end() ? 1 : it->second;
+        }
+
+        bool take(T& v) {
+            if (m_active.empty()) return false;
+            auto key = m_active.front();
+            auto it = m_lanes.find(key);
+            auto& l = it->second;
+            v = ::std::move(l.items.front());
+            l.items.pop_front();
+            m_size --;
+            m_active.pop_front();
+            if (l.items.empty()) {
+                m_lanes.erase(it);
+            } else if (-- l.credit > 0) {
+                m_active.push_front(key);
+            } else {
+                l.credit = weight(key);
+                m_active.push_back(key);
+            }
+            return true;
+        }
+
+        void deactivate(const ::std::string& key) {
+            for (auto it = m_active.begin(); it != m_active.end(); it ++) {
+                if (*it == key) {
+                    m_active.erase(it);
+                    return;
+                }
+            }
+        }
+    };
+}
+
+#endif
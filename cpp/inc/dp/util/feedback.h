@@ -0,0 +1,84 @@
+#ifndef __DP_UTIL_FEEDBACK_H
+#define __DP_UTIL_FEEDBACK_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+
+namespace dp {
+    // rate_feedback is a datagram sent back to a frame producer, asking
+    // it to slow down or lower the quality while the pipeline can't keep
+    // up with it, in network byte order. See doc/dp/feedback.md.
+    struct rate_feedback {
+        static constexpr uint16_t magic = 0x4446;
+        static constexpr uint8_t version = 1;
+        static constexpr size_t size = 16;
+
+        // increments with every feedback to the producer, starting
+        // over at 1 once it was told the limit is lifted.
+        uint32_t seq;
+        // the highest rate to send at in millihertz, 0 for no limit.
+        uint32_t max_fps_milli;
+        // the encoding quality to use in percent of the usual one.
+        uint8_t quality;
+        // the load of the pipeline in percent, over 100 when frames
+        // wait for it, capped at 255.
+        uint8_t load;
+        // frames of the producer waiting or lost since the last feedback.
+        uint16_t backlog;
+
+        rate_feedback() : seq(0), max_fps_milli(0), quality(100), load(0), backlog(0) { }
+
+        void encode(void* buf) const;
+        // false if buf doesn't start with a valid feedback.
+        static bool decode(const void* buf, size_t len, rate_feedback&);
+    };
+
+    // rate_controller suggests the rate_feedback of each producer from
+    // what it sent over an interval, the load of the pipeline and the
+    // frames of it which waited or were lost. It cuts the rate of a
+    // producer to its share of the pipeline right away when it is
+    // overloaded or losing frames, and lifts it step by step otherwise,
+    // dropping the limit once it is well above what the producer sends.
+    // At min_fps, it lowers the quality instead. It is not thread safe.
+    class rate_controller {
+    public:
+        // the load to keep the pipeline at.
+        static constexpr double default_target = 0.8;
+        static constexpr double default_min_fps = 1.0;
+
+        rate_controller(double target = default_target, double min_fps = default_min_fps);
+
+        // returns true and fills fb when the producer should be told,
+        // i.e. while it is limited and once after the limit is lifted.
+        bool update(const ::std::string& source, double load, double interval_sec,
+            uint64_t frames, uint64_t lost, size_t backlog, rate_feedback& fb);
+
+        // forgets a producer which stopped sending.
+        void remove(const ::std::string& source) { m_sources.erase(source); }
+
+    private:
+        // the limit is lifted past this much of the rate sent.
+        static constexpr double lift_ratio = 2.0;
+        // how much the limit grows in an interval of spare capacity.
+        static constexpr double raise_ratio = 1.25;
+        static constexpr int quality_step = 10;
+        static constexpr int min_quality = 30;
+
+        struct state {
+            // the current limit, 0 for none.
+            double fps;
+            int quality;
+            uint32_t seq;
+
+            state() : fps(0), quality(100), seq(0) { }
+        };
+
+        double m_target;
+        double m_min_fps;
+        ::std::unordered_map<::std::string, state> m_sources;
+    };
+}
+
+#endif
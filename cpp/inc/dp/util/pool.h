@@ -1,29 +1,32 @@
 #ifndef __DP_UTIL_POOL_H
 #define __DP_UTIL_POOL_H
 
-#include <list>
-#include <vector>
-#include <mutex>
-#include <condition_variable>
+#include <memory>
+
+#include "dp/util/queue.h"
 
 namespace dp {
+    // index_pool hands out the indices [0, size) of a fixed set
+    // of resources, blocking in get until one is put back.
     class index_pool {
     public:
         static constexpr size_t none = (size_t)(-1);
 
         index_pool(size_t size = 0);
 
+        // not safe while indices are handed out.
         void resize(size_t size);
 
+        size_t size() const { return m_size; }
+        // approximate number of free indices.
+        size_t available() const { return m_ring->size(); }
+
         size_t get(bool nowait = false);
         void put(size_t);
 
     private:
-        ::std::vector<size_t> m_ring;
-        volatile size_t m_get;
-        volatile size_t m_put;
-        ::std::mutex m_put_mutex;
-        ::std::condition_variable m_put_cv;
+        size_t m_size;
+        ::std::unique_ptr<ring<size_t>> m_ring;
     };
 }
 
@@ -1,11 +1,17 @@
 #ifndef __DP_UTIL_QUEUE_H
 #define __DP_UTIL_QUEUE_H
 
-#include <list>
+#include <cstddef>
+#include <deque>
 #include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
 #include <mutex>
 #include <condition_variable>
 
+#include "dp/util/eventcount.h"
+
 namespace dp {
     template<typename T>
     class queue {
@@ -15,14 +21,14 @@ namespace dp {
         T get() {
             ::std::unique_lock<::std::mutex> lock(m_mutex);
             while (m_queue.empty()) m_cv.wait(lock);
-            T v = m_queue.front();
+            T v = ::std::move(m_queue.front());
             m_queue.pop_front();
             return v;
         }
 
         void put(T v) {
             ::std::unique_lock<::std::mutex> lock(m_mutex);
-            m_queue.push_back(v);
+            m_queue.push_back(::std::move(v));
             m_cv.notify_one();
         }
 
@@ -32,40 +38,210 @@ namespace dp {
         }
 
     private:
-        ::std::list<T> m_queue;
+        ::std::deque<T> m_queue;
         ::std::mutex m_mutex;
         ::std::condition_variable m_cv;
     };
 
+    // ring is a bounded lock-free multi-producer multi-consumer queue.
+    // Every cell carries a sequence number telling whether it is ready
+    // for the producer or the consumer at a given position, so producers
+    // and consumers only contend on their own position counter.
+    // The capacity is rounded up to a power of 2, at least 2.
     template<typename T>
-    class single_consumer_queue {
+    class ring {
     public:
-        single_consumer_queue(size_t max_num)
-        : m_queue(max_num), m_get(0), m_put(0) { }
+        ring(size_t capacity)
+        : m_mask(round_up(capacity) - 1),
+          m_cells(new cell[m_mask + 1]),
+          m_put(0), m_get(0), m_closed(false) {
+            for (size_t i = 0; i <= m_mask; i ++) {
+                m_cells[i].seq.store(i, ::std::memory_order_relaxed);
+            }
+        }
 
-        T get() {
-            if (m_get >= m_queue.size()) return nullptr;
-            if (m_get >= m_put) {
-                ::std::unique_lock<::std::mutex> lock(m_mutex);
-                while (m_get >= m_put) m_cv.wait(lock);
+        size_t capacity() const { return m_mask + 1; }
+
+        // approximate, for monitoring only.
+        size_t size() const {
+            size_t put = m_put.load(::std::memory_order_relaxed);
+            size_t get = m_get.load(::std::memory_order_relaxed);
+            return put > get ? put - get : 0;
+        }
+
+        bool try_put(const T& v) { T c(v); return try_put(::std::move(c)); }
+
+        bool try_put(T&& v) {
+            size_t pos;
+            cell *c = claim(m_put, 0, pos);
+            if (c == nullptr) return false;
+            c->value = ::std::move(v);
+            c->seq.store(pos + 1, ::std::memory_order_release);
+            m_not_empty.notify_one();
+            return true;
+        }
+
+        bool try_get(T& v) {
+            size_t pos;
+            cell *c = claim(m_get, 1, pos);
+            if (c == nullptr) return false;
+            v = ::std::move(c->value);
+            c->seq.store(pos + m_mask + 1, ::std::memory_order_release);
+            m_not_full.notify_one();
+            return true;
+        }
+
+        // puts up to n items from vs, returns the number put.
+        size_t put_n(T* vs, size_t n) {
+            size_t pos;
+            size_t count = claim_n(m_put, 0, n, pos);
+            for (size_t i = 0; i < count; i ++) {
+                cell& c = m_cells[(pos + i) & m_mask];
+                c.value = ::std::move(vs[i]);
+                c.seq.store(pos + i + 1, ::std::memory_order_release);
             }
-            return m_queue[m_get++];
+            if (count > 0) m_not_empty.notify_all();
+            return count;
         }
 
-        void put(T v) {
-            if (m_put < m_queue.size()) {
-                ::std::unique_lock<::std::mutex> lock(m_mutex);
-                m_queue[m_put++] = v;
-                m_cv.notify_one();
+        // gets up to n items into vs, returns the number got.
+        size_t get_n(T* vs, size_t n) {
+            size_t pos;
+            size_t count = claim_n(m_get, 1, n, pos);
+            for (size_t i = 0; i < count; i ++) {
+                cell& c = m_cells[(pos + i) & m_mask];
+                vs[i] = ::std::move(c.value);
+                c.seq.store(pos + i + m_mask + 1, ::std::memory_order_release);
+            }
+            if (count > 0) m_not_full.notify_all();
+            return count;
+        }
+
+        // blocks while full, returns false if closed.
+        bool put(T v) {
+            while (true) {
+                if (m_closed.load(::std::memory_order_acquire)) return false;
+                if (spin([&] { return try_put(::std::move(v)); })) return true;
+                auto key = m_not_full.prepare_wait();
+                if (m_closed.load(::std::memory_order_acquire)) {
+                    m_not_full.cancel_wait();
+                    return false;
+                }
+                if (try_put(::std::move(v))) {
+                    m_not_full.cancel_wait();
+                    return true;
+                }
+                m_not_full.wait(key);
+            }
+        }
+
+        // blocks while empty, returns false once closed and drained.
+        bool get(T& v) {
+            while (true) {
+                if (spin([&] { return try_get(v); })) return true;
+                auto key = m_not_empty.prepare_wait();
+                if (try_get(v)) {
+                    m_not_empty.cancel_wait();
+                    return true;
+                }
+                if (m_closed.load(::std::memory_order_acquire)) {
+                    m_not_empty.cancel_wait();
+                    return false;
+                }
+                m_not_empty.wait(key);
             }
         }
 
+        // wakes up all blocked callers, further puts fail.
+        void close() {
+            m_closed.store(true, ::std::memory_order_release);
+            m_not_empty.notify_all();
+            m_not_full.notify_all();
+        }
+
+        bool closed() const { return m_closed.load(::std::memory_order_acquire); }
+
     private:
-        ::std::vector<T> m_queue;
-        size_t m_get;
-        volatile size_t m_put;
-        ::std::mutex m_mutex;
-        ::std::condition_variable m_cv;
+        struct cell {
+            ::std::atomic<size_t> seq;
+            T value;
+        };
+
+        static constexpr size_t cache_line = 64;
+        static constexpr int spin_rounds = 16;
+
+        const size_t m_mask;
+        ::std::unique_ptr<cell[]> m_cells;
+        // the padding keeps the counters on cache lines of their own
+        // wherever the ring is allocated, as new doesn't honor alignas
+        // beyond the default alignment in C++11.
+        char m_pad0[cache_line];
+        ::std::atomic<size_t> m_put;
+        char m_pad1[cache_line - sizeof(::std::atomic<size_t>)];
+        ::std::atomic<size_t> m_get;
+        char m_pad2[cache_line - sizeof(::std::atomic<size_t>)];
+        ::std::atomic<bool> m_closed;
+        char m_pad3[cache_line - sizeof(::std::atomic<bool>)];
+        event_count m_not_empty;
+        event_count m_not_full;
+
+        // retries briefly before blocking, a peer is usually
+        // about to make progress and a futex round trip costs more.
+        template<typename F>
+        static bool spin(F f) {
+            for (int i = 0; i < spin_rounds; i ++) {
+                if (f()) return true;
+                ::std::this_thread::yield();
+            }
+            return false;
+        }
+
+        static size_t round_up(size_t n) {
+            size_t cap = 2;
+            while (cap < n) cap <<= 1;
+            return cap;
+        }
+
+        // a cell at pos is ready for producers when seq == pos,
+        // and for consumers when seq == pos + 1.
+        cell* claim(::std::atomic<size_t>& counter, size_t ready, size_t& pos) {
+            pos = counter.load(::std::memory_order_relaxed);
+            while (true) {
+                cell *c = &m_cells[pos & m_mask];
+                size_t seq = c->seq.load(::std::memory_order_acquire);
+                auto diff = (ptrdiff_t)seq - (ptrdiff_t)(pos + ready);
+                if (diff == 0) {
+                    if (counter.compare_exchange_weak(pos, pos + 1, ::std::memory_order_relaxed)) {
+                        return c;
+                    }
+                } else if (diff < 0) {
+                    return nullptr;
+                } else {
+                    pos = counter.load(::std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // claims up to n consecutive ready cells at once.
+        size_t claim_n(::std::atomic<size_t>& counter, size_t ready, size_t n, size_t& pos) {
+            pos = counter.load(::std::memory_order_relaxed);
+            while (true) {
+                size_t count = 0;
+                for (; count < n && count <= m_mask; count ++) {
+                    size_t seq = m_cells[(pos + count) & m_mask].seq.load(::std::memory_order_acquire);
+                    if (seq != pos + count + ready) break;
+                }
+                if (count == 0) {
+                    size_t seq = m_cells[pos & m_mask].seq.load(::std::memory_order_acquire);
+                    if ((ptrdiff_t)seq - (ptrdiff_t)(pos + ready) < 0) return 0;
+                    pos = counter.load(::std::memory_order_relaxed);
+                    continue;
+                }
+                if (counter.compare_exchange_weak(pos, pos + count, ::std::memory_order_relaxed)) {
+                    return count;
+                }
+            }
+        }
     };
 }
 
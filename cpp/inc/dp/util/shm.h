@@ -0,0 +1,110 @@
+#ifndef __DP_UTIL_SHM_H
+#define __DP_UTIL_SHM_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <memory>
+#include <mutex>
+
+namespace dp {
+    // a frame published into a slot of a shm_channel.
+    struct shm_frame {
+        enum format : uint32_t {
+            // compressed image bytes, e.g. JPEG.
+            encoded = 0,
+            // uncompressed pixels, laid out as a cv::Mat.
+            raw = 1,
+        };
+
+        uint32_t slot;
+        uint32_t len;
+        uint32_t fmt;
+        // raw frames only, as cv::Mat rows, cols, type and step.
+        int32_t rows, cols, type;
+        uint32_t step;
+        // 0 leaves the sequence to the image id or the consumer.
+        uint64_t seq;
+    };
+
+    // shm_channel is shared memory between one producer, e.g. a camera
+    // agent, and the consumer in dpe, in another process on the same host.
+    // The consumer creates a memfd holding fixed-size slots and rings of
+    // slot numbers, and hands it over with two eventfds on a Unix socket.
+    // The producer fills a free slot and publishes it; the consumer works
+    // on the slot in place and releases it once done. Results go back
+    // to the producer as messages in a byte ring.
+    // The producer end is for one thread, and so is next on the consumer
+    // end, while release and put_result may be called from any thread.
+    class shm_channel {
+    public:
+        static constexpr size_t none = (size_t)-1;
+        static constexpr size_t max_slots = 1024;
+        static constexpr size_t max_slot_size = 64 << 20;
+        static constexpr size_t results_size = 64 << 10;
+
+        ~shm_channel();
+
+        // the producer end, connected to the consumer listening on path.
+        // The consumer may grant fewer or smaller slots.
+        static ::std::shared_ptr<shm_channel> connect(const ::std::string& path,
+            size_t slots, size_t slot_size, const ::std::string& name = ::std::string());
+        // the consumer end, serving a producer connected on sock,
+        // which is closed along with the channel, or on failure.
+        // A blocking sock waits up to a second for the hello, a
+        // nonblocking one has to be readable already.
+        static ::std::shared_ptr<shm_channel> accept(int sock,
+            size_t slots_limit = max_slots, size_t slot_size_limit = max_slot_size);
+
+        const ::std::string& name() const { return m_name; }
+        size_t slots() const { return m_slots; }
+        size_t slot_size() const { return m_slot_size; }
+        void* slot(size_t index) const;
+
+        // readable when the producer hangs up.
+        int socket() const { return m_sock; }
+        // signaled to the consumer on publish.
+        int ready_fd() const { return m_ready_fd; }
+        // signaled to the producer on release and put_result.
+        int done_fd() const { return m_done_fd; }
+        // clears a signal, before checking the rings.
+        static void clear(int fd);
+
+        // producer: a free slot, or none.
+        size_t acquire();
+        void publish(const shm_frame&);
+        // waits for done_fd up to timeout_ms, -1 waits forever.
+        bool wait(int timeout_ms);
+        bool take_result(::std::string& msg);
+
+        // consumer: false if nothing is published, or the descriptor is invalid.
+        bool next(shm_frame&);
+        void release(size_t slot);
+        // false if there's no room for it now.
+        bool put_result(const void* data, size_t len);
+
+    private:
+        struct header;
+
+        int m_sock;
+        int m_memfd;
+        int m_ready_fd;
+        int m_done_fd;
+        void *m_map;
+        size_t m_map_len;
+        header *m_header;
+        shm_frame *m_ready;
+        uint32_t *m_free;
+        char *m_results;
+        char *m_slot_base;
+        ::std::string m_name;
+        size_t m_slots;
+        size_t m_slot_size;
+        ::std::mutex m_mutex;
+
+        shm_channel();
+        void map(bool init);
+    };
+}
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef __DP_UTIL_URING_H
+#define __DP_UTIL_URING_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+struct io_uring_sqe;
+struct io_uring_buf_ring;
+
+namespace dp {
+    // uring is a small event loop on io_uring. Operations are started
+    // from the thread calling run, or through post from other threads,
+    // and their handlers run on that thread as completions arrive.
+    class uring {
+    public:
+        // res is the result of the operation, -errno on failure,
+        // flags are the IORING_CQE_F_* flags of the completion.
+        using handler = ::std::function<void(int res, uint32_t flags)>;
+        using op_id = uint64_t;
+
+        uring(unsigned entries = 256);
+        virtual ~uring();
+
+        // false if the kernel or the sandbox doesn't allow io_uring.
+        static bool supported();
+
+        // buffer_group is a ring of buffers registered with the kernel,
+        // which picks one for every completion of a multishot receive.
+        // The buffer belongs to the handler until put back.
+        class buffer_group {
+        public:
+            ~buffer_group();
+
+            uint16_t id() const { return m_id; }
+            size_t buf_size() const { return m_buf_size; }
+            size_t count() const { return m_count; }
+            void* buf(uint16_t bid) const { return m_bufs + m_buf_size * bid; }
+
+            // returns a buffer to the kernel, safe from any thread.
+            void put(uint16_t bid);
+
+        private:
+            buffer_group(uring*, uint16_t id, uint16_t count, size_t size);
+
+            uring *m_uring;
+            uint16_t m_id;
+            size_t m_count;
+            size_t m_buf_size;
+            char *m_bufs;
+            io_uring_buf_ring *m_ring;
+            size_t m_ring_size;
+            ::std::mutex m_mutex;
+
+            friend class uring;
+        };
+
+        // count is rounded up to a power of 2.
+        buffer_group* add_buffer_group(uint16_t count, size_t size);
+
+        // the buffer id carried by a completion with IORING_CQE_F_BUFFER.
+        static uint16_t buffer_id(uint32_t flags);
+        // false on the last completion of a multishot operation.
+        static bool more(uint32_t flags);
+
+        // a datagram received by recvmsg_multishot.
+        struct message {
+            const sockaddr_in *from;
+            const void *control;
+            size_t control_len;
+            void *payload;
+            size_t len;
+            // the space left in the buffer after the payload.
+            size_t room;
+            bool truncated;
+        };
+
+        // arms a multishot recvmsg on a datagram socket, taking buffers
+        // from group. Use parse to read a completion. The receive stops
+        // on errors or when the group has no buffer left (-ENOBUFS),
+        // the last completion comes without IORING_CQE_F_MORE.
+        op_id recvmsg_multishot(int fd, buffer_group*, handler, size_t control_len = 0);
+        static message parse(const buffer_group*, int res, uint32_t flags, size_t control_len = 0);
+
+        // arms a multishot recv on a stream socket.
+        op_id recv_multishot(int fd, buffer_group*, handler);
+        // arms a multishot accept, res is the new connection.
+        op_id accept_multishot(int fd, handler);
+
+        // the buffers must stay valid until the handler runs.
+        op_id send(int fd, const void* buf, size_t len, handler);
+        op_id sendmsg(int fd, const iovec* iov, size_t iovcnt, const sockaddr_in* to, handler);
+        // res is -ETIME when the timeout expires.
+        op_id timeout(uint64_t ms, handler);
+
+        // the handler of op gets -ECANCELED.
+        void cancel(op_id);
+
+        // runs fn on the loop thread, safe from any thread.
+        void post(::std::function<void()> fn);
+
+        // handles completions until stop.
+        void run();
+        // safe from any thread.
+        void stop();
+
+    private:
+        struct op;
+        struct sq_ring;
+        struct cq_ring;
+
+        // what a handler needs of an io_uring_cqe.
+        struct completion {
+            op_id id;
+            int res;
+            uint32_t flags;
+        };
+
+        int m_fd;
+        ::std::unique_ptr<sq_ring> m_sq;
+        ::std::unique_ptr<cq_ring> m_cq;
+        io_uring_sqe *m_sqes;
+        size_t m_sqes_size;
+        unsigned m_to_submit;
+        // completions taken off the ring, not handled yet.
+        ::std::deque<completion> m_reaped;
+
+        op_id m_next_op;
+        ::std::unordered_map<op_id, ::std::unique_ptr<op>> m_ops;
+        ::std::vector<::std::unique_ptr<buffer_group>> m_groups;
+
+        int m_event_fd;
+        ::std::mutex m_post_mutex;
+        ::std::vector<::std::function<void()>> m_posted;
+        ::std::atomic<bool> m_stopping;
+
+        io_uring_sqe* get_sqe(op_id&, handler&&);
+        // false if nothing was submitted.
+        bool submit(unsigned wait_nr);
+        // moves the completions off the ring into m_reaped.
+        size_t reap();
+        void complete(const completion&);
+        void arm_wakeup();
+        void run_posted();
+    };
+}
+
+#endif
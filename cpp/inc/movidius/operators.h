@@ -10,13 +10,15 @@
 #include "movidius/ncs.h"
 
 namespace movidius::op {
-    struct exec {
+    struct exec : ::dp::graph::typed_op<
+        ::dp::graph::inputs<::cv::Mat>, ::dp::graph::outputs<::std::vector<float>>> {
         compute_stick::graph *graph;
         exec(compute_stick::graph *g) : graph(g) { }
         void operator() (::dp::graph::ctx);
     };
 
-    struct crop_fp16 {
+    struct crop_fp16 : ::dp::graph::typed_op<
+        ::dp::graph::inputs<::cv::Mat>, ::dp::graph::outputs<::cv::Mat>> {
         int cx, cy;
         crop_fp16(int _cx, int _cy) : cx(_cx), cy(_cy) { }
         void operator() (::dp::graph::ctx);
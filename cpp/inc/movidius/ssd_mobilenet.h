@@ -2,13 +2,15 @@
 #define __MOVIDIUS_SSD_MOBILENET_H
 
 #include <vector>
+#include <opencv2/core/core.hpp>
 
 #include "dp/graph.h"
 #include "dp/types.h"
 #include "movidius/ncs.h"
 
 namespace movidius::op {
-    struct ssd_mobilenet {
+    struct ssd_mobilenet : ::dp::graph::typed_op<
+        ::dp::graph::inputs<::cv::Mat>, ::dp::graph::outputs<::std::vector<::dp::detect_box>>> {
         // image w and h
         static constexpr int net_imagesz = 300;
 
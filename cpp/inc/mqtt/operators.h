@@ -5,7 +5,8 @@
 #include "mqtt/mqtt.h"
 
 namespace mqtt::op {
-    struct pub {
+    struct pub : ::dp::graph::typed_op<
+        ::dp::graph::inputs<::std::string>, ::dp::graph::outputs<>> {
         ::mqtt::client* client;
         ::std::string topic;
         pub(::mqtt::client* c, const ::std::string& t) : client(c), topic(t) {}
@@ -1,46 +1,526 @@
+#include <glog/logging.h>
+
 #include "dp/graph.h"
 #include "dp/dispatch.h"
 
 namespace dp {
     using namespace std;
 
-    graph_dispatcher::graph_dispatcher() {
+    overflow_policy parse_overflow_policy(const string& name) {
+        if (name == "block") return overflow_policy::block;
+        if (name == "drop-newest") return overflow_policy::drop_newest;
+        if (name == "drop-oldest") return overflow_policy::drop_oldest;
+        if (name == "latest") return overflow_policy::latest_per_source;
+        throw invalid_argument("unknown overflow policy: " + name);
+    }
+
+    const char* overflow_policy_name(overflow_policy policy) {
+        switch (policy) {
+        case overflow_policy::block: return "block";
+        case overflow_policy::drop_newest: return "drop-newest";
+        case overflow_policy::drop_oldest: return "drop-oldest";
+        case overflow_policy::latest_per_source: return "latest";
+        }
+        return "unknown";
+    }
+
+    graph_dispatcher::graph_dispatcher()
+    : m_capacity(0), m_policy(overflow_policy::block), m_waiting(0),
+      m_stopping(false), m_idle_ticks(0), m_last_overflow(0),
+      m_order_window(0), m_order_timeout(0) {
     }
 
     graph_dispatcher::~graph_dispatcher() {
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_stopping = true;
+            m_scaler_cv.notify_all();
+            m_yield_cv.notify_all();
+            m_order_cv.notify_all();
+            // blocked dispatch calls drop their sessions and leave.
+            m_cv.notify_all();
+            while (m_waiting > 0) m_cv.wait(lock);
+        }
+        if (m_scaler.joinable()) m_scaler.join();
+        // the workers still go through m_slots in next, so all of them
+        // are joined before any slot or the graph it uses goes away,
+        // then what is still queued is released.
+        for (auto& sl : m_slots) sl->inbox.close();
+        for (auto& sl : m_slots) sl->worker.join();
+        m_slots.clear();
+        for (auto& s : m_pending) drop(s);
+    }
+
+    void graph_dispatcher::set_queue(size_t capacity, overflow_policy policy) {
+        unique_lock<mutex> lock(m_mutex);
+        m_capacity = capacity;
+        m_policy = policy;
+        m_cv.notify_all();
+    }
+
+    void graph_dispatcher::set_order(size_t window, chrono::milliseconds timeout) {
+        unique_lock<mutex> lock(m_mutex);
+        m_order_window = window;
+        m_order_timeout = timeout;
+    }
+
+    void graph_dispatcher::set_scaling(const scaling_policy& policy) {
+        if (!policy.factory) {
+            throw invalid_argument("scaling requires a graph factory");
+        }
+        if (m_scaler.joinable()) {
+            throw logic_error("scaling already started");
+        }
+        m_scaling = policy;
+        m_scaler = thread([this] { scale(); });
+    }
+
+    dispatch_stats graph_dispatcher::stats() const {
+        unique_lock<mutex> lock(m_mutex);
+        return m_stats;
+    }
+
+    latency_stats graph_dispatcher::latency() const {
+        unique_lock<mutex> lock(m_mutex);
+        return m_latency;
     }
 
-    size_t graph_dispatcher::add_graph(graph* g) {
-        size_t idx = m_slots.size();
-        m_slots.push_back(move(unique_ptr<slot>(new slot(g, idx))));
-        m_pool.resize(m_slots.size());
-        return idx;
+    void graph_dispatcher::add_graph(graph* g, size_t frames) {
+        add_slot(unique_ptr<slot>(new slot(this, g)));
+        for (size_t i = 1; i < frames; i ++) {
+            graph *f = g->fork();
+            add_slot(unique_ptr<slot>(new slot(this, f, f)));
+        }
+    }
+
+    size_t graph_dispatcher::size() const {
+        unique_lock<mutex> lock(m_mutex);
+        return m_slots.size();
+    }
+
+    double graph_dispatcher::load() const {
+        unique_lock<mutex> lock(m_mutex);
+        if (m_slots.empty()) return 0;
+        size_t busy = m_slots.size() - m_idle.size();
+        return (double)(busy + m_pending.size() + m_waiting) / (double)m_slots.size();
+    }
+
+    void graph_dispatcher::add_slot(unique_ptr<slot>&& sl) {
+        unique_lock<mutex> lock(m_mutex);
+        slot *p = sl.get();
+        m_slots.push_back(move(sl));
+        if (!m_pending.empty()) {
+            start(p);
+            p->run(move(m_pending.front()));
+            m_pending.pop_front();
+        } else {
+            m_idle.push_back(p);
+            m_cv.notify_one();
+        }
     }
 
     bool graph_dispatcher::dispatch(const session& s, bool nowait) {
-        size_t idx = m_pool.get(nowait);
-        if (idx == index_pool::none) return false;
-        m_slots[idx]->run(this, s);
+        bool refused;
+        return submit(session(s), nowait, refused);
+    }
+
+    bool graph_dispatcher::offer(const session& s) {
+        bool refused;
+        submit(session(s), true, refused);
+        return !refused;
+    }
+
+    bool graph_dispatcher::submit(session&& s, bool nowait, bool& refused) {
+        refused = false;
+        s.dispatched = frame_latency::now();
+        unique_lock<mutex> lock(m_mutex);
+        if (m_policy == overflow_policy::latest_per_source) {
+            for (auto& p : m_pending) {
+                if (p.source == s.source) {
+                    untrack(p);
+                    track(s);
+                    session old(move(p));
+                    p = move(s);
+                    m_stats.replaced ++;
+                    lock.unlock();
+                    drop(old);
+                    return true;
+                }
+            }
+        }
+        bool waited = false;
+        while (m_idle.empty() && m_pending.size() >= m_capacity) {
+            if (m_policy == overflow_policy::block) {
+                if (nowait) {
+                    m_stats.rejected ++;
+                    refused = true;
+                    return false;
+                }
+                if (!waited) m_stats.blocked ++;
+                waited = true;
+                m_waiting ++;
+                m_cv.wait(lock);
+                m_waiting --;
+                if (m_stopping) {
+                    m_cv.notify_all();
+                    lock.unlock();
+                    drop(s);
+                    return true;
+                }
+                continue;
+            }
+            if (m_policy == overflow_policy::drop_newest || m_pending.empty()) {
+                m_stats.dropped_newest ++;
+                lock.unlock();
+                drop(s);
+                return false;
+            }
+            session old(move(m_pending.front()));
+            m_pending.pop_front();
+            untrack(old);
+            track(s);
+            m_pending.push_back(move(s));
+            m_stats.dropped_oldest ++;
+            m_stats.queued ++;
+            lock.unlock();
+            drop(old);
+            return true;
+        }
+        if (!m_idle.empty()) {
+            slot *sl = take_idle();
+            track(s);
+            chrono::steady_clock::time_point until;
+            if (m_pending.size() < m_capacity && should_yield(sl, m_pending.size() + 1, until)) {
+                // queue s for a faster busy slot, and let the idle
+                // one watch the queue in case that falls behind.
+                m_pending.push_back(move(s));
+                m_stats.queued ++;
+                m_yield_cv.notify_all();
+                lock.unlock();
+                sl->run(session());
+                return true;
+            }
+            m_stats.dispatched ++;
+            lock.unlock();
+            sl->run(move(s));
+            return true;
+        }
+        track(s);
+        m_pending.push_back(move(s));
+        m_stats.queued ++;
+        if (m_pending.size() > m_stats.max_depth) {
+            m_stats.max_depth = m_pending.size();
+        }
+        m_yield_cv.notify_all();
+        return true;
+    }
+
+    graph_dispatcher::slot* graph_dispatcher::take_idle() {
+        auto best = m_idle.begin();
+        for (auto it = m_idle.begin() + 1; it < m_idle.end(); it ++) {
+            if ((*it)->service_ms < (*best)->service_ms) best = it;
+        }
+        slot *sl = *best;
+        *best = m_idle.back();
+        m_idle.pop_back();
+        start(sl);
+        return sl;
+    }
+
+    void graph_dispatcher::start(slot* sl) {
+        sl->busy = true;
+        sl->started = chrono::steady_clock::now();
+    }
+
+    bool graph_dispatcher::should_yield(const slot* sl, size_t queued, chrono::steady_clock::time_point& until) const {
+        if (sl->service_ms <= 0) return false;
+        auto now = chrono::steady_clock::now();
+        size_t faster = 0;
+        for (auto& p : m_slots) {
+            if (!p->busy || p->service_ms <= 0) continue;
+            auto expected = p->started + chrono::microseconds((int64_t)(p->service_ms * 1000));
+            double remaining = expected > now ?
+                chrono::duration<double, milli>(expected - now).count() : 0;
+            if (remaining + p->service_ms < sl->service_ms * yield_margin) {
+                // by then p should have completed a queued session too.
+                auto completed = expected + chrono::microseconds((int64_t)(p->service_ms * 1000));
+                if (faster == 0 || completed < until) until = completed;
+                faster ++;
+            }
+        }
+        // the faster slots can't take more sessions than their number.
+        return faster > 0 && faster >= queued;
+    }
+
+    vector<double> graph_dispatcher::service_times() const {
+        unique_lock<mutex> lock(m_mutex);
+        vector<double> times;
+        for (auto& p : m_slots) times.push_back(p->service_ms);
+        return times;
+    }
+
+    bool graph_dispatcher::next(slot *sl, session& s, double ms) {
+        s = session();
+        unique_lock<mutex> lock(m_mutex);
+        sl->busy = false;
+        if (ms >= 0) {
+            sl->service_ms = sl->service_ms > 0 ?
+                ewma_alpha * ms + (1 - ewma_alpha) * sl->service_ms : ms;
+        }
+        // either a queue entry or a slot becomes free.
+        m_cv.notify_one();
+        m_yield_cv.notify_all();
+        bool yielded = false;
+        while (!m_stopping && !m_pending.empty()) {
+            // a faster slot is expected to complete the queued sessions
+            // earlier, unless it is not done by the time it should be.
+            chrono::steady_clock::time_point until;
+            if (!yielded && should_yield(sl, m_pending.size(), until)) {
+                yielded = true;
+                m_stats.yielded ++;
+                while (!m_pending.empty() &&
+                    m_yield_cv.wait_until(lock, until) == cv_status::no_timeout) {
+                    if (m_stopping || !should_yield(sl, m_pending.size(), until)) break;
+                }
+                continue;
+            }
+            s = move(m_pending.front());
+            m_pending.pop_front();
+            start(sl);
+            m_yield_cv.notify_all();
+            return true;
+        }
+        m_idle.push_back(sl);
+        return false;
+    }
+
+    void graph_dispatcher::scale() {
+        unique_lock<mutex> lock(m_mutex);
+        while (!m_stopping) {
+            m_scaler_cv.wait_for(lock, m_scaling.interval);
+            if (!m_stopping) scale_once(lock);
+        }
+    }
+
+    void graph_dispatcher::scale_once(unique_lock<mutex>& lock) {
+        uint64_t overflow = m_stats.blocked + m_stats.rejected +
+            m_stats.dropped_newest + m_stats.dropped_oldest + m_stats.replaced;
+        bool pressure = !m_pending.empty() || m_waiting > 0 || overflow != m_last_overflow;
+        m_last_overflow = overflow;
+        if (pressure) {
+            m_idle_ticks = 0;
+            if (m_slots.size() >= m_scaling.max_slots) return;
+            lock.unlock();
+            unique_ptr<slot> sl;
+            string err;
+            try {
+                graph *g = m_scaling.factory();
+                sl.reset(new slot(this, g, g, true));
+            } catch (const exception& e) {
+                err = e.what();
+            }
+            bool added = sl != nullptr;
+            if (added) {
+                VLOG(1) << "scaling: add replica " << sl->g->name();
+                add_slot(move(sl));
+            }
+            lock.lock();
+            if (added) {
+                m_stats.grown ++;
+            } else {
+                // e.g. a device-bound graph ran out of devices,
+                // stay at what could be built.
+                m_scaling.max_slots = m_slots.size();
+                LOG(WARNING) << "scaling: capped at " << m_slots.size() << " slots: " << err;
+            }
+            return;
+        }
+        if (m_idle.empty() || m_slots.size() <= m_scaling.min_slots) {
+            m_idle_ticks = 0;
+            return;
+        }
+        if (++ m_idle_ticks < m_scaling.idle_intervals) return;
+        m_idle_ticks = 0;
+        for (auto it = m_idle.begin(); it != m_idle.end(); it ++) {
+            if (!(*it)->replica) continue;
+            slot *p = *it;
+            m_idle.erase(it);
+            unique_ptr<slot> sl;
+            for (auto& s : m_slots) {
+                if (s.get() == p) {
+                    sl = move(s);
+                    s = move(m_slots.back());
+                    m_slots.pop_back();
+                    break;
+                }
+            }
+            m_stats.shrunk ++;
+            // the worker is idle, joining it is quick.
+            lock.unlock();
+            VLOG(1) << "scaling: remove replica " << sl->g->name();
+            sl.reset();
+            lock.lock();
+            return;
+        }
+    }
+
+    void graph_dispatcher::drop(const session& s) {
+        try {
+            if (s.dropped) s.dropped();
+        } catch (const exception& e) {
+            LOG(ERROR) << "drop: " << e.what();
+        }
+    }
+
+    void graph_dispatcher::track(const session& s) {
+        if (m_order_window == 0) return;
+        m_order[s.source].inflight.insert(s.seq);
+    }
+
+    void graph_dispatcher::untrack(const session& s) {
+        auto it = m_order.find(s.source);
+        if (it == m_order.end()) return;
+        auto& st = it->second;
+        auto seq = st.inflight.find(s.seq);
+        if (seq != st.inflight.end()) st.inflight.erase(seq);
+        if (st.inflight.empty() && st.late.empty()) {
+            m_order.erase(it);
+        }
+        // the frames waiting for s may go now.
+        m_order_cv.notify_all();
+    }
+
+    void graph_dispatcher::skip_before(order_state& st, uint64_t seq) {
+        auto end = st.inflight.lower_bound(seq);
+        for (auto it = st.inflight.begin(); it != end; ) {
+            if (st.done.find(*it) == st.done.end()) {
+                st.late.insert(*it);
+                it = st.inflight.erase(it);
+            } else {
+                ++ it;
+            }
+        }
+    }
+
+    bool graph_dispatcher::await_turn(const session& s) {
+        unique_lock<mutex> lock(m_mutex);
+        auto it = m_order.find(s.source);
+        if (it == m_order.end()) return true;
+        auto& st = it->second;
+        auto late = st.late.find(s.seq);
+        if (late != st.late.end()) {
+            st.late.erase(late);
+            if (st.inflight.empty() && st.late.empty()) {
+                m_order.erase(it);
+            }
+            m_stats.late ++;
+            return false;
+        }
+        st.done.insert(s.seq);
+        auto deadline = chrono::steady_clock::now() + m_order_timeout;
+        bool waited = false, skipped = false;
+        while (!m_stopping && *st.inflight.begin() != s.seq) {
+            waited = true;
+            if (skipped) {
+                // only completed frames are ahead, they go shortly,
+                // unless their finalizers hang, then s goes anyway.
+                if (m_order_cv.wait_until(lock, deadline) == cv_status::timeout) break;
+            } else if (st.done.size() > m_order_window ||
+                m_order_cv.wait_until(lock, deadline) == cv_status::timeout) {
+                skip_before(st, s.seq);
+                skipped = true;
+                deadline = chrono::steady_clock::now() + m_order_timeout;
+                m_order_cv.notify_all();
+            }
+        }
+        if (waited) m_stats.reordered ++;
         return true;
     }
 
-    void graph_dispatcher::slot::run(graph_dispatcher *p, const session& s) {
-        unique_lock<mutex> lock(worker_mutex);
-        worker = new thread([this, p, s] () {
+    void graph_dispatcher::finalized(const session& s, const frame_latency& l) {
+        unique_lock<mutex> lock(m_mutex);
+        if (l.received < l.dispatched) {
+            m_latency.ingress.add(l.dispatched - l.received);
+        }
+        m_latency.wait.add(l.started - l.dispatched);
+        m_latency.exec.add(l.executed - l.started);
+        m_latency.order.add(l.finalizer.begin - l.executed);
+        m_latency.finalize.add(l.finalizer.end - l.finalizer.begin);
+        m_latency.total.add(l.finalizer.end - l.received);
+        auto it = m_order.find(s.source);
+        if (it == m_order.end()) return;
+        auto done = it->second.done.find(s.seq);
+        if (done != it->second.done.end()) it->second.done.erase(done);
+        untrack(s);
+    }
+
+    graph_dispatcher::slot::slot(graph_dispatcher *p, graph *_g, graph *_owned, bool _replica)
+    : g(_g), owned(_owned), replica(_replica), inbox(2),
+      busy(false), service_ms(0) {
+        worker = thread([this, p] { work(p); });
+    }
+
+    graph_dispatcher::slot::~slot() {
+        inbox.close();
+        if (worker.joinable()) worker.join();
+    }
+
+    void graph_dispatcher::slot::run(session&& s) {
+        // the slot was idle, so its inbox is empty.
+        if (!inbox.try_put(move(s))) {
+            throw logic_error("dispatch to a busy slot");
+        }
+    }
+
+    void graph_dispatcher::slot::work(graph_dispatcher *p) {
+        session s;
+        while (inbox.get(s)) {
+            // an empty session only wakes up the slot to watch the queue.
+            double ms = -1;
+            if (s.initializer || s.finalizer) ms = exec(p, s);
+            // keep draining the pending queue before going idle.
+            while (p->next(this, s, ms)) {
+                ms = exec(p, s);
+            }
+        }
+    }
+
+    double graph_dispatcher::slot::exec(graph_dispatcher *p, const session& s) {
+        auto start = chrono::steady_clock::now();
+        auto& l = g->latency();
+        try {
             g->reset();
+            l.dispatched = s.dispatched;
+            l.received = s.received > 0 ? s.received : s.dispatched;
+            l.started = frame_latency::now();
             if (s.initializer) s.initializer(g);
             g->exec();
-            if (s.finalizer) s.finalizer(g);
+        } catch (const exception& e) {
+            LOG(ERROR) << "G:" << g->name() << " " << e.what();
+        }
+        if (l.executed == 0) l.executed = frame_latency::now();
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        if (!p->await_turn(s)) {
+            drop(s);
             g->reset();
-
-            auto t = const_cast<thread*>(worker);
-            {
-                unique_lock<mutex> lock_slot(worker_mutex);
-                worker = nullptr;
-                p->m_pool.put(index);
-            }
-            t->detach();
-            delete t;
-        });
+            return ms;
+        }
+        // the finalizer releases what the initializer acquired,
+        // so it runs even if the graph failed.
+        l.finalizer.begin = frame_latency::now();
+        try {
+            if (p->m_completion) p->m_completion(g);
+        } catch (const exception& e) {
+            LOG(ERROR) << "G:" << g->name() << " complete: " << e.what();
+        }
+        try {
+            if (s.finalizer) s.finalizer(g);
+        } catch (const exception& e) {
+            LOG(ERROR) << "G:" << g->name() << " finalize: " << e.what();
+        }
+        l.finalizer.end = frame_latency::now();
+        p->finalized(s, l);
+        g->reset();
+        return ms;
     }
 }
@@ -0,0 +1,418 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+#include "gtest/gtest.h"
+
+#include "dp/graph.h"
+#include "dp/dispatch.h"
+#include "dp/util/queue.h"
+
+namespace dp {
+    using namespace std;
+
+    // a single-slot dispatcher whose graph is held
+    // in its op until the gate opens.
+    struct gated_dispatcher {
+        graph g;
+        mutex gate_mutex;
+        condition_variable gate_cv;
+        bool opened;
+        queue<string> done;
+        queue<string> dropped;
+        // the last member, its workers are joined first.
+        graph_dispatcher disp;
+
+        gated_dispatcher(size_t capacity, overflow_policy policy)
+        : g("gated"), opened(false) {
+            setup(g);
+            disp.add_graph(&g);
+            disp.set_queue(capacity, policy);
+        }
+
+        void setup(graph& gg) {
+            gg.def_vars({"input", "out"});
+            gg.add_op("wait", {"input"}, {"out"}, [this] (graph::ctx ctx) {
+                unique_lock<mutex> lock(gate_mutex);
+                while (!opened) gate_cv.wait(lock);
+                ctx.out(0)->set<string>(ctx.in(0)->as<string>());
+            });
+        }
+
+        ~gated_dispatcher() {
+            open();
+        }
+
+        void open() {
+            unique_lock<mutex> lock(gate_mutex);
+            opened = true;
+            gate_cv.notify_all();
+        }
+
+        bool dispatch(const string& val, const string& source = "", bool nowait = false) {
+            return disp.dispatch(make_session(val, source), nowait);
+        }
+
+        bool offer(const string& val) {
+            return disp.offer(make_session(val, ""));
+        }
+
+        session make_session(const string& val, const string& source) {
+            session s;
+            s.source = source;
+            s.initializer = [val] (graph *g) {
+                g->var("input")->set<string>(val);
+            };
+            s.finalizer = [this] (graph *g) {
+                done.put(g->var("out")->as<string>());
+            };
+            s.dropped = [this, val] {
+                dropped.put(val);
+            };
+            return s;
+        }
+    };
+
+    TEST(DispatchTest, ParsePolicy) {
+        EXPECT_EQ(overflow_policy::drop_oldest, parse_overflow_policy("drop-oldest"));
+        EXPECT_STREQ("latest", overflow_policy_name(overflow_policy::latest_per_source));
+        EXPECT_THROW(parse_overflow_policy("none"), invalid_argument);
+    }
+
+    TEST(DispatchTest, Block) {
+        gated_dispatcher d(1, overflow_policy::block);
+        EXPECT_TRUE(d.dispatch("a"));
+        EXPECT_TRUE(d.dispatch("b"));
+        EXPECT_FALSE(d.dispatch("c", "", true));
+        d.open();
+        EXPECT_TRUE(d.dispatch("c"));
+        EXPECT_EQ("a", d.done.get());
+        EXPECT_EQ("b", d.done.get());
+        EXPECT_EQ("c", d.done.get());
+        auto stats = d.disp.stats();
+        EXPECT_EQ(1, stats.rejected);
+        EXPECT_EQ(1, stats.max_depth);
+        EXPECT_TRUE(d.dropped.empty());
+    }
+
+    TEST(DispatchTest, DropNewest) {
+        gated_dispatcher d(1, overflow_policy::drop_newest);
+        EXPECT_TRUE(d.dispatch("a"));
+        EXPECT_TRUE(d.dispatch("b"));
+        EXPECT_FALSE(d.dispatch("c"));
+        EXPECT_EQ("c", d.dropped.get());
+        d.open();
+        EXPECT_EQ("a", d.done.get());
+        EXPECT_EQ("b", d.done.get());
+        auto stats = d.disp.stats();
+        EXPECT_EQ(1, stats.dispatched);
+        EXPECT_EQ(1, stats.queued);
+        EXPECT_EQ(1, stats.dropped_newest);
+    }
+
+    TEST(DispatchTest, Offer) {
+        gated_dispatcher d(1, overflow_policy::block);
+        EXPECT_TRUE(d.offer("a"));
+        EXPECT_TRUE(d.offer("b"));
+        // refused, and still the caller's.
+        EXPECT_FALSE(d.offer("c"));
+        EXPECT_TRUE(d.dropped.empty());
+        EXPECT_EQ(1, d.disp.stats().rejected);
+
+        // dropped by the policy, so taken.
+        gated_dispatcher n(1, overflow_policy::drop_newest);
+        EXPECT_TRUE(n.offer("a"));
+        EXPECT_TRUE(n.offer("b"));
+        EXPECT_TRUE(n.offer("c"));
+        EXPECT_EQ("c", n.dropped.get());
+    }
+
+    TEST(DispatchTest, Load) {
+        gated_dispatcher d(2, overflow_policy::block);
+        EXPECT_EQ(0, d.disp.load());
+        EXPECT_TRUE(d.dispatch("a"));
+        EXPECT_EQ(1, d.disp.load());
+        EXPECT_TRUE(d.dispatch("b"));
+        EXPECT_TRUE(d.dispatch("c"));
+        EXPECT_EQ(3, d.disp.load());
+        d.open();
+        EXPECT_EQ("a", d.done.get());
+        EXPECT_EQ("b", d.done.get());
+        EXPECT_EQ("c", d.done.get());
+        // the slot becomes idle right after the finalizer.
+        for (int i = 0; i < 100 && d.disp.load() > 0; i ++) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        EXPECT_EQ(0, d.disp.load());
+    }
+
+    TEST(DispatchTest, Teardown) {
+        atomic<int> finalized(0), dropped(0);
+        graph g("slow");
+        g.def_vars({"input", "out"});
+        g.add_op("sleep", {"input"}, {"out"}, [] (graph::ctx ctx) {
+            this_thread::sleep_for(chrono::milliseconds(10));
+            ctx.out(0)->set<int>(1);
+        });
+        {
+            graph_dispatcher disp;
+            disp.add_graph(&g, 2);
+            disp.set_queue(8, overflow_policy::block);
+            session s;
+            s.initializer = [] (graph *g) { g->var("input")->set<int>(1); };
+            s.finalizer = [&finalized] (graph*) { finalized ++; };
+            s.dropped = [&dropped] { dropped ++; };
+            for (int i = 0; i < 10; i ++) disp.dispatch(s);
+        }
+        // the running sessions complete, the queued ones are dropped.
+        EXPECT_EQ(10, finalized + dropped);
+        EXPECT_GT(dropped, 0);
+    }
+
+    TEST(DispatchTest, DropOldest) {
+        gated_dispatcher d(2, overflow_policy::drop_oldest);
+        EXPECT_TRUE(d.dispatch("a"));
+        EXPECT_TRUE(d.dispatch("b"));
+        EXPECT_TRUE(d.dispatch("c"));
+        EXPECT_TRUE(d.dispatch("d"));
+        EXPECT_EQ("b", d.dropped.get());
+        d.open();
+        EXPECT_EQ("a", d.done.get());
+        EXPECT_EQ("c", d.done.get());
+        EXPECT_EQ("d", d.done.get());
+        EXPECT_EQ(1, d.disp.stats().dropped_oldest);
+    }
+
+    TEST(DispatchTest, LatestPerSource) {
+        gated_dispatcher d(2, overflow_policy::latest_per_source);
+        EXPECT_TRUE(d.dispatch("a1", "a"));
+        EXPECT_TRUE(d.dispatch("a2", "a"));
+        EXPECT_TRUE(d.dispatch("b1", "b"));
+        EXPECT_TRUE(d.dispatch("a3", "a"));
+        EXPECT_EQ("a2", d.dropped.get());
+        EXPECT_TRUE(d.dispatch("c1", "c"));
+        EXPECT_EQ("a3", d.dropped.get());
+        d.open();
+        EXPECT_EQ("a1", d.done.get());
+        EXPECT_EQ("b1", d.done.get());
+        EXPECT_EQ("c1", d.done.get());
+        auto stats = d.disp.stats();
+        EXPECT_EQ(1, stats.replaced);
+        EXPECT_EQ(1, stats.dropped_oldest);
+    }
+
+    static bool eventually(function<bool()> cond) {
+        for (int i = 0; i < 500 && !cond(); i ++) {
+            this_thread::sleep_for(chrono::milliseconds(2));
+        }
+        return cond();
+    }
+
+    TEST(DispatchTest, Scaling) {
+        gated_dispatcher d(8, overflow_policy::block);
+        scaling_policy policy;
+        policy.min_slots = 1;
+        policy.max_slots = 3;
+        policy.interval = chrono::milliseconds(5);
+        policy.idle_intervals = 4;
+        policy.factory = [&d] {
+            unique_ptr<graph> g(new graph("replica"));
+            d.setup(*g);
+            return g.release();
+        };
+        d.disp.set_scaling(policy);
+        for (int i = 0; i < 6; i ++) {
+            EXPECT_TRUE(d.dispatch(to_string(i)));
+        }
+        EXPECT_TRUE(eventually([&d] { return d.disp.size() == 3; }));
+        d.open();
+        for (int i = 0; i < 6; i ++) d.done.get();
+        EXPECT_TRUE(eventually([&d] { return d.disp.size() == 1; }));
+        auto stats = d.disp.stats();
+        EXPECT_EQ(2, stats.grown);
+        EXPECT_EQ(2, stats.shrunk);
+    }
+
+    TEST(DispatchTest, ScalingCapped) {
+        gated_dispatcher d(8, overflow_policy::block);
+        scaling_policy policy;
+        policy.min_slots = 1;
+        policy.max_slots = 4;
+        policy.interval = chrono::milliseconds(5);
+        policy.factory = [] () -> graph* {
+            throw runtime_error("device unavailable");
+        };
+        d.disp.set_scaling(policy);
+        EXPECT_TRUE(d.dispatch("a"));
+        EXPECT_TRUE(d.dispatch("b"));
+        this_thread::sleep_for(chrono::milliseconds(50));
+        EXPECT_EQ(1, d.disp.size());
+        EXPECT_EQ(0, d.disp.stats().grown);
+    }
+
+    // a dispatcher with independent graphs, whose
+    // sessions sleep for the given milliseconds.
+    struct sleepy_dispatcher {
+        vector<unique_ptr<graph>> graphs;
+        queue<uint64_t> done;
+        queue<uint64_t> dropped;
+        graph_dispatcher disp;
+
+        sleepy_dispatcher(size_t count, size_t window, chrono::milliseconds timeout) {
+            for (size_t i = 0; i < count; i ++) {
+                unique_ptr<graph> g(new graph("sleepy"));
+                g->def_vars({"input", "out"});
+                g->add_op("sleep", {"input"}, {"out"}, [] (graph::ctx ctx) {
+                    this_thread::sleep_for(chrono::milliseconds(ctx.in<int>(0)));
+                    ctx.out(0)->set<int>(ctx.in<int>(0));
+                });
+                disp.add_graph(g.get());
+                graphs.push_back(move(g));
+            }
+            disp.set_order(window, timeout);
+        }
+
+        void dispatch(uint64_t seq, int ms, const string& source = "cam") {
+            session s;
+            s.source = source;
+            s.seq = seq;
+            s.initializer = [ms] (graph *g) {
+                g->var("input")->set<int>(ms);
+            };
+            s.finalizer = [this, seq] (graph *g) {
+                done.put(seq);
+            };
+            s.dropped = [this, seq] {
+                dropped.put(seq);
+            };
+            disp.dispatch(s);
+        }
+    };
+
+    TEST(DispatchTest, Ordered) {
+        sleepy_dispatcher d(3, 3, chrono::milliseconds(2000));
+        d.dispatch(1, 60);
+        d.dispatch(2, 30);
+        d.dispatch(3, 1);
+        EXPECT_EQ(1, d.done.get());
+        EXPECT_EQ(2, d.done.get());
+        EXPECT_EQ(3, d.done.get());
+        d.dispatch(4, 1, "other");
+        EXPECT_EQ(4, d.done.get());
+        auto stats = d.disp.stats();
+        EXPECT_EQ(2, stats.reordered);
+        EXPECT_EQ(0, stats.late);
+    }
+
+    TEST(DispatchTest, OrderedTimeout) {
+        sleepy_dispatcher d(2, 2, chrono::milliseconds(20));
+        d.dispatch(1, 300);
+        d.dispatch(2, 1);
+        EXPECT_EQ(2, d.done.get());
+        EXPECT_EQ(1, d.dropped.get());
+        EXPECT_TRUE(d.done.empty());
+        EXPECT_EQ(1, d.disp.stats().late);
+    }
+
+    TEST(DispatchTest, OrderedWindow) {
+        sleepy_dispatcher d(3, 1, chrono::milliseconds(2000));
+        d.dispatch(1, 300);
+        d.dispatch(2, 1);
+        d.dispatch(3, 30);
+        // 3 completing makes two frames wait behind 1, beyond the window.
+        EXPECT_EQ(2, d.done.get());
+        EXPECT_EQ(3, d.done.get());
+        EXPECT_EQ(1, d.dropped.get());
+    }
+
+    // a dispatcher with one graph per delay, each session
+    // outputs the name of the graph which ran it.
+    struct mixed_dispatcher {
+        vector<unique_ptr<graph>> graphs;
+        queue<string> done;
+        graph_dispatcher disp;
+
+        mixed_dispatcher(const vector<pair<string, int>>& delays) {
+            for (auto& d : delays) {
+                unique_ptr<graph> g(new graph(d.first));
+                string name = d.first;
+                int ms = d.second;
+                g->def_vars({"input", "out"});
+                g->add_op("sleep", {"input"}, {"out"}, [name, ms] (graph::ctx ctx) {
+                    auto done = ctx.defer();
+                    thread([ctx, done, name, ms] {
+                        this_thread::sleep_for(chrono::milliseconds(ms));
+                        ctx.out(0)->set<string>(name);
+                        done();
+                    }).detach();
+                });
+                disp.add_graph(g.get());
+                graphs.push_back(move(g));
+            }
+        }
+
+        void dispatch() {
+            session s;
+            s.initializer = [] (graph *g) {
+                g->var("input")->set<string>("x");
+            };
+            s.finalizer = [this] (graph *g) {
+                done.put(g->var("out")->as<string>());
+            };
+            disp.dispatch(s);
+        }
+
+        // runs one session on every slot to measure them.
+        void warm_up() {
+            for (size_t i = 0; i < graphs.size(); i ++) dispatch();
+            for (size_t i = 0; i < graphs.size(); i ++) done.get();
+            // the time is recorded after the finalizer.
+            eventually([this] {
+                for (auto t : disp.service_times()) {
+                    if (t <= 0) return false;
+                }
+                return true;
+            });
+        }
+    };
+
+    TEST(DispatchTest, FastestIdle) {
+        mixed_dispatcher d({{"slow", 30}, {"fast", 5}});
+        d.warm_up();
+        auto times = d.disp.service_times();
+        ASSERT_EQ(2, times.size());
+        EXPECT_GT(times[0], times[1]);
+        for (int i = 0; i < 5; i ++) {
+            // let the slot go idle after its finalizer.
+            this_thread::sleep_for(chrono::milliseconds(5));
+            d.dispatch();
+            EXPECT_EQ("fast", d.done.get());
+        }
+    }
+
+    TEST(DispatchTest, LeastExpectedCompletion) {
+        mixed_dispatcher d({{"slow", 60}, {"fast1", 5}, {"fast2", 5}, {"fast3", 5}});
+        d.disp.set_queue(2, overflow_policy::block);
+        d.warm_up();
+        const int count = 60;
+        thread feeder([&d] {
+            for (int i = 0; i < count; i ++) d.dispatch();
+        });
+        int slow = 0;
+        for (int i = 0; i < count; i ++) {
+            if (d.done.get() == "slow") slow ++;
+        }
+        feeder.join();
+        // the slow slot may take the first session while idle,
+        // afterwards it leaves the queue to the fast ones.
+        EXPECT_LE(slow, 1);
+        EXPECT_GT(d.disp.stats().yielded, 0);
+    }
+}
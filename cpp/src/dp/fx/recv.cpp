@@ -4,6 +4,7 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <string.h>
 #include <stdexcept>
 #include <glog/logging.h>
 
@@ -51,34 +52,35 @@ namespace dp::fx {
     }
 
     void tcp_recv::run(recv_handler handler) {
-        bool expect_data = false;
-        size_t recv_size = 0, size = 0;
         while (true) {
-            if (expect_data) {
-                size_t left = size - recv_size;
-                int r = recv(socket_fd(), (char*)buf_ptr()+recv_size, left, 0);
-                if (r < 0) {
-                    throw runtime_error(errmsg("recv"));
-                }
-                recv_size += (size_t)r;
-                if (recv_size >= size) {
-                    expect_data = false;
-                    recv_size = 0;
-                    handler(buf_ptr(), size);
-                }
-            } else {
-                size_t left = 2 - recv_size;
-                int r = recv(socket_fd(), (char*)buf_ptr()+recv_size, left, 0);
-                if (r < 0) {
-                    throw runtime_error(errmsg("recv"));
-                }
-                recv_size += (size_t)r;
-                if (recv_size >= 2) {
-                    size = *(uint16_t*)buf_ptr();
-                    expect_data = true;
-                    recv_size = 0;
+            uint16_t sz16;
+            recv_all(&sz16, sizeof(sz16));
+            size_t size = sz16;
+            if (sz16 == 0xffff) {
+                uint32_t sz32;
+                recv_all(&sz32, sizeof(sz32));
+                if (sz32 > max_frame_size) {
+                    throw runtime_error("frame too large: " + to_string(sz32));
                 }
+                size = sz32;
             }
+            reserve(size);
+            recv_all(buf_ptr(), size);
+            handler(buf_ptr(), size);
+        }
+    }
+
+    void tcp_recv::recv_all(void *buf, size_t size) {
+        size_t recv_size = 0;
+        while (recv_size < size) {
+            int r = recv(socket_fd(), (char*)buf+recv_size, size-recv_size, 0);
+            if (r < 0) {
+                throw runtime_error(errmsg("recv"));
+            }
+            if (r == 0) {
+                throw runtime_error("connection closed");
+            }
+            recv_size += (size_t)r;
         }
     }
 
@@ -92,7 +94,7 @@ namespace dp::fx {
     }
 
     udp_recv::udp_recv(const string& host, int port)
-    : socket_recv(SOCK_DGRAM) {
+    : socket_recv(SOCK_DGRAM), m_chunks(2) {
         sockaddr_in sa;
         memset(&sa, 0, sizeof(sa));
         sa.sin_family = PF_INET;
@@ -125,7 +127,18 @@ namespace dp::fx {
                 }
                 throw runtime_error(errmsg("recvfrom"));
             }
-            handler(buf_ptr(), (size_t)r);
+            chunk_header h;
+            if (!chunk_header::decode(buf_ptr(), (size_t)r, h)) {
+                handler(buf_ptr(), (size_t)r);
+                continue;
+            }
+            size_t len = 0;
+            uint64_t src = ((uint64_t)sa.sin_addr.s_addr << 16) | sa.sin_port;
+            size_t slot = m_chunks.feed(src, buf_ptr(), (size_t)r, len);
+            if (slot != index_pool::none) {
+                handler(m_chunks.buf(slot), len);
+                m_chunks.release(slot);
+            }
         }
     }
 }
\ No newline at end of file
@@ -1,23 +1,34 @@
-#include <thread>
 #include <stdexcept>
 #include <glog/logging.h>
 
-#include "dp/util/queue.h"
+#include "dp/util/executor.h"
 #include "dp/graph.h"
 
 namespace dp {
     using namespace std;
 
+    constexpr size_t graph::none;
+
     graph::graph(const string& name)
-    : m_name(name) {
+    : m_name(name), m_prog(new program()),
+      m_executor(nullptr), m_active(0), m_failed(false), m_done(false) {
+    }
+
+    graph::program* graph::build_prog() {
+        if (m_prog->forked) throw logic_error("graph already forked: " + m_name);
+        m_prog->compiled = false;
+        return m_prog.get();
     }
 
     graph::variable* graph::def_var(const string& name) {
-        auto pr = m_vars.insert(make_pair(name, nullptr));
+        auto prog = build_prog();
+        auto pr = prog->var_names.insert(make_pair(name, m_vars.size()));
         if (!pr.second) throw invalid_argument("variable already defined: " + name);
-        auto v = new variable(name);
-        pr.first->second.reset(v);
-        return v;
+        prog->vars.push_back(name);
+        prog->producers.push_back(none);
+        prog->types.push_back(nullptr);
+        m_vars.push_back(variable(name));
+        return &m_vars.back();
     }
 
     void graph::def_vars(const vector<string>& names) {
@@ -26,28 +37,112 @@ namespace dp {
         }
     }
 
+    static size_t must_find_index(const unordered_map<string, size_t>& names, const string& name) {
+        auto it = names.find(name);
+        if (it == names.end())
+            throw invalid_argument("variable not found: " + name);
+        return it->second;
+    }
+
     void graph::add_op(const string& name,
         const vector<string>& inputs,
         const vector<string>& outputs,
-        const op_func& fn) {
-        auto pr = m_ops.insert(make_pair(name, nullptr));
-        if (!pr.second) throw invalid_argument("operator already defined: " + name);
-        op *o = new op(name, fn);
+        const op_func& fn, const op_sig& sig) {
+        auto prog = build_prog();
+        if (prog->op_names.find(name) != prog->op_names.end())
+            throw invalid_argument("operator already defined: " + name);
+        if (!sig.empty() && (sig.in.size() != inputs.size() || sig.out.size() != outputs.size()))
+            throw invalid_argument("operator " + name + " expects " +
+                to_string(sig.in.size()) + " inputs and " + to_string(sig.out.size()) + " outputs");
+        op o(name, fn);
         for (auto& n : inputs) {
-            o->params.push_back(var(n));
+            o.params.push_back(must_find_index(prog->var_names, n));
         }
         for (auto& n : outputs) {
-            auto pr = m_out_vars.insert(make_pair(n, name));
-            if (!pr.second)
-                throw invalid_argument("var " + n + " is already output from op " + pr.first->second);
-            o->results.push_back(var(n));
+            auto index = must_find_index(prog->var_names, n);
+            auto producer = prog->producers[index];
+            if (producer != none)
+                throw invalid_argument("var " + n + " is already output from op " + prog->ops[producer].name);
+            o.results.push_back(index);
+        }
+
+        auto types = prog->types;
+        auto declare = [&types, prog] (size_t index, const type_info* t) {
+            if (t == nullptr) return;
+            auto& declared = types[index];
+            if (declared == nullptr) {
+                declared = t;
+            } else if (*declared != *t) {
+                throw variable::type_error(prog->vars[index], declared->name(), t->name());
+            }
+        };
+        if (!sig.empty()) {
+            for (size_t i = 0; i < o.params.size(); i ++) {
+                declare(o.params[i], sig.in[i]);
+            }
+            for (size_t i = 0; i < o.results.size(); i ++) {
+                declare(o.results[i], sig.out[i]);
+            }
+        }
+        prog->types.swap(types);
+
+        for (auto index : o.results) {
+            prog->producers[index] = prog->ops.size();
         }
-        pr.first->second.reset(o);
+        prog->op_names.insert(make_pair(name, prog->ops.size()));
+        prog->ops.push_back(move(o));
+    }
+
+    void graph::compile() {
+        auto prog = m_prog.get();
+        if (prog->compiled) return;
+        auto& ops = prog->ops;
+        for (auto& o : ops) {
+            o.sources.clear();
+            o.successors.clear();
+            o.deps = 0;
+        }
+        for (size_t i = 0; i < ops.size(); i ++) {
+            op& o = ops[i];
+            for (auto v : o.params) {
+                auto producer = prog->producers[v];
+                if (producer == none) {
+                    o.sources.push_back(v);
+                } else {
+                    ops[producer].successors.push_back(i);
+                    o.deps ++;
+                }
+            }
+        }
+        prog->typed_sources.clear();
+        for (size_t v = 0; v < prog->vars.size(); v ++) {
+            if (prog->types[v] != nullptr && prog->producers[v] == none) {
+                prog->typed_sources.push_back(v);
+            }
+        }
+        prog->lanes.reset(new op_lane[ops.size()]);
+        m_pending.reset(new atomic<size_t>[ops.size()]);
+        m_latency.resize(ops.size());
+        prog->compiled = true;
+    }
+
+    graph* graph::fork() const {
+        const_cast<graph*>(this)->compile();
+        unique_ptr<graph> g(new graph(m_name));
+        g->m_prog = m_prog;
+        for (auto& name : m_prog->vars) {
+            g->m_vars.push_back(variable(name));
+        }
+        g->m_pending.reset(new atomic<size_t>[m_prog->ops.size()]);
+        g->m_latency.resize(m_prog->ops.size());
+        m_prog->forked = true;
+        return g.release();
     }
 
     graph::variable* graph::find_var(const string& name) const noexcept {
-        auto it = m_vars.find(name);
-        return it == m_vars.end() ? nullptr : it->second.get();
+        auto& names = m_prog->var_names;
+        auto it = names.find(name);
+        return it == names.end() ? nullptr : const_cast<variable*>(&m_vars[it->second]);
     }
 
     graph::variable* graph::var(const string& name) const {
@@ -58,64 +153,144 @@ namespace dp {
     }
 
     void graph::reset() {
-        for (auto& pr : m_vars) {
-            pr.second->clear();
-        }
-        for (auto& pr : m_ops) {
-            pr.second->activated = false;
+        for (auto& v : m_vars) {
+            v.clear();
         }
+        m_latency.clear();
     }
 
-    void graph::exec(size_t concurrency) {
+    void graph::exec(executor* ex) {
         VLOG(2) << "G:" + m_name << " EXEC";
-        single_consumer_queue<op*> doneq(m_ops.size());
-        queue<op*> runq;
-        vector<unique_ptr<thread>> threads(concurrency);
-        size_t count = 0;
-        for (size_t i = 0; i < concurrency; i ++) {
-            threads[i].reset(new thread([this, &doneq, &runq] () {
-                op *o = nullptr;
-                while ((o = runq.get()) != nullptr) {
-                    VLOG(2) << "G:" + m_name << " OP:" + o->name << " START";
-                    o->run([&doneq, o] () {
-                        doneq.put(o);
-                    });
-                }
-            }));
+        compile();
+        auto& ops = m_prog->ops;
+        for (auto v : m_prog->typed_sources) {
+            exception_ptr err;
+            if (!check_type(v, err)) rethrow_exception(err);
+        }
+        m_executor = ex == nullptr ? executor::get() : ex;
+        m_error = nullptr;
+        m_failed = false;
+        m_done = false;
+        // hold one reference so completions during seeding
+        // can't report the graph done early.
+        m_active = 1;
+
+        for (size_t i = 0; i < ops.size(); i ++) {
+            const op& o = ops[i];
+            size_t pending = o.deps;
+            for (auto v : o.sources) {
+                if (!m_vars[v].is_set()) pending ++;
+            }
+            m_pending[i] = pending;
+        }
+        // ops with deps are only activated by their producers,
+        // so the counters of the others stay stable while seeding.
+        for (size_t i = 0; i < ops.size(); i ++) {
+            if (ops[i].deps == 0 && m_pending[i].load() == 0) {
+                activate(i);
+            }
         }
 
-        for (auto& pr : m_ops) {
-            op* o = pr.second.get();
-            if (!o->activated && o->ready()) {
-                o->activated = true;
-                count ++;
-                runq.put(o);
+        if (m_active.fetch_sub(1) > 1) {
+            unique_lock<mutex> lock(m_exec_mutex);
+            while (!m_done) m_exec_cv.wait(lock);
+        }
+
+        VLOG(2) << "G:" + m_name << " DONE";
+        if (m_error) rethrow_exception(m_error);
+    }
+
+    void graph::activate(size_t index) {
+        m_active.fetch_add(1);
+        if (m_prog->forked) {
+            op_lane& lane = m_prog->lanes[index];
+            unique_lock<mutex> lock(lane.mutex);
+            if (lane.busy) {
+                lane.waiting.push_back(this);
+                return;
             }
+            lane.busy = true;
         }
+        m_executor->submit([this, index] { run(index); });
+    }
 
-        while (count > 0) {
-            auto o = doneq.get();
-            if (o == nullptr) break;
-            VLOG(2) << "G:" + m_name << " OP:" + o->name << " DONE";
-            count --;
-            for (auto v : o->results) {
-                if (!v->is_set())
-                    throw logic_error("op " + o->name + " completes without set output " + v->name());
+    void graph::release(size_t index) {
+        if (!m_prog->forked) return;
+        op_lane& lane = m_prog->lanes[index];
+        graph* next = nullptr;
+        {
+            unique_lock<mutex> lock(lane.mutex);
+            if (lane.waiting.empty()) {
+                lane.busy = false;
+                return;
             }
-            for (auto& pr : m_ops) {
-                o = pr.second.get();
-                if (!o->activated && o->ready()) {
-                    o->activated = true;
-                    count ++;
-                    runq.put(o);
-                }
+            next = lane.waiting.front();
+            lane.waiting.pop_front();
+        }
+        next->m_executor->submit([next, index] { next->run(index); });
+    }
+
+    void graph::run(size_t index) {
+        const op& o = m_prog->ops[index];
+        VLOG(2) << "G:" + m_name << " OP:" + o.name << " START";
+        m_latency.op(index).begin = frame_latency::now();
+        function<void()> done = [this, index] () {
+            complete(index, nullptr);
+        };
+        try {
+            o.fn(ctx(this, &o, &done));
+        } catch (...) {
+            // after defer, completing is up to the deferred call,
+            // which may have finished the graph already.
+            if (done) {
+                complete(index, current_exception());
+            } else {
+                LOG(ERROR) << "op throws after defer";
             }
+            return;
         }
+        if (done) done();
+    }
 
-        for (size_t i = 0; i < threads.size(); i ++) runq.put(nullptr);
-        for (auto& t : threads) t->join();
+    void graph::complete(size_t index, exception_ptr err) {
+        const op& o = m_prog->ops[index];
+        VLOG(2) << "G:" + m_name << " OP:" + o.name << " DONE";
+        m_latency.op(index).end = frame_latency::now();
+        release(index);
+        if (!err) {
+            for (auto v : o.results) {
+                if (!m_vars[v].is_set()) {
+                    err = make_exception_ptr(logic_error(
+                        "op " + o.name + " completes without set output " + m_vars[v].name()));
+                    break;
+                }
+                if (!check_type(v, err)) break;
+            }
+        }
+        if (err) {
+            unique_lock<mutex> lock(m_exec_mutex);
+            if (!m_error) m_error = err;
+            m_failed = true;
+        } else if (!m_failed.load()) {
+            for (auto s : o.successors) {
+                if (m_pending[s].fetch_sub(1) == 1) activate(s);
+            }
+        }
+        if (m_active.fetch_sub(1) == 1) {
+            unique_lock<mutex> lock(m_exec_mutex);
+            m_done = true;
+            m_exec_cv.notify_all();
+        }
+    }
 
-        VLOG(2) << "G:" + m_name << " DONE";
+    bool graph::check_type(size_t index, exception_ptr& err) const {
+        auto declared = m_prog->types[index];
+        auto& v = m_vars[index];
+        if (declared == nullptr || !v.is_set() || *v.type() == *declared) {
+            return true;
+        }
+        err = make_exception_ptr(variable::type_error(v.name(), v.type()->name(), declared->name()));
+        return false;
     }
 
     function<void()> graph::ctx::defer() {
@@ -124,9 +299,4 @@ namespace dp {
         *m_done_ptr = nullptr;
         return fn;
     }
-
-    void graph::op::run(function<void()> done) {
-        fn(ctx(this, &done));
-        if (done) done();
-    }
 }
@@ -1,4 +1,6 @@
 #include <cstring>
+#include <cstdlib>
+#include <cerrno>
 #include <stdexcept>
 #include <fstream>
 #include <unordered_set>
@@ -20,6 +22,15 @@ namespace dp {
         return f->create_op(name, type, params);
     }
 
+    graph::op_sig graph_def::op_registry::signature(
+        const string& type, const graph_def::params& params) {
+        auto f = get_factory(type);
+        if (f == nullptr) {
+            throw invalid_argument("invalid op " + type);
+        }
+        return f->signature(type, params);
+    }
+
     void graph_def::op_registry::add_factory(const ::std::string& name, op_factory* f) {
         if (!m_factories.insert(make_pair(name, f)).second) {
             throw logic_error("factory already registered: " + name);
@@ -54,6 +65,41 @@ namespace dp {
         return it == m_factories.end() ? nullptr : it->second;
     }
 
+    string graph_def::param(const graph_def::params& arg, const string& key) {
+        auto it = arg.find(key);
+        return it == arg.end() ? string() : it->second;
+    }
+
+    long graph_def::int_param(const graph_def::params& arg, const string& key,
+        long def, long min, long max) {
+        auto str = param(arg, key);
+        if (str.empty()) return def;
+        char *end = nullptr;
+        errno = 0;
+        long n = strtol(str.c_str(), &end, 10);
+        if (errno != 0 || *end != 0 || n < min || n > max) {
+            throw invalid_argument("invalid param " + key + ": " + str);
+        }
+        return n;
+    }
+
+    double graph_def::real_param(const graph_def::params& arg, const string& key,
+        double def, double min) {
+        auto str = param(arg, key);
+        if (str.empty()) return def;
+        char *end = nullptr;
+        double v = strtod(str.c_str(), &end);
+        if (*end != 0 || !(v >= min)) {
+            throw invalid_argument("invalid param " + key + ": " + str);
+        }
+        return v;
+    }
+
+    bool graph_def::bool_param(const graph_def::params& arg, const string& key) {
+        auto str = param(arg, key);
+        return str == "true" || str == "1";
+    }
+
     static graph_def::op_registry _op_registry;
     static graph_def::ingress_registry _ingress_registry;
 
@@ -136,6 +182,10 @@ namespace dp {
 
     exec_env& graph_def::build_env(exec_env& env, const graph_def::params& args) const {
         env.graphs.push_back(move(unique_ptr<graph>(build_graph(args))));
+        if (!env.replicate) {
+            auto name = m_selected_graph;
+            env.replicate = [this, name, args] { return build_graph(name, args); };
+        }
         env.ingresses = move(build_ingresses(args));
         env.build();
         return env;
@@ -164,7 +214,7 @@ namespace dp {
             return g;
         } catch (const exception& e) {
             delete g;
-            throw e;
+            throw;
         }
     }
 
@@ -291,11 +341,17 @@ namespace dp {
             for (auto v_it : it->o_vars) {
                 out.push_back(v_it->name());
             }
-            g.add_op(it->name(), in, out,
-                it->factory->create_op(
-                    it->name(),
-                    it->s_iter->factory->parsed,
-                    make_params(it->s_iter->params, xg.args, args)));
+            auto type = it->s_iter->factory->parsed;
+            auto params = make_params(it->s_iter->params, xg.args, args);
+            try {
+                g.add_op(it->name(), in, out,
+                    it->factory->create_op(it->name(), type, params),
+                    it->factory->signature(type, params));
+            } catch (const graph::variable::type_error& e) {
+                throw graph_def::parse_error(it->s_iter->name->loc,
+                    "op " + it->name() + ": " + e.what());
+            }
         }
+        g.compile();
     }
 }
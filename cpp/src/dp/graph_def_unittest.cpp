@@ -109,4 +109,17 @@ namespace dp {
         EXPECT_STREQ("t2.res", ctx.run("t2").c_str());
         ctx.stop();
     }
+
+    TEST(GraphDefTest, Params) {
+        graph_def::params p{ {"port", "2053"}, {"speed", "0.5"}, {"loop", "1"}, {"bad", "12x"} };
+        EXPECT_EQ(2053, graph_def::int_param(p, "port", 2052, 1, 65535));
+        EXPECT_EQ(2052, graph_def::int_param(p, "missing", 2052, 1, 65535));
+        EXPECT_THROW(graph_def::int_param(p, "port", 0, 1, 1024), invalid_argument);
+        EXPECT_THROW(graph_def::int_param(p, "bad", 0, 0, 100), invalid_argument);
+        EXPECT_DOUBLE_EQ(0.5, graph_def::real_param(p, "speed", 1, 0));
+        EXPECT_THROW(graph_def::real_param(p, "bad", 1, 0), invalid_argument);
+        EXPECT_TRUE(graph_def::bool_param(p, "loop"));
+        EXPECT_FALSE(graph_def::bool_param(p, "missing"));
+        EXPECT_EQ("", graph_def::param(p, "missing"));
+    }
 }
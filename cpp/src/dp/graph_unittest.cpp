@@ -0,0 +1,206 @@
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include "gtest/gtest.h"
+
+#include "dp/graph.h"
+#include "dp/types.h"
+#include "dp/util/executor.h"
+
+namespace dp {
+    using namespace std;
+
+    static graph::op_func append(const string& suffix) {
+        return [suffix] (graph::ctx ctx) {
+            ctx.out(0)->set<string>(ctx.in(0)->as<string>() + suffix);
+        };
+    }
+
+    TEST(GraphTest, VariableStorage) {
+        graph::variable v("v");
+        EXPECT_FALSE(v.is_set());
+        EXPECT_THROW(v.as<int>(), logic_error);
+
+        char data[4];
+        buf_ref ref = { data, sizeof(data) };
+        v.set<buf_ref>(ref);
+        EXPECT_EQ(data, v.as<buf_ref>().ptr);
+        EXPECT_THROW(v.as<string>(), graph::variable::type_error);
+
+        const vector<int> values(16, 1);
+        v.set(values);
+        auto p = &v.as<vector<int>>();
+        auto data_ptr = p->data();
+        v.clear();
+        EXPECT_FALSE(v.is_set());
+        v.set(values);
+        EXPECT_EQ(p, &v.as<vector<int>>());
+        EXPECT_EQ(data_ptr, v.as<vector<int>>().data());
+        v.set<string>("str");
+        EXPECT_STREQ("str", v.as<string>().c_str());
+    }
+
+    TEST(GraphTest, DefVar) {
+        graph g;
+        auto first = g.def_var("v0");
+        first->set<int>(7);
+        for (int i = 1; i < 100; i ++) g.def_var("v" + to_string(i));
+        EXPECT_EQ(first, g.var("v0"));
+        EXPECT_EQ(7, first->as<int>());
+    }
+
+    TEST(GraphTest, Exec) {
+        graph g("test");
+        g.def_vars({"input", "a", "b", "out"});
+        g.add_op("a", {"input"}, {"a"}, append(".a"));
+        g.add_op("b", {"input"}, {"b"}, append(".b"));
+        g.add_op("out", {"a", "b"}, {"out"}, [] (graph::ctx ctx) {
+            ctx.out(0)->set<string>(ctx.in(0)->as<string>() + "+" + ctx.in(1)->as<string>());
+        });
+        for (int i = 0; i < 3; i ++) {
+            g.reset();
+            g.var("input")->set<string>("x");
+            g.exec();
+            EXPECT_STREQ("x.a+x.b", g.var("out")->as<string>().c_str());
+        }
+    }
+
+    TEST(GraphTest, ExecDeferred) {
+        executor ex(2);
+        graph g("test");
+        g.def_vars({"input", "out"});
+        g.add_op("async", {"input"}, {"out"}, [] (graph::ctx ctx) {
+            auto done = ctx.defer();
+            thread([ctx, done] {
+                ctx.out(0)->set<string>(ctx.in(0)->as<string>() + ".async");
+                done();
+            }).detach();
+        });
+        g.var("input")->set<string>("x");
+        g.exec(&ex);
+        EXPECT_STREQ("x.async", g.var("out")->as<string>().c_str());
+    }
+
+    TEST(GraphTest, ExecDeferredThrow) {
+        executor ex(2);
+        graph g("test");
+        g.def_vars({"input", "out"});
+        g.add_op("async", {"input"}, {"out"}, [] (graph::ctx ctx) {
+            auto done = ctx.defer();
+            thread([ctx, done] {
+                this_thread::sleep_for(chrono::milliseconds(20));
+                ctx.out(0)->set<string>(ctx.in(0)->as<string>() + ".async");
+                done();
+            }).detach();
+            throw runtime_error("after defer");
+        });
+        // completes once, by the deferred call.
+        for (int i = 0; i < 2; i ++) {
+            g.reset();
+            g.var("input")->set<string>("x");
+            g.exec(&ex);
+            EXPECT_STREQ("x.async", g.var("out")->as<string>().c_str());
+        }
+    }
+
+    TEST(GraphTest, ExecError) {
+        graph g("test");
+        g.def_vars({"input", "a", "out"});
+        g.add_op("fail", {"input"}, {"a"}, [] (graph::ctx ctx) {
+            throw runtime_error("failed");
+        });
+        g.add_op("out", {"a"}, {"out"}, append(".out"));
+        g.var("input")->set<string>("x");
+        EXPECT_THROW(g.exec(), runtime_error);
+        EXPECT_FALSE(g.var("out")->is_set());
+    }
+
+    TEST(GraphTest, ExecOutOfOrderOps) {
+        graph g("test");
+        g.def_vars({"input", "a", "b", "out"});
+        g.add_op("out", {"b"}, {"out"}, append(".out"));
+        g.add_op("b", {"a"}, {"b"}, append(".b"));
+        g.add_op("a", {"input"}, {"a"}, append(".a"));
+        g.var("input")->set<string>("x");
+        g.exec();
+        EXPECT_STREQ("x.a.b.out", g.var("out")->as<string>().c_str());
+    }
+
+    TEST(GraphTest, ExecMissingInput) {
+        graph g("test");
+        g.def_vars({"input", "other", "a", "b"});
+        g.add_op("a", {"input"}, {"a"}, append(".a"));
+        g.add_op("b", {"a", "other"}, {"b"}, append(".b"));
+        g.var("input")->set<string>("x");
+        g.exec();
+        EXPECT_TRUE(g.var("a")->is_set());
+        EXPECT_FALSE(g.var("b")->is_set());
+    }
+
+    TEST(GraphTest, Fork) {
+        atomic<int> running(0), overlapped(0);
+        graph g("test");
+        g.def_vars({"input", "a", "out"});
+        g.add_op("a", {"input"}, {"a"}, [&running, &overlapped] (graph::ctx ctx) {
+            if (running.fetch_add(1) > 0) overlapped ++;
+            this_thread::sleep_for(chrono::milliseconds(2));
+            ctx.out(0)->set<string>(ctx.in(0)->as<string>() + ".a");
+            running --;
+        });
+        g.add_op("out", {"a"}, {"out"}, append(".out"));
+        vector<unique_ptr<graph>> frames;
+        for (int i = 0; i < 3; i ++) {
+            frames.push_back(unique_ptr<graph>(g.fork()));
+        }
+        EXPECT_THROW(g.def_var("more"), logic_error);
+
+        vector<thread> threads;
+        for (size_t i = 0; i < frames.size(); i ++) {
+            threads.push_back(thread([&frames, i] {
+                auto f = frames[i].get();
+                for (int n = 0; n < 5; n ++) {
+                    f->reset();
+                    f->var("input")->set<string>(to_string(i));
+                    f->exec();
+                    EXPECT_EQ(to_string(i) + ".a.out", f->var("out")->as<string>());
+                }
+            }));
+        }
+        for (auto& t : threads) t.join();
+        EXPECT_EQ(0, overlapped.load());
+        EXPECT_FALSE(g.var("out")->is_set());
+    }
+
+    struct typed_append : graph::typed_op<graph::inputs<string>, graph::outputs<string>> {
+        void operator() (graph::ctx ctx) {
+            ctx.out(0)->set<string>(ctx.in<string>(0) + ".typed");
+        }
+    };
+
+    TEST(GraphTest, TypedOps) {
+        graph g("test");
+        g.def_vars({"input", "a", "b", "c"});
+        g.add_op("a", {"input"}, {"a"}, typed_append());
+        EXPECT_THROW(g.add_op("b", {"a"}, {"b"}, [] (graph::ctx) { },
+            graph::typed_op<graph::inputs<int>, graph::outputs<int>>::signature()),
+            graph::variable::type_error);
+        EXPECT_THROW(g.add_op("b", {"a", "input"}, {"b"}, typed_append()), invalid_argument);
+        g.add_op("b", {"a"}, {"b"}, [] (graph::ctx ctx) {
+            ctx.out(0)->set<int>(1);
+        }, graph::typed_op<graph::inputs<void>, graph::outputs<void>>::signature());
+        g.add_op("c", {"b"}, {"c"}, typed_append());
+
+        g.var("input")->set<string>("x");
+        EXPECT_THROW(g.exec(), graph::variable::type_error);
+        EXPECT_TRUE(g.var("a")->is_set());
+        EXPECT_FALSE(g.var("c")->is_set());
+
+        g.reset();
+        g.var("input")->set<int>(1);
+        EXPECT_THROW(g.exec(), graph::variable::type_error);
+        EXPECT_FALSE(g.var("a")->is_set());
+    }
+}
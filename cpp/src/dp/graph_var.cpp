@@ -8,24 +8,21 @@ namespace dp {
     using namespace std;
 
     graph::variable::variable(const string& name)
-    : m_name(name), m_val(nullptr) {
+    : m_name(name), m_type(nullptr), m_heap(nullptr), m_heap_type(nullptr) {
     }
 
-    graph::variable::~variable() {
-        if (m_val) {
-            delete m_val;
-        }
-    }
-
-    void graph::variable::set_val(val_base *val) {
-        clear();
-        m_val = val;
+    graph::variable::variable(variable&& v)
+    : m_name(move(v.m_name)), m_type(v.m_type), m_inline(v.m_inline),
+      m_heap(v.m_heap), m_heap_type(v.m_heap_type) {
+        v.m_type = nullptr;
+        v.m_heap = nullptr;
+        v.m_heap_type = nullptr;
     }
 
-    void graph::variable::clear() {
-        auto p = m_val;
-        m_val = nullptr;
-        if (p != nullptr) delete p;
+    graph::variable::~variable() {
+        if (m_heap) {
+            delete m_heap;
+        }
     }
 
     graph::variable* graph::variable::must_set() {
@@ -29,10 +29,11 @@ namespace dp {
             for (size_t off = buf.len-4; off > 0; off --) {
                 if (p[off] == 0xff && p[off+1] == 0xfe) {
                     if (off + 4 >= buf.len) continue;
+                    // the size of a segment includes its own 2 bytes.
                     uint16_t sz = ((uint16_t)p[off+2] << 8) | (uint16_t)p[off+3];
-                    if (off+sz+4 > buf.len) continue;
+                    if (sz < 2 || off+sz+4 > buf.len) continue;
                     if (p[off+sz+2] != 0xff) continue;
-                    comment.assign((const char*)p+off+4, sz);
+                    comment.assign((const char*)p+off+4, sz-2);
                     break;
                 }
             }
@@ -57,12 +58,13 @@ namespace dp {
         if (p[0] != 0xff || p[1] != 0xd9)
             return false;
         string str = id.encode();
-        if (buf.len + str.length() + 4 > capacity)
+        if (str.length() + 2 > 0xffff || buf.len + str.length() + 4 > capacity)
             return false;
         memcpy(p+4, str.c_str(), str.length());
+        size_t sz = str.length() + 2;
         p[1] = 0xfe;
-        p[2] = (uint8_t)(str.length() >> 8);
-        p[3] = (uint8_t)(str.length() && 0xff);
+        p[2] = (uint8_t)(sz >> 8);
+        p[3] = (uint8_t)(sz & 0xff);
         p += 4 + str.length();
         p[0] = 0xff;
         p[1] = 0xd9;
@@ -1,8 +1,23 @@
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <deque>
+#include <stdexcept>
+#include <glog/logging.h>
+
 #include "dp/ingress.h"
+#include "dp/util/error.h"
 
 namespace dp {
     using namespace std;
 
+    // lets the poll thread notice ingresses which ended by themselves.
+    static constexpr int poll_timeout_ms = 200;
+    // how soon a stalled ingress or held sessions are tried again.
+    static constexpr int retry_ms = 5;
+
     ingress::ingress()
     : m_input_var("input"), m_running(true) {
 
@@ -19,9 +34,11 @@ namespace dp {
 
     bool ingress::recv(dispatcher *disp, bool nowait) {
         session session;
-        if (prepare_session(session, nowait)) {
-            return disp->dispatch(session, nowait);
-        }
+        if (!prepare_session(session, nowait)) return false;
+        if (!nowait) return disp->dispatch(session);
+        if (disp->offer(session)) return true;
+        // refused, and still ours.
+        if (session.dropped) session.dropped();
         return false;
     }
 
@@ -31,12 +48,66 @@ namespace dp {
         }
     }
 
-    ingress::runner::runner() {
+    bool ingress::poll(dispatcher *disp) {
+        while (running()) {
+            session session;
+            if (!prepare_session(session, true)) break;
+            disp->dispatch(session, true);
+        }
+        return true;
+    }
+
+    // stands between a polled ingress and the dispatcher,
+    // holding the sessions refused for now so poll never blocks.
+    struct polled_ingress : public dispatcher {
+        ingress *in;
+        int fd;
+        dispatcher *target;
+        deque<session> held;
+        bool stalled;
+        // whether fd is in the epoll set.
+        bool armed;
+
+        polled_ingress(ingress *i, int f, dispatcher *t)
+        : in(i), fd(f), target(t), stalled(false), armed(false) { }
+
+        // false when s is held: not lost, and no longer the caller's.
+        bool dispatch(const session& s, bool nowait) {
+            if (held.empty() && target->offer(s)) return true;
+            held.push_back(s);
+            return false;
+        }
+
+        // refuses instead of holding, as offer leaves s to the caller.
+        bool offer(const session& s) {
+            return held.empty() && target->offer(s);
+        }
+
+        double load() const { return target->load(); }
+
+        void drop_held() {
+            for (auto& s : held) {
+                if (s.dropped) s.dropped();
+            }
+            held.clear();
+        }
+
+        // false while some are still refused.
+        bool flush() {
+            while (!held.empty()) {
+                if (!target->offer(held.front())) return false;
+                held.pop_front();
+            }
+            return true;
+        }
+    };
+
+    ingress::runner::runner() : m_multiplex(false), m_wake(-1) {
 
     }
 
     ingress::runner::~runner() {
-
+        if (m_wake >= 0) close(m_wake);
     }
 
     void ingress::runner::add(ingress *ingress) {
@@ -44,18 +115,121 @@ namespace dp {
     }
 
     void ingress::runner::start(dispatcher *disp) {
+        vector<ingress*> pollable;
         for (auto ingress : m_ingresses) {
+            if (m_multiplex && ingress->poll_fd() >= 0) {
+                pollable.push_back(ingress);
+                continue;
+            }
             unique_ptr<thread> thread_ptr(new thread([ingress, disp] {
                 ingress->run(disp);
             }));
             m_threads.push_back(move(thread_ptr));
         }
+        if (pollable.empty()) return;
+        if (m_wake < 0) {
+            m_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (m_wake < 0) {
+                throw runtime_error(errmsg("eventfd"));
+            }
+        }
+        unique_ptr<thread> thread_ptr(new thread([this, pollable, disp] {
+            poll_all(pollable, disp);
+        }));
+        m_threads.push_back(move(thread_ptr));
     }
 
     void ingress::runner::stop() {
         for (auto ingress : m_ingresses) {
             ingress->stop();
         }
+        if (m_wake >= 0) {
+            uint64_t one = 1;
+            if (write(m_wake, &one, sizeof(one)) < 0) { }
+        }
+    }
+
+    void ingress::runner::poll_all(const vector<ingress*>& ingresses, dispatcher *disp) {
+        int ep = epoll_create1(EPOLL_CLOEXEC);
+        if (ep < 0) {
+            LOG(ERROR) << errmsg("epoll_create1");
+            return;
+        }
+        vector<polled_ingress*> entries;
+        // nothing catches on this thread: on errors the ingresses
+        // aren't polled any more, and the held sessions are dropped.
+        try {
+            auto arm = [ep] (polled_ingress *p, bool on) {
+                if (p->armed == on) return;
+                epoll_event ev;
+                memset(&ev, 0, sizeof(ev));
+                ev.events = EPOLLIN;
+                ev.data.ptr = p;
+                if (epoll_ctl(ep, on ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, p->fd, &ev) < 0) {
+                    throw runtime_error(errmsg("epoll_ctl"));
+                }
+                p->armed = on;
+            };
+            // polls p, and arms its fd unless it has to be retried.
+            auto step = [&arm] (polled_ingress *p) {
+                if (p->flush() && p->in->running()) {
+                    p->stalled = !p->in->poll(p);
+                }
+                arm(p, p->held.empty() && !p->stalled && p->in->running());
+            };
+
+            epoll_event wake;
+            memset(&wake, 0, sizeof(wake));
+            wake.events = EPOLLIN;
+            wake.data.ptr = nullptr;
+            if (epoll_ctl(ep, EPOLL_CTL_ADD, m_wake, &wake) < 0) {
+                throw runtime_error(errmsg("epoll_ctl"));
+            }
+            for (auto in : ingresses) {
+                auto p = new polled_ingress(in, in->poll_fd(), disp);
+                m_polled.push_back(unique_ptr<dispatcher>(p));
+                entries.push_back(p);
+                step(p);
+            }
+
+            const size_t max_events = 64;
+            epoll_event events[max_events];
+            while (!entries.empty()) {
+                bool retry = false;
+                for (auto p : entries) {
+                    if (!p->armed) retry = true;
+                }
+                int n = epoll_wait(ep, events, max_events, retry ? retry_ms : poll_timeout_ms);
+                if (n < 0 && errno != EINTR) {
+                    throw runtime_error(errmsg("epoll_wait"));
+                }
+                for (int i = 0; i < n; i ++) {
+                    auto p = (polled_ingress*)events[i].data.ptr;
+                    if (p == nullptr) {
+                        uint64_t val;
+                        while (read(m_wake, &val, sizeof(val)) > 0) { }
+                        continue;
+                    }
+                    step(p);
+                }
+                for (auto it = entries.begin(); it != entries.end(); ) {
+                    auto p = *it;
+                    if (!p->armed && p->in->running()) step(p);
+                    if (p->in->running()) {
+                        ++ it;
+                        continue;
+                    }
+                    // an ingress stopped, or done: its held sessions are dropped.
+                    arm(p, false);
+                    p->drop_held();
+                    it = entries.erase(it);
+                }
+            }
+        } catch (const exception& e) {
+            LOG(ERROR) << "poll: " << e.what();
+            for (auto p : entries) p->drop_held();
+        }
+        close(ep);
     }
 
     void ingress::runner::join() {
@@ -66,9 +240,19 @@ namespace dp {
     }
 
     void exec_env::build() {
+        dispatcher.set_queue(queue_size, overflow);
+        dispatcher.set_order(order_window, order_timeout);
         for (auto& p : graphs) {
-            dispatcher.add_graph(p.get());
+            dispatcher.add_graph(p.get(), frames);
+        }
+        if (replicate && max_graphs > dispatcher.size()) {
+            scaling_policy policy;
+            policy.min_slots = dispatcher.size();
+            policy.max_slots = max_graphs;
+            policy.factory = replicate;
+            dispatcher.set_scaling(policy);
         }
+        runner.set_multiplex(multiplex);
         for (auto& p : ingresses) {
             runner.add(p.get());
         }
@@ -0,0 +1,53 @@
+#include <cstdio>
+
+#include "dp/types.h"
+#include "net.h"
+
+namespace dp::in {
+    using namespace std;
+
+    string address_source(const sockaddr_in& sa) {
+        char str[16];
+        snprintf(str, sizeof(str), "%08x", sa.sin_addr.s_addr);
+        return str;
+    }
+
+    bool datagram_session(session& session, const string& input_var,
+        reassembler& chunks, void* buf, size_t len, size_t cap,
+        const sockaddr_in& from, function<void()> release) {
+        chunk_header h;
+        if (chunk_header::decode(buf, len, h)) {
+            uint64_t src = ((uint64_t)from.sin_addr.s_addr << 16) | from.sin_port;
+            size_t frame_len = 0;
+            size_t slot = chunks.feed(src, buf, len, frame_len);
+            release();
+            if (slot == index_pool::none) return false;
+            buf = chunks.buf(slot);
+            len = frame_len;
+            cap = chunks.capacity();
+            auto c = &chunks;
+            release = [c, slot] { c->release(slot); };
+        }
+
+        buf_ref ref;
+        ref.ptr = buf;
+        ref.len = len;
+
+        image_id id;
+        if (!image_id::extract(ref, id)) {
+            id.src = address_source(from);
+            image_id::inject(ref, cap, id);
+        }
+
+        session.source = id.src;
+        session.seq = id.seq;
+        session.initializer = [input_var, ref] (graph *g) {
+            g->var(input_var)->set<buf_ref>(ref);
+        };
+        session.finalizer = [release] (graph *g) {
+            release();
+        };
+        session.dropped = release;
+        return true;
+    }
+}
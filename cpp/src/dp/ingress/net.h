@@ -0,0 +1,25 @@
+#ifndef __DP_INGRESS_NET_H
+#define __DP_INGRESS_NET_H
+
+#include <string>
+#include <functional>
+#include <netinet/in.h>
+
+#include "dp/dispatch.h"
+#include "dp/util/chunk.h"
+
+namespace dp::in {
+    // the source of frames from an address which carry no image_id.
+    ::std::string address_source(const sockaddr_in&);
+
+    // makes a session of a datagram in buf, which holds up to cap bytes,
+    // as dp.udp receives them: chunks are put together by chunks first,
+    // and frames without an image_id get one from the address.
+    // release gives buf back, once the session is done with it, or right
+    // away for a chunk. Returns false while the frame isn't complete.
+    bool datagram_session(session&, const ::std::string& input_var,
+        reassembler& chunks, void* buf, size_t len, size_t cap,
+        const sockaddr_in& from, ::std::function<void()> release);
+}
+
+#endif
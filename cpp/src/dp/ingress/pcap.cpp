@@ -0,0 +1,313 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <cstdlib>
+#include <map>
+#include <tuple>
+#include <stdexcept>
+#include <thread>
+#include <glog/logging.h>
+
+#include "dp/operators.h"
+#include "dp/types.h"
+#include "dp/ingress/pcap.h"
+#include "dp/graph_def.h"
+#include "dp/util/error.h"
+#include "net.h"
+
+namespace dp::in {
+    using namespace std;
+
+    // same as dp.udp, holds any datagram with room for an image id.
+    static constexpr size_t buf_size = 0x10000;
+
+    static constexpr uint32_t magic_usec = 0xa1b2c3d4;
+    static constexpr uint32_t magic_nsec = 0xa1b23c4d;
+    static constexpr uint32_t magic_pcapng = 0x0a0d0d0a;
+    static constexpr size_t file_header_size = 24;
+    static constexpr size_t record_header_size = 16;
+
+    enum link_type {
+        link_null = 0,
+        link_ethernet = 1,
+        link_raw_bsd = 12,
+        link_raw = 101,
+        link_linux_sll = 113,
+        link_linux_sll2 = 276,
+    };
+
+    static uint16_t be16(const char *p) {
+        return (uint16_t)(((uint8_t)p[0] << 8) | (uint8_t)p[1]);
+    }
+
+    static uint32_t u32(const char *p, bool swap) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return swap ? __builtin_bswap32(v) : v;
+    }
+
+    static bool known_link(uint32_t link) {
+        switch (link) {
+        case link_null:
+        case link_ethernet:
+        case link_raw_bsd:
+        case link_raw:
+        case link_linux_sll:
+        case link_linux_sll2:
+            return true;
+        }
+        return false;
+    }
+
+    // the offset of the IPv4 header in a captured packet, or -1.
+    static int ipv4_offset(uint32_t link, const char *p, size_t len) {
+        switch (link) {
+        case link_null:
+            if (len < 4) return -1;
+            // the address family, in the capturing host's byte order.
+            return (u32(p, false) == AF_INET || u32(p, true) == AF_INET) ? 4 : -1;
+        case link_ethernet: {
+            size_t off = 12;
+            while (len >= off + 2 && (be16(p + off) == 0x8100 || be16(p + off) == 0x88a8)) {
+                off += 4;
+            }
+            if (len < off + 2 || be16(p + off) != 0x0800) return -1;
+            return (int)off + 2;
+        }
+        case link_raw_bsd:
+        case link_raw:
+            return 0;
+        case link_linux_sll:
+            return len >= 16 && be16(p + 14) == 0x0800 ? 16 : -1;
+        case link_linux_sll2:
+            return len >= 20 && be16(p) == 0x0800 ? 20 : -1;
+        }
+        return -1;
+    }
+
+    pcap::pcap(const string& path, uint16_t port, double speed, bool loop,
+        size_t buf_count, size_t frame_size)
+    : m_map(MAP_FAILED), m_map_len(0), m_port(port), m_speed(speed), m_loop(loop),
+      m_pos(0), m_pool(buf_count), m_bufs(buf_count), m_chunks(buf_count, frame_size) {
+        try {
+            load(path);
+        } catch (const exception&) {
+            if (m_map != MAP_FAILED) munmap(m_map, m_map_len);
+            throw;
+        }
+        if (m_datagrams.empty()) {
+            munmap(m_map, m_map_len);
+            throw runtime_error("no datagrams to port " + to_string(port) + " in " + path);
+        }
+    }
+
+    pcap::~pcap() {
+        munmap(m_map, m_map_len);
+    }
+
+    void pcap::load(const string& path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw runtime_error(errmsg(path));
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            close(fd);
+            throw runtime_error(errmsg(path));
+        }
+        if ((size_t)st.st_size < file_header_size) {
+            close(fd);
+            throw runtime_error(path + ": not a pcap file");
+        }
+        m_map_len = (size_t)st.st_size;
+        m_map = mmap(nullptr, m_map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (m_map == MAP_FAILED) {
+            throw runtime_error(errmsg(path));
+        }
+        madvise(m_map, m_map_len, MADV_SEQUENTIAL);
+
+        const char *p = (const char*)m_map;
+        uint32_t magic = u32(p, false);
+        bool swap = false, nsec = false;
+        if (magic == magic_usec || magic == __builtin_bswap32(magic_usec)) {
+            swap = magic != magic_usec;
+        } else if (magic == magic_nsec || magic == __builtin_bswap32(magic_nsec)) {
+            swap = magic != magic_nsec;
+            nsec = true;
+        } else if (magic == magic_pcapng) {
+            throw runtime_error(path + ": pcapng isn't supported, convert with editcap -F pcap");
+        } else {
+            throw runtime_error(path + ": not a pcap file");
+        }
+        uint32_t link = u32(p + 20, swap) & 0xffff;
+        if (!known_link(link)) {
+            throw runtime_error(path + ": unsupported link type " + to_string(link));
+        }
+
+        // fragments by source, destination and IP id.
+        struct fragments {
+            vector<char> data;
+            // the 8-byte blocks received, so duplicates and
+            // overlaps don't make up for missing fragments.
+            vector<bool> blocks;
+            size_t got, total;
+
+            fragments() : got(0), total(0) { }
+        };
+        map<tuple<uint32_t, uint32_t, uint16_t>, fragments> frags;
+        bool first = true;
+        chrono::nanoseconds base(0);
+        size_t skipped = 0;
+
+        auto add_udp = [&] (const char *udp, size_t len, uint32_t src, chrono::nanoseconds ts) {
+            if (len < 8 || be16(udp + 2) != m_port) return;
+            size_t ulen = be16(udp + 4);
+            if (ulen <= 8 || ulen > len) {
+                skipped ++;
+                return;
+            }
+            if (first) {
+                base = ts;
+                first = false;
+            }
+            datagram d;
+            d.ptr = udp + 8;
+            d.len = ulen - 8;
+            memset(&d.from, 0, sizeof(d.from));
+            d.from.sin_family = AF_INET;
+            d.from.sin_addr.s_addr = src;
+            memcpy(&d.from.sin_port, udp, sizeof(d.from.sin_port));
+            d.time = ts > base ? ts - base : chrono::nanoseconds(0);
+            m_datagrams.push_back(d);
+        };
+
+        size_t off = file_header_size;
+        while (m_map_len - off >= record_header_size) {
+            const char *rec = p + off;
+            uint64_t sec = u32(rec, swap), frac = u32(rec + 4, swap);
+            size_t caplen = u32(rec + 8, swap), origlen = u32(rec + 12, swap);
+            if (caplen > m_map_len - off - record_header_size) {
+                LOG(WARNING) << path << ": truncated at " << off;
+                break;
+            }
+            off += record_header_size + caplen;
+            chrono::nanoseconds ts(sec * 1000000000 + (nsec ? frac : frac * 1000));
+            const char *pkt = rec + record_header_size;
+
+            int ip_off = ipv4_offset(link, pkt, caplen);
+            if (ip_off < 0 || caplen < (size_t)ip_off + 20) continue;
+            const char *ip = pkt + ip_off;
+            size_t avail = caplen - (size_t)ip_off;
+            if (((uint8_t)ip[0] >> 4) != 4 || ip[9] != IPPROTO_UDP) continue;
+            size_t ihl = ((uint8_t)ip[0] & 0xf) * 4;
+            size_t total = be16(ip + 2);
+            if (caplen < origlen || total > avail || ihl < 20 || total <= ihl) {
+                skipped ++;
+                continue;
+            }
+            uint32_t src, dst;
+            memcpy(&src, ip + 12, sizeof(src));
+            memcpy(&dst, ip + 16, sizeof(dst));
+            uint16_t frag = be16(ip + 6);
+            bool more = (frag & 0x2000) != 0;
+            size_t frag_off = (size_t)(frag & 0x1fff) * 8;
+            const char *payload = ip + ihl;
+            size_t len = total - ihl;
+            if (!more && frag_off == 0) {
+                add_udp(payload, len, src, ts);
+                continue;
+            }
+
+            auto key = make_tuple(src, dst, be16(ip + 4));
+            auto& f = frags[key];
+            size_t end = frag_off + len;
+            // only the last fragment may end off a block,
+            // and nothing goes past it.
+            if (end > 0x10000 || (more && len % 8 != 0) ||
+                (f.total != 0 && (end > f.total || (!more && end != f.total))) ||
+                (!more && f.data.size() > end)) {
+                frags.erase(key);
+                skipped ++;
+                continue;
+            }
+            if (f.data.size() < end) {
+                f.data.resize(end);
+                f.blocks.resize((end + 7) / 8);
+            }
+            memcpy(&f.data[frag_off], payload, len);
+            for (size_t b = frag_off / 8; b < (end + 7) / 8; b ++) {
+                if (!f.blocks[b]) {
+                    f.blocks[b] = true;
+                    f.got ++;
+                }
+            }
+            if (!more) f.total = end;
+            if (f.total == 0 || f.got < f.blocks.size()) continue;
+            f.data.resize(f.total);
+            m_defragged.push_back(move(f.data));
+            frags.erase(key);
+            auto& data = m_defragged.back();
+            add_udp(&data[0], data.size(), src, ts);
+        }
+        skipped += frags.size();
+        LOG(INFO) << "pcap " << path << ": " << m_datagrams.size() << " datagrams to port "
+            << m_port << ", " << skipped << " skipped";
+    }
+
+    // datagrams late already go right away, which keeps bursts.
+    void pcap::pace(const datagram& d) {
+        if (m_speed <= 0) return;
+        chrono::nanoseconds at((int64_t)((double)d.time.count() / m_speed));
+        this_thread::sleep_until(m_start + chrono::duration_cast<chrono::steady_clock::duration>(at));
+    }
+
+    bool pcap::prepare_session(session& session, bool nowait) {
+        if (m_pos >= m_datagrams.size()) {
+            if (!m_loop) {
+                m_running = false;
+                return false;
+            }
+            m_pos = 0;
+        }
+        size_t slot = m_pool.get(nowait);
+        if (slot == index_pool::none) return false;
+        if (!m_bufs[slot]) {
+            m_bufs[slot].reset(new char[buf_size]);
+        }
+        if (m_pos == 0) {
+            m_start = chrono::steady_clock::now();
+        }
+        const datagram& d = m_datagrams[m_pos ++];
+        pace(d);
+        memcpy(m_bufs[slot].get(), d.ptr, d.len);
+        return datagram_session(session, input_var(), m_chunks,
+            m_bufs[slot].get(), d.len, buf_size, d.from, [this, slot] { m_pool.put(slot); });
+    }
+
+    struct pcap_factory : public dp::graph_def::ingress_factory {
+        ingress* create_ingress(
+            const string& name,
+            const string& type,
+            const dp::graph_def::params& arg) {
+            auto path = dp::graph_def::param(arg, "path");
+            if (path.empty()) {
+                throw invalid_argument("missing param path");
+            }
+            auto port = dp::graph_def::int_param(arg, "port", 2052, 1, 65535);
+            auto speed = dp::graph_def::real_param(arg, "speed", 1, 0);
+            auto buf_count = dp::graph_def::int_param(arg, "buffers", 8, 1, 1024);
+            auto frame_size = dp::graph_def::int_param(arg, "max_frame", max_frame_size, 1, 1L << 30);
+            return new pcap(path, (uint16_t)port, speed, dp::graph_def::bool_param(arg, "loop"),
+                (size_t)buf_count, (size_t)frame_size);
+        }
+    };
+
+    void pcap::register_factory() {
+        static pcap_factory _factory;
+        dp::graph_def::ingress_registry::get()->add_factory("dp.pcap", &_factory);
+    }
+}
@@ -0,0 +1,241 @@
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <chrono>
+#include <stdexcept>
+#include "gtest/gtest.h"
+
+#include "dp/types.h"
+#include "dp/ingress/pcap.h"
+#include "net.h"
+
+namespace dp::in {
+    using namespace std;
+
+    static constexpr uint16_t port = 2052;
+    static const uint32_t cam_addr = htonl(0x0a000102);
+
+    // finishes every session right away, keeping what it carried.
+    struct datagram_dispatcher : public dispatcher {
+        graph g;
+        vector<string> sources;
+        vector<string> frames;
+
+        datagram_dispatcher() { g.def_var("input"); }
+
+        virtual bool dispatch(const session& s, bool nowait) {
+            s.initializer(&g);
+            auto& ref = g.var("input")->as<buf_ref>();
+            sources.push_back(s.source);
+            frames.push_back(string((const char*)ref.ptr, ref.len));
+            s.finalizer(&g);
+            return true;
+        }
+    };
+
+    static string be16(uint16_t v) {
+        v = htons(v);
+        return string((const char*)&v, sizeof(v));
+    }
+
+    static string u16(uint16_t v, bool swap) {
+        if (swap) v = __builtin_bswap16(v);
+        return string((const char*)&v, sizeof(v));
+    }
+
+    static string u32(uint32_t v, bool swap) {
+        if (swap) v = __builtin_bswap32(v);
+        return string((const char*)&v, sizeof(v));
+    }
+
+    static string udp_datagram(const string& payload, uint16_t dport = port) {
+        return be16(40000) + be16(dport) + be16((uint16_t)(payload.size() + 8)) + be16(0) + payload;
+    }
+
+    // an IPv4 packet of a UDP datagram, or a fragment of it.
+    static string ip_packet(const string& data, uint16_t id = 1,
+        size_t frag_off = 0, bool more = false) {
+        string ip;
+        ip += (char)0x45;
+        ip += (char)0;
+        ip += be16((uint16_t)(data.size() + 20));
+        ip += be16(id);
+        ip += be16((uint16_t)((more ? 0x2000 : 0) | (frag_off / 8)));
+        ip += (char)64;
+        ip += (char)IPPROTO_UDP;
+        ip += be16(0);
+        ip += string((const char*)&cam_addr, 4);
+        uint32_t dst = htonl(0x0a000101);
+        ip += string((const char*)&dst, 4);
+        return ip + data;
+    }
+
+    struct pcap_file {
+        bool swap;
+        bool nsec;
+        uint32_t link;
+        string content;
+
+        pcap_file(uint32_t l, bool s = false, bool n = false)
+        : swap(s), nsec(n), link(l) {
+            content = u32(n ? 0xa1b23c4d : 0xa1b2c3d4, s) + u16(2, s) + u16(4, s) +
+                u32(0, s) + u32(0, s) + u32(0xffff, s) + u32(l, s);
+        }
+
+        // frac is in usec or nsec as the file says.
+        void add(const string& pkt, uint32_t sec = 0, uint32_t frac = 0, size_t caplen = 0) {
+            if (caplen == 0) caplen = pkt.size();
+            content += u32(sec, swap) + u32(frac, swap) +
+                u32((uint32_t)caplen, swap) + u32((uint32_t)pkt.size(), swap);
+            content += pkt.substr(0, caplen);
+        }
+
+        string ethernet(const string& ip, const vector<uint16_t>& vlans = {}) const {
+            string pkt(12, (char)0x11);
+            for (auto tpid : vlans) pkt += be16(tpid) + be16(5);
+            return pkt + be16(0x0800) + ip;
+        }
+
+        string write(const string& name) const {
+            string fn = string("/tmp/pcap_test.") + name + "." + to_string(getpid());
+            ofstream(fn, ios::binary) << content;
+            return fn;
+        }
+    };
+
+    static string make_payload(size_t size, int seed) {
+        string data(size, 0);
+        for (size_t i = 0; i < size; i ++) data[i] = (char)((i * 7 + seed) & 0x7f);
+        return data;
+    }
+
+    static vector<string> replay_all(const string& fn, double speed = 0) {
+        pcap in(fn, port, speed);
+        datagram_dispatcher disp;
+        while (in.recv(&disp)) { }
+        unlink(fn.c_str());
+        sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_addr.s_addr = cam_addr;
+        for (auto& src : disp.sources) {
+            EXPECT_EQ(address_source(sa), src);
+        }
+        return disp.frames;
+    }
+
+    TEST(PcapTest, LinkTypes) {
+        auto p1 = make_payload(100, 1), p2 = make_payload(200, 2);
+        auto ip1 = ip_packet(udp_datagram(p1)), ip2 = ip_packet(udp_datagram(p2));
+        auto other = ip_packet(udp_datagram(p1, port + 1));
+
+        pcap_file eth(1);
+        eth.add(eth.ethernet(ip1));
+        eth.add(eth.ethernet(other));
+        // 802.1Q and QinQ tags.
+        eth.add(eth.ethernet(ip2, {0x8100}));
+        eth.add(eth.ethernet(ip1, {0x88a8, 0x8100}));
+        // not IPv4.
+        eth.add(string(12, 0) + be16(0x86dd) + ip1);
+        EXPECT_EQ(vector<string>({p1, p2, p1}), replay_all(eth.write("eth")));
+
+        pcap_file sll(113);
+        sll.add(string(14, 0) + be16(0x0800) + ip1);
+        sll.add(string(14, 0) + be16(0x86dd) + ip2);
+        EXPECT_EQ(vector<string>({p1}), replay_all(sll.write("sll")));
+
+        pcap_file sll2(276);
+        sll2.add(be16(0x0800) + string(18, 0) + ip2);
+        EXPECT_EQ(vector<string>({p2}), replay_all(sll2.write("sll2")));
+
+        pcap_file raw(101);
+        raw.add(ip1);
+        EXPECT_EQ(vector<string>({p1}), replay_all(raw.write("raw")));
+
+        pcap_file null(0);
+        uint32_t af = AF_INET;
+        null.add(string((const char*)&af, 4) + ip2);
+        EXPECT_EQ(vector<string>({p2}), replay_all(null.write("null")));
+
+        pcap_file unsupported(105);
+        unsupported.add(ip1);
+        auto fn = unsupported.write("unsupported");
+        EXPECT_THROW(pcap in(fn), runtime_error);
+        unlink(fn.c_str());
+    }
+
+    TEST(PcapTest, Headers) {
+        auto p = make_payload(64, 3);
+        auto ip = ip_packet(udp_datagram(p));
+        for (bool swap : { false, true }) {
+            // 50ms apart in usec, at speed 1.
+            pcap_file usec(101, swap);
+            usec.add(ip, 10, 0);
+            usec.add(ip, 10, 50000);
+            auto start = chrono::steady_clock::now();
+            EXPECT_EQ(2, replay_all(usec.write("usec"), 1).size());
+            auto elapsed = chrono::steady_clock::now() - start;
+            EXPECT_GE(elapsed, chrono::milliseconds(45));
+            EXPECT_LT(elapsed, chrono::milliseconds(500));
+
+            // 50ms apart in nsec, at speed 100.
+            pcap_file nsec(101, swap, true);
+            nsec.add(ip, 10, 0);
+            nsec.add(ip, 10, 50000000);
+            start = chrono::steady_clock::now();
+            EXPECT_EQ(2, replay_all(nsec.write("nsec"), 100).size());
+            elapsed = chrono::steady_clock::now() - start;
+            EXPECT_LT(elapsed, chrono::milliseconds(45));
+        }
+
+        string fn = "/tmp/pcap_test.bad." + to_string(getpid());
+        ofstream(fn, ios::binary) << string(64, 'x');
+        EXPECT_THROW(pcap in(fn), runtime_error);
+        ofstream(fn, ios::binary) << u32(0x0a0d0d0a, false) + string(60, 0);
+        EXPECT_THROW(pcap in(fn), runtime_error);
+        unlink(fn.c_str());
+    }
+
+    TEST(PcapTest, Fragments) {
+        auto p1 = make_payload(3000, 1), p2 = make_payload(3000, 2);
+        auto d1 = udp_datagram(p1), d2 = udp_datagram(p2);
+        pcap_file f(101);
+        // out of order, with a duplicate.
+        f.add(ip_packet(d1.substr(1480, 1480), 7, 1480, true));
+        f.add(ip_packet(d1.substr(2960), 7, 2960, false));
+        f.add(ip_packet(d1.substr(0, 1480), 7, 0, true));
+        f.add(ip_packet(d1.substr(1480, 1480), 7, 1480, true));
+        // the duplicate of the first fragment doesn't make up for the second.
+        f.add(ip_packet(d2.substr(0, 1480), 8, 0, true));
+        f.add(ip_packet(d2.substr(0, 1480), 8, 0, true));
+        f.add(ip_packet(d2.substr(2960), 8, 2960, false));
+        // a fragment past the end.
+        f.add(ip_packet(d2.substr(0, 1480), 9, 0, true));
+        f.add(ip_packet(d2.substr(2960), 9, 2960, false));
+        f.add(ip_packet(d2.substr(1480, 1480), 9, 2960, true));
+        f.add(ip_packet(d2.substr(1480, 1480), 9, 1480, true));
+        EXPECT_EQ(vector<string>({p1}), replay_all(f.write("frags")));
+    }
+
+    TEST(PcapTest, Truncation) {
+        auto p1 = make_payload(500, 1), p2 = make_payload(600, 2);
+        auto ip1 = ip_packet(udp_datagram(p1)), ip2 = ip_packet(udp_datagram(p2));
+        pcap_file f(101);
+        f.add(ip1);
+        // cut by the snap length.
+        f.add(ip2, 0, 0, 300);
+        // the length in the UDP header beyond the packet.
+        auto bad = ip_packet(udp_datagram(p2));
+        bad[24] = (char)0x7f;
+        f.add(bad);
+        f.add(ip2);
+        // the file ends within a record.
+        f.add(ip1);
+        f.content.resize(f.content.size() - 10);
+        EXPECT_EQ(vector<string>({p1, p2}), replay_all(f.write("trunc")));
+    }
+}
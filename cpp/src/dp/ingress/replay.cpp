@@ -0,0 +1,214 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <cstdlib>
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <glog/logging.h>
+
+#include "dp/operators.h"
+#include "dp/types.h"
+#include "dp/ingress/replay.h"
+#include "dp/graph_def.h"
+#include "dp/util/error.h"
+
+namespace dp::in {
+    using namespace std;
+
+    // room for the image id injected into frames without one.
+    static constexpr size_t id_room = 32;
+
+    static bool is_jpeg_name(const string& name) {
+        auto dot = name.rfind('.');
+        if (dot == string::npos) return false;
+        string ext = name.substr(dot + 1);
+        transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        return ext == "jpg" || ext == "jpeg";
+    }
+
+    static string base_name(string path) {
+        while (path.length() > 1 && path.back() == '/') path.pop_back();
+        auto slash = path.rfind('/');
+        return slash == string::npos ? path : path.substr(slash + 1);
+    }
+
+    replay::replay(const string& path, double fps, bool loop, const string& source, size_t buf_count)
+    : m_loop(loop), m_source(source), m_period(0), m_pos(0), m_seq(0),
+      m_seq_offset(0), m_lap_max(0), m_buf_size(0), m_pool(buf_count), m_bufs(buf_count) {
+        if (fps > 0) {
+            m_period = chrono::duration_cast<chrono::steady_clock::duration>(
+                chrono::duration<double>(1.0 / fps));
+        }
+        if (m_source.empty()) {
+            m_source = base_name(path);
+        }
+        try {
+            load(path);
+        } catch (const exception&) {
+            for (auto& m : m_maps) munmap(m.ptr, m.len);
+            throw;
+        }
+        if (m_frames.empty()) {
+            for (auto& m : m_maps) munmap(m.ptr, m.len);
+            throw runtime_error("no frames in " + path);
+        }
+        for (auto& f : m_frames) {
+            if (f.len > m_buf_size) m_buf_size = f.len;
+        }
+        m_buf_size += id_room + m_source.length();
+        LOG(INFO) << "replay " << path << ": " << m_frames.size() << " frames";
+    }
+
+    replay::~replay() {
+        for (auto& m : m_maps) {
+            munmap(m.ptr, m.len);
+        }
+    }
+
+    void replay::load(const string& path) {
+        struct stat st;
+        if (stat(path.c_str(), &st) < 0) {
+            throw runtime_error(errmsg(path));
+        }
+        if (S_ISDIR(st.st_mode)) {
+            DIR *dir = opendir(path.c_str());
+            if (dir == nullptr) {
+                throw runtime_error(errmsg(path));
+            }
+            vector<string> names;
+            while (auto ent = readdir(dir)) {
+                string name(ent->d_name);
+                if (is_jpeg_name(name)) names.push_back(name);
+            }
+            closedir(dir);
+            sort(names.begin(), names.end());
+            for (auto& name : names) {
+                load(path + "/" + name);
+            }
+            return;
+        }
+
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw runtime_error(errmsg(path));
+        }
+        if (st.st_size == 0) {
+            close(fd);
+            return;
+        }
+        mapping m;
+        m.len = (size_t)st.st_size;
+        m.ptr = mmap(nullptr, m.len, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (m.ptr == MAP_FAILED) {
+            throw runtime_error(errmsg(path));
+        }
+        madvise(m.ptr, m.len, MADV_SEQUENTIAL);
+        m_maps.push_back(m);
+
+        const char *p = (const char*)m.ptr;
+        if (m.len >= 2 && (uint8_t)p[0] == 0xff && (uint8_t)p[1] == 0xd8) {
+            m_frames.push_back(frame{p, m.len});
+            return;
+        }
+        size_t off = 0;
+        while (off < m.len) {
+            uint32_t len;
+            if (m.len - off < sizeof(len)) {
+                throw runtime_error(path + ": truncated frame at " + to_string(off));
+            }
+            memcpy(&len, p + off, sizeof(len));
+            len = ntohl(len);
+            off += sizeof(len);
+            if (m.len - off < len) {
+                throw runtime_error(path + ": truncated frame at " + to_string(off));
+            }
+            if (len > 0) {
+                m_frames.push_back(frame{p + off, len});
+            }
+            off += len;
+        }
+    }
+
+    // keeps the rate without bursting to catch up after a stall.
+    void replay::pace() {
+        if (m_period.count() == 0) return;
+        auto now = chrono::steady_clock::now();
+        if (m_next.time_since_epoch().count() == 0 || now > m_next + m_period) {
+            m_next = now;
+        }
+        this_thread::sleep_until(m_next);
+        m_next += m_period;
+    }
+
+    bool replay::prepare_session(session& session, bool nowait) {
+        if (m_pos >= m_frames.size()) {
+            if (!m_loop) {
+                m_running = false;
+                return false;
+            }
+            m_pos = 0;
+            m_seq_offset += m_lap_max;
+            m_lap_max = 0;
+        }
+        size_t slot = m_pool.get(nowait);
+        if (slot == index_pool::none) return false;
+        if (!m_bufs[slot]) {
+            m_bufs[slot].reset(new char[m_buf_size]);
+        }
+        pace();
+
+        const frame& f = m_frames[m_pos ++];
+        buf_ref ref;
+        ref.ptr = m_bufs[slot].get();
+        ref.len = f.len;
+        memcpy(ref.ptr, f.ptr, f.len);
+
+        image_id id;
+        if (!image_id::extract(ref, id, false)) {
+            id.seq = ++ m_seq;
+            id.src = m_source;
+            image_id::inject(ref, m_buf_size, id);
+        } else {
+            if (id.seq > m_lap_max) m_lap_max = id.seq;
+            id.seq += m_seq_offset;
+        }
+
+        session.source = id.src;
+        session.seq = id.seq;
+        session.initializer = [this, ref] (graph *g) {
+            g->var(input_var())->set<buf_ref>(ref);
+        };
+        session.finalizer = [this, slot] (graph *g) {
+            m_pool.put(slot);
+        };
+        session.dropped = [this, slot] {
+            m_pool.put(slot);
+        };
+        return true;
+    }
+
+    struct replay_factory : public dp::graph_def::ingress_factory {
+        ingress* create_ingress(
+            const string& name,
+            const string& type,
+            const dp::graph_def::params& arg) {
+            auto path = dp::graph_def::param(arg, "path");
+            if (path.empty()) {
+                throw invalid_argument("missing param path");
+            }
+            return new replay(path, dp::graph_def::real_param(arg, "fps", 0, 0),
+                dp::graph_def::bool_param(arg, "loop"), dp::graph_def::param(arg, "source"));
+        }
+    };
+
+    void replay::register_factory() {
+        static replay_factory _factory;
+        dp::graph_def::ingress_registry::get()->add_factory("dp.replay", &_factory);
+    }
+}
@@ -0,0 +1,173 @@
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <stdexcept>
+#include "gtest/gtest.h"
+
+#include "dp/types.h"
+#include "dp/ingress/replay.h"
+
+namespace dp::in {
+    using namespace std;
+
+    // finishes every session right away, keeping what it carried.
+    struct frame_dispatcher : public dispatcher {
+        struct frame {
+            string source;
+            uint64_t seq;
+            string data;
+        };
+
+        graph g;
+        vector<frame> frames;
+
+        frame_dispatcher() { g.def_var("input"); }
+
+        virtual bool dispatch(const session& s, bool nowait) {
+            s.initializer(&g);
+            auto& ref = g.var("input")->as<buf_ref>();
+            frames.push_back(frame{s.source, s.seq, string((const char*)ref.ptr, ref.len)});
+            s.finalizer(&g);
+            return true;
+        }
+    };
+
+    struct temp_dir {
+        string path;
+
+        temp_dir() {
+            char tmpl[] = "/tmp/replay_test.XXXXXX";
+            path = mkdtemp(tmpl);
+        }
+
+        ~temp_dir() {
+            if (system(("rm -rf " + path).c_str()) != 0) { }
+        }
+
+        string write(const string& name, const string& content) const {
+            string fn = path + "/" + name;
+            ofstream(fn, ios::binary) << content;
+            return fn;
+        }
+    };
+
+    static string make_jpeg(size_t size, int seed) {
+        string frame(size, 0);
+        for (size_t i = 0; i < size; i ++) frame[i] = (char)((i * 7 + seed) & 0x7f);
+        frame[0] = (char)0xff;
+        frame[1] = (char)0xd8;
+        frame[size - 2] = (char)0xff;
+        frame[size - 1] = (char)0xd9;
+        return frame;
+    }
+
+    static string with_id(const string& jpeg, uint64_t seq, const string& src) {
+        image_id id;
+        id.seq = seq;
+        id.src = src;
+        string buf(jpeg.size() + 64, 0);
+        memcpy(&buf[0], jpeg.data(), jpeg.size());
+        buf_ref ref{&buf[0], jpeg.size()};
+        EXPECT_TRUE(image_id::inject(ref, buf.size(), id));
+        buf.resize(ref.len);
+        return buf;
+    }
+
+    static string prefixed(const string& frame) {
+        uint32_t len = htonl((uint32_t)frame.size());
+        return string((const char*)&len, sizeof(len)) + frame;
+    }
+
+    // the frame as recorded, without the id injected by replay.
+    static string recorded(const frame_dispatcher::frame& f, size_t len) {
+        return f.data.substr(0, len - 2);
+    }
+
+    TEST(ReplayTest, LengthPrefixedFile) {
+        temp_dir dir;
+        auto f1 = make_jpeg(100, 1), f2 = make_jpeg(3000, 2), f3 = make_jpeg(20, 3);
+        // zero lengths are keepalives.
+        auto fn = dir.write("cam.bin", prefixed(f1) + prefixed("") + prefixed(f2) + prefixed(f3));
+        replay in(fn);
+        ASSERT_EQ(3, in.frames());
+        frame_dispatcher disp;
+        for (int i = 0; i < 3; i ++) EXPECT_TRUE(in.recv(&disp));
+        EXPECT_FALSE(in.recv(&disp));
+        ASSERT_EQ(3, disp.frames.size());
+        EXPECT_EQ(f1.substr(0, 98), recorded(disp.frames[0], f1.size()));
+        EXPECT_EQ(f2.substr(0, 2998), recorded(disp.frames[1], f2.size()));
+        EXPECT_EQ(f3.substr(0, 18), recorded(disp.frames[2], f3.size()));
+        for (size_t i = 0; i < disp.frames.size(); i ++) {
+            auto& f = disp.frames[i];
+            EXPECT_EQ("cam.bin", f.source);
+            EXPECT_EQ(i + 1, f.seq);
+            image_id id;
+            ASSERT_TRUE(id.decode(buf_ref{(void*)f.data.data(), f.data.size()}));
+            EXPECT_EQ("cam.bin", id.src);
+            EXPECT_EQ(i + 1, id.seq);
+        }
+
+        auto bad = dir.write("bad.bin", prefixed(f1) + prefixed(f2).substr(0, 1000));
+        EXPECT_THROW(replay r(bad), runtime_error);
+        auto empty = dir.write("empty.bin", "");
+        EXPECT_THROW(replay r(empty), runtime_error);
+    }
+
+    TEST(ReplayTest, Directory) {
+        temp_dir dir;
+        vector<string> frames;
+        for (int i = 0; i < 3; i ++) frames.push_back(make_jpeg(200 + i, i));
+        dir.write("b.jpg", frames[1]);
+        dir.write("c.JPEG", frames[2]);
+        dir.write("a.jpg", frames[0]);
+        dir.write("notes.txt", "not a frame");
+        replay in(dir.path + "/", 0, false, "rec");
+        ASSERT_EQ(3, in.frames());
+        frame_dispatcher disp;
+        while (in.recv(&disp)) { }
+        ASSERT_EQ(3, disp.frames.size());
+        for (size_t i = 0; i < frames.size(); i ++) {
+            EXPECT_EQ(frames[i].substr(0, frames[i].size() - 2), recorded(disp.frames[i], frames[i].size()));
+            EXPECT_EQ("rec", disp.frames[i].source);
+            EXPECT_EQ(i + 1, disp.frames[i].seq);
+        }
+    }
+
+    TEST(ReplayTest, Ids) {
+        temp_dir dir;
+        auto f1 = with_id(make_jpeg(100, 1), 5, "cam1");
+        auto f2 = make_jpeg(100, 2);
+        auto f3 = with_id(make_jpeg(100, 3), 6, "cam1");
+        auto fn = dir.write("rec.bin", prefixed(f1) + prefixed(f2) + prefixed(f3));
+
+        replay in(fn);
+        frame_dispatcher disp;
+        while (in.recv(&disp)) { }
+        ASSERT_EQ(3, disp.frames.size());
+        // frames carrying an id are replayed untouched.
+        EXPECT_EQ(f1, disp.frames[0].data);
+        EXPECT_EQ("cam1", disp.frames[0].source);
+        EXPECT_EQ(5, disp.frames[0].seq);
+        EXPECT_EQ("rec.bin", disp.frames[1].source);
+        EXPECT_EQ(1, disp.frames[1].seq);
+        EXPECT_EQ(f3, disp.frames[2].data);
+        EXPECT_EQ(6, disp.frames[2].seq);
+
+        // every lap goes on past the seqs of the one before.
+        replay looped(fn, 0, true);
+        frame_dispatcher ldisp;
+        for (int i = 0; i < 9; i ++) EXPECT_TRUE(looped.recv(&ldisp));
+        ASSERT_EQ(9, ldisp.frames.size());
+        vector<uint64_t> cam1, rec;
+        for (auto& f : ldisp.frames) {
+            (f.source == "cam1" ? cam1 : rec).push_back(f.seq);
+        }
+        EXPECT_EQ(vector<uint64_t>({5, 6, 11, 12, 17, 18}), cam1);
+        EXPECT_EQ(vector<uint64_t>({1, 2, 3}), rec);
+        EXPECT_EQ(f1, ldisp.frames[3].data);
+    }
+}
@@ -0,0 +1,311 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <errno.h>
+#include <string.h>
+#include <cstdlib>
+#include <map>
+#include <stdexcept>
+#include <glog/logging.h>
+#include <opencv2/core/core.hpp>
+
+#include "dp/operators.h"
+#include "dp/types.h"
+#include "dp/ingress/shm.h"
+#include "dp/graph_def.h"
+#include "dp/util/error.h"
+
+namespace dp::in {
+    using namespace std;
+    using namespace cv;
+
+    // lets the loop notice stop.
+    static constexpr int wait_timeout_ms = 200;
+    static constexpr int max_events = 64;
+    // how long a producer has to send its hello.
+    static constexpr int handshake_timeout_ms = 1000;
+
+    // buses by path, for publish.
+    static map<string, shm*> _buses;
+    static mutex _buses_mutex;
+
+    shm::shm(const string& path, size_t slots, size_t slot_size)
+    : m_path(path), m_socket(-1), m_epoll(-1), m_slots(slots), m_slot_size(slot_size),
+      m_connected(0) {
+        sockaddr_un sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        if (path.length() >= sizeof(sa.sun_path)) {
+            throw invalid_argument("shm path too long: " + path);
+        }
+        strcpy(sa.sun_path, path.c_str());
+        m_socket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (m_socket < 0) {
+            throw runtime_error(errmsg("socket"));
+        }
+        // a socket left behind by a previous run.
+        unlink(path.c_str());
+        if (bind(m_socket, (sockaddr*)&sa, sizeof(sa)) < 0 ||
+            listen(m_socket, SOMAXCONN) < 0) {
+            close(m_socket);
+            throw runtime_error(errmsg("bind " + path));
+        }
+        m_epoll = epoll_create1(EPOLL_CLOEXEC);
+        if (m_epoll < 0) {
+            close(m_socket);
+            unlink(path.c_str());
+            throw runtime_error(errmsg("epoll_create1"));
+        }
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = m_socket;
+        if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_socket, &ev) < 0) {
+            close(m_epoll);
+            close(m_socket);
+            unlink(path.c_str());
+            throw runtime_error(errmsg("epoll_ctl"));
+        }
+        lock_guard<mutex> lock(_buses_mutex);
+        _buses[path] = this;
+    }
+
+    shm::~shm() {
+        {
+            lock_guard<mutex> lock(_buses_mutex);
+            auto it = _buses.find(m_path);
+            if (it != _buses.end() && it->second == this) _buses.erase(it);
+        }
+        // sessions still in the graphs keep their channels mapped.
+        m_producers.clear();
+        for (auto& h : m_handshakes) close(h.first);
+        close(m_epoll);
+        close(m_socket);
+        unlink(m_path.c_str());
+    }
+
+    void shm::run(dispatcher *disp) {
+        while (running()) {
+            wait(disp, wait_timeout_ms);
+        }
+    }
+
+    bool shm::poll(dispatcher *disp) {
+        wait(disp, 0);
+        return true;
+    }
+
+    void shm::wait(dispatcher *disp, int timeout_ms) {
+        epoll_event events[max_events];
+        int n = epoll_wait(m_epoll, events, max_events, timeout_ms);
+        if (n < 0) {
+            if (errno == EINTR) return;
+            throw runtime_error(errmsg("epoll_wait"));
+        }
+        for (int i = 0; i < n; i ++) {
+            int fd = events[i].data.fd;
+            if (fd == m_socket) {
+                accept_producers();
+                continue;
+            }
+            if (m_handshakes.find(fd) != m_handshakes.end()) {
+                handshake(fd);
+                continue;
+            }
+            auto it = m_producers.find(fd);
+            if (it == m_producers.end()) continue;
+            auto p = it->second;
+            if (fd == p->channel->socket()) {
+                char c;
+                if (::recv(fd, &c, sizeof(c), MSG_DONTWAIT) == 0 ||
+                    (events[i].events & (EPOLLHUP | EPOLLERR)) != 0) {
+                    close_producer(p);
+                }
+                continue;
+            }
+            receive(*p, disp);
+        }
+        if (!m_handshakes.empty()) expire_handshakes();
+    }
+
+    // the hello is read once it arrives, so a slow producer
+    // doesn't hold up the others.
+    void shm::accept_producers() {
+        while (true) {
+            int fd = accept4(m_socket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    LOG(ERROR) << errmsg("accept");
+                }
+                return;
+            }
+            epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.fd = fd;
+            if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                LOG(ERROR) << errmsg("epoll_ctl");
+                close(fd);
+                continue;
+            }
+            m_handshakes[fd] = chrono::steady_clock::now() +
+                chrono::milliseconds(handshake_timeout_ms);
+        }
+    }
+
+    void shm::handshake(int fd) {
+        m_handshakes.erase(fd);
+        epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+        shared_ptr<producer> p(new producer());
+        try {
+            // closes fd if it fails.
+            p->channel = shm_channel::accept(fd, m_slots, m_slot_size);
+        } catch (const exception& e) {
+            LOG(ERROR) << "shm: " << e.what();
+            return;
+        }
+        p->source = p->channel->name();
+        if (p->source.empty()) {
+            p->source = "shm:" + to_string(++ m_connected);
+        }
+        p->seq = 0;
+
+        bool added = true;
+        for (int pfd : { p->channel->socket(), p->channel->ready_fd() }) {
+            epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = pfd == p->channel->socket() ? EPOLLRDHUP : EPOLLIN;
+            ev.data.fd = pfd;
+            if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, pfd, &ev) < 0) {
+                LOG(ERROR) << errmsg("epoll_ctl");
+                added = false;
+            }
+        }
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_producers[p->channel->socket()] = p;
+            m_producers[p->channel->ready_fd()] = p;
+        }
+        if (!added) {
+            close_producer(p);
+            return;
+        }
+        VLOG(2) << "shm: connected " << p->source << ", " << p->channel->slots()
+            << " slots of " << p->channel->slot_size();
+    }
+
+    void shm::expire_handshakes() {
+        auto now = chrono::steady_clock::now();
+        for (auto it = m_handshakes.begin(); it != m_handshakes.end(); ) {
+            if (it->second > now) {
+                ++ it;
+                continue;
+            }
+            LOG(ERROR) << "shm: no hello from a producer";
+            epoll_ctl(m_epoll, EPOLL_CTL_DEL, it->first, nullptr);
+            close(it->first);
+            it = m_handshakes.erase(it);
+        }
+    }
+
+    void shm::close_producer(const shared_ptr<producer>& p) {
+        VLOG(2) << "shm: disconnected " << p->source;
+        int sock = p->channel->socket(), ready = p->channel->ready_fd();
+        epoll_ctl(m_epoll, EPOLL_CTL_DEL, sock, nullptr);
+        epoll_ctl(m_epoll, EPOLL_CTL_DEL, ready, nullptr);
+        lock_guard<mutex> lock(m_mutex);
+        m_producers.erase(sock);
+        m_producers.erase(ready);
+    }
+
+    void shm::receive(producer& p, dispatcher *disp) {
+        auto ch = p.channel;
+        shm_channel::clear(ch->ready_fd());
+        shm_frame f;
+        while (running() && ch->next(f)) {
+            uint32_t slot = f.slot;
+            session s;
+            if (f.fmt == shm_frame::raw) {
+                if (f.type < 0 || f.type != CV_MAT_TYPE(f.type) ||
+                    f.step < (size_t)f.cols * CV_ELEM_SIZE(f.type)) {
+                    LOG(ERROR) << p.source << ": invalid raw frame";
+                    ch->release(slot);
+                    continue;
+                }
+                Mat frame(f.rows, f.cols, f.type, ch->slot(slot), f.step);
+                s.source = p.source;
+                s.seq = f.seq != 0 ? f.seq : ++ p.seq;
+                s.initializer = [this, frame] (graph *g) {
+                    g->var(input_var())->set<Mat>(frame);
+                };
+            } else {
+                buf_ref ref;
+                ref.ptr = ch->slot(slot);
+                ref.len = f.len;
+                image_id id;
+                if (!image_id::extract(ref, id)) {
+                    id.src = p.source;
+                    if (f.seq != 0) id.seq = f.seq;
+                    image_id::inject(ref, ch->slot_size(), id);
+                }
+                s.source = id.src;
+                s.seq = id.seq;
+                s.initializer = [this, ref] (graph *g) {
+                    g->var(input_var())->set<buf_ref>(ref);
+                };
+            }
+            s.finalizer = [ch, slot] (graph *g) {
+                ch->release(slot);
+            };
+            s.dropped = [ch, slot] {
+                ch->release(slot);
+            };
+            disp->dispatch(s);
+        }
+    }
+
+    size_t shm::broadcast(const string& msg) {
+        lock_guard<mutex> lock(m_mutex);
+        size_t sent = 0;
+        for (auto& pr : m_producers) {
+            // every producer is there twice.
+            if (pr.first != pr.second->channel->socket()) continue;
+            if (pr.second->channel->put_result(msg.data(), msg.length())) {
+                sent ++;
+            } else {
+                VLOG(3) << "shm: results full for " << pr.second->source;
+            }
+        }
+        return sent;
+    }
+
+    size_t shm::publish(const string& path, const string& msg) {
+        lock_guard<mutex> lock(_buses_mutex);
+        auto it = _buses.find(path);
+        if (it == _buses.end()) return 0;
+        return it->second->broadcast(msg);
+    }
+
+    struct shm_factory : public dp::graph_def::ingress_factory {
+        ingress* create_ingress(
+            const string& name,
+            const string& type,
+            const dp::graph_def::params& arg) {
+            auto path = dp::graph_def::param(arg, "path");
+            if (path.empty()) {
+                throw invalid_argument("missing param path");
+            }
+            auto slots = dp::graph_def::int_param(arg, "slots", 8, 1, shm_channel::max_slots);
+            auto slot_size = dp::graph_def::int_param(arg, "slot_size",
+                max_frame_size, 1, shm_channel::max_slot_size);
+            return new shm(path, (size_t)slots, (size_t)slot_size);
+        }
+    };
+
+    void shm::register_factory() {
+        static shm_factory _factory;
+        dp::graph_def::ingress_registry::get()->add_factory("dp.shm", &_factory);
+    }
+}
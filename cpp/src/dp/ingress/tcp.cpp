@@ -0,0 +1,335 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <string.h>
+#include <cstdlib>
+#include <stdexcept>
+#include <glog/logging.h>
+
+#include "dp/operators.h"
+#include "dp/types.h"
+#include "dp/ingress/tcp.h"
+#include "dp/graph_def.h"
+#include "dp/util/error.h"
+#include "net.h"
+
+namespace dp::in {
+    using namespace std;
+
+    // large enough to take several small frames per recv.
+    static constexpr size_t read_buf_size = 0x40000;
+    // lets the loop notice stop.
+    static constexpr int wait_timeout_ms = 200;
+    static constexpr int max_events = 64;
+
+    tcp::tcp(uint16_t port, size_t buf_count, size_t frame_size)
+    : m_socket(-1), m_epoll(-1), m_wake(-1), m_starved(false), m_frame_size(frame_size),
+      m_pool(buf_count), m_bufs(buf_count) {
+        m_socket = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (m_socket < 0) {
+            throw runtime_error(errmsg("socket"));
+        }
+        int en = 1;
+        setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &en, sizeof(en));
+        sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = PF_INET;
+        sa.sin_port = htons(port);
+        sa.sin_addr.s_addr = INADDR_ANY;
+        if (bind(m_socket, (sockaddr*)&sa, sizeof(sa)) < 0 ||
+            listen(m_socket, SOMAXCONN) < 0) {
+            close(m_socket);
+            throw runtime_error(errmsg("bind"));
+        }
+        m_epoll = epoll_create1(EPOLL_CLOEXEC);
+        if (m_epoll < 0) {
+            close(m_socket);
+            throw runtime_error(errmsg("epoll_create1"));
+        }
+        m_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_wake < 0) {
+            close(m_epoll);
+            close(m_socket);
+            throw runtime_error(errmsg("eventfd"));
+        }
+        for (int fd : { m_socket, m_wake }) {
+            epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.fd = fd;
+            if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                close(m_wake);
+                close(m_epoll);
+                close(m_socket);
+                throw runtime_error(errmsg("epoll_ctl"));
+            }
+        }
+    }
+
+    tcp::~tcp() {
+        for (auto& c : m_conns) {
+            close(c.first);
+        }
+        close(m_wake);
+        close(m_epoll);
+        close(m_socket);
+    }
+
+    void tcp::run(dispatcher *disp) {
+        while (running()) {
+            wait(disp, wait_timeout_ms);
+        }
+    }
+
+    bool tcp::poll(dispatcher *disp) {
+        wait(disp, 0);
+        return true;
+    }
+
+    void tcp::wait(dispatcher *disp, int timeout_ms) {
+        epoll_event events[max_events];
+        int n = epoll_wait(m_epoll, events, max_events, timeout_ms);
+        if (n < 0) {
+            if (errno == EINTR) return;
+            throw runtime_error(errmsg("epoll_wait"));
+        }
+        for (int i = 0; i < n; i ++) {
+            int fd = events[i].data.fd;
+            if (fd == m_socket) {
+                accept_conns();
+                continue;
+            }
+            if (fd == m_wake) {
+                resume(disp);
+                continue;
+            }
+            auto it = m_conns.find(fd);
+            if (it == m_conns.end()) continue;
+            // a paused connection still gets these and isn't read,
+            // so it would be reported again right away.
+            if (it->second->paused && (events[i].events & (EPOLLERR | EPOLLHUP))) {
+                close_conn(*it->second);
+                continue;
+            }
+            read(*it->second, disp);
+        }
+    }
+
+    void tcp::accept_conns() {
+        while (true) {
+            sockaddr_in sa;
+            socklen_t salen = sizeof(sa);
+            int fd = accept4(m_socket, (sockaddr*)&sa, &salen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    LOG(ERROR) << errmsg("accept");
+                }
+                return;
+            }
+            unique_ptr<conn> c(new conn());
+            c->fd = fd;
+            c->source = address_source(sa);
+            c->buf.resize(read_buf_size);
+            c->head = c->tail = 0;
+            c->slot = index_pool::none;
+            c->frame_len = c->frame_got = 0;
+            c->paused = false;
+
+            epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN | EPOLLRDHUP;
+            ev.data.fd = fd;
+            if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                LOG(ERROR) << errmsg("epoll_ctl");
+                close(fd);
+                continue;
+            }
+            VLOG(2) << "tcp: connected " << c->source;
+            m_conns[fd] = move(c);
+        }
+    }
+
+    // reads once per event, so busy connections don't starve others.
+    void tcp::read(conn& c, dispatcher *disp) {
+        if (c.paused) return;
+        int r;
+        if (c.slot != index_pool::none) {
+            r = ::recv(c.fd, m_bufs[c.slot].get() + c.frame_got, c.frame_len - c.frame_got, 0);
+            if (r > 0) {
+                c.frame_got += (size_t)r;
+                if (c.frame_got == c.frame_len) {
+                    size_t slot = c.slot;
+                    c.slot = index_pool::none;
+                    deliver(c, slot, c.frame_len, disp);
+                }
+                return;
+            }
+        } else {
+            r = ::recv(c.fd, &c.buf[c.tail], c.buf.size() - c.tail, 0);
+            if (r > 0) {
+                c.tail += (size_t)r;
+                if (!parse(c, disp)) close_conn(c);
+                return;
+            }
+        }
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+        if (r < 0) {
+            LOG(ERROR) << c.source << ": " << errmsg("recv");
+        }
+        close_conn(c);
+    }
+
+    bool tcp::parse(conn& c, dispatcher *disp) {
+        while (c.tail - c.head >= sizeof(uint32_t)) {
+            uint32_t len;
+            memcpy(&len, &c.buf[c.head], sizeof(len));
+            len = ntohl(len);
+            if (len > m_frame_size) {
+                LOG(ERROR) << c.source << ": frame too large: " << len;
+                return false;
+            }
+            size_t avail = c.tail - c.head - sizeof(len);
+            c.head += sizeof(len);
+            if (len == 0) continue;
+            size_t slot = take_buf();
+            if (slot == index_pool::none) {
+                c.head -= sizeof(len);
+                pause(c);
+                break;
+            }
+            if (avail >= len) {
+                memcpy(m_bufs[slot].get(), &c.buf[c.head], len);
+                c.head += len;
+                deliver(c, slot, len, disp);
+                continue;
+            }
+            // the rest of the frame goes straight into the buffer.
+            memcpy(m_bufs[slot].get(), &c.buf[c.head], avail);
+            c.slot = slot;
+            c.frame_len = len;
+            c.frame_got = avail;
+            c.head = c.tail;
+        }
+        if (c.head == c.tail) {
+            c.head = c.tail = 0;
+        } else if (c.head > 0) {
+            memmove(&c.buf[0], &c.buf[c.head], c.tail - c.head);
+            c.tail -= c.head;
+            c.head = 0;
+        }
+        return true;
+    }
+
+    void tcp::close_conn(conn& c) {
+        VLOG(2) << "tcp: disconnected " << c.source;
+        if (c.slot != index_pool::none) {
+            release(c.slot);
+        }
+        epoll_ctl(m_epoll, EPOLL_CTL_DEL, c.fd, nullptr);
+        close(c.fd);
+        m_conns.erase(c.fd);
+    }
+
+    void tcp::pause(conn& c) {
+        if (c.paused) return;
+        c.paused = true;
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = 0;
+        ev.data.fd = c.fd;
+        epoll_ctl(m_epoll, EPOLL_CTL_MOD, c.fd, &ev);
+        m_paused.push_back(c.fd);
+    }
+
+    void tcp::resume(dispatcher *disp) {
+        uint64_t val;
+        while (::read(m_wake, &val, sizeof(val)) > 0) { }
+        vector<int> paused;
+        paused.swap(m_paused);
+        for (int fd : paused) {
+            auto it = m_conns.find(fd);
+            if (it == m_conns.end()) continue;
+            auto& c = *it->second;
+            c.paused = false;
+            epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN | EPOLLRDHUP;
+            ev.data.fd = fd;
+            epoll_ctl(m_epoll, EPOLL_CTL_MOD, fd, &ev);
+            if (!parse(c, disp)) close_conn(c);
+        }
+    }
+
+    // returns none when all buffers are taken, and arranges
+    // for a wake up once one comes back.
+    size_t tcp::take_buf() {
+        size_t slot = m_pool.get(true);
+        if (slot == index_pool::none) {
+            m_starved = true;
+            slot = m_pool.get(true);
+            if (slot == index_pool::none) return slot;
+        }
+        if (!m_bufs[slot]) {
+            m_bufs[slot].reset(new char[m_frame_size]);
+        }
+        return slot;
+    }
+
+    void tcp::release(size_t slot) {
+        m_pool.put(slot);
+        if (m_starved.exchange(false)) {
+            uint64_t one = 1;
+            if (write(m_wake, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+                LOG(ERROR) << errmsg("eventfd write");
+            }
+        }
+    }
+
+    void tcp::deliver(conn& c, size_t slot, size_t len, dispatcher *disp) {
+        buf_ref ref;
+        ref.ptr = m_bufs[slot].get();
+        ref.len = len;
+
+        image_id id;
+        if (!image_id::extract(ref, id)) {
+            id.src = c.source;
+            image_id::inject(ref, m_frame_size, id);
+        }
+
+        session s;
+        s.source = id.src;
+        s.seq = id.seq;
+        s.initializer = [this, ref] (graph *g) {
+            g->var(input_var())->set<buf_ref>(ref);
+        };
+        s.finalizer = [this, slot] (graph *g) {
+            release(slot);
+        };
+        s.dropped = [this, slot] {
+            release(slot);
+        };
+        disp->dispatch(s);
+    }
+
+    struct tcp_factory : public dp::graph_def::ingress_factory {
+        ingress* create_ingress(
+            const string& name,
+            const string& type,
+            const dp::graph_def::params& arg) {
+            auto port = dp::graph_def::int_param(arg, "port", tcp::default_port, 1, 65535);
+            auto buf_count = dp::graph_def::int_param(arg, "buffers", 16, 1, 1024);
+            auto frame_size = dp::graph_def::int_param(arg, "max_frame", max_frame_size, 1, 1L << 30);
+            return new tcp((uint16_t)port, (size_t)buf_count, (size_t)frame_size);
+        }
+    };
+
+    void tcp::register_factory() {
+        static tcp_factory _factory;
+        dp::graph_def::ingress_registry::get()->add_factory("dp.tcp", &_factory);
+    }
+}
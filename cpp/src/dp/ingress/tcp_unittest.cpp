@@ -0,0 +1,183 @@
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include "gtest/gtest.h"
+
+#include "dp/types.h"
+#include "dp/ingress/tcp.h"
+
+namespace dp::in {
+    using namespace std;
+
+    static constexpr uint16_t test_port = 22052;
+
+    // keeps the frames dispatched, and their sessions until finished.
+    struct record_dispatcher : public dispatcher {
+        graph g;
+        vector<string> frames;
+        vector<session> held;
+
+        record_dispatcher() { g.def_var("input"); }
+
+        virtual bool dispatch(const session& s, bool nowait) {
+            s.initializer(&g);
+            auto& ref = g.var("input")->as<buf_ref>();
+            frames.push_back(string((const char*)ref.ptr, ref.len));
+            held.push_back(s);
+            return true;
+        }
+
+        void finish(size_t n) {
+            for (size_t i = 0; i < n && !held.empty(); i ++) {
+                held.front().finalizer(&g);
+                held.erase(held.begin());
+            }
+        }
+    };
+
+    static string make_frame(size_t size, int seed) {
+        string frame(size, 0);
+        for (size_t i = 0; i < size; i ++) frame[i] = (char)((i * 7 + seed) & 0x7f);
+        return frame;
+    }
+
+    static string prefixed(const string& frame) {
+        uint32_t len = htonl((uint32_t)frame.size());
+        return string((const char*)&len, sizeof(len)) + frame;
+    }
+
+    static int connect_to(uint16_t port) {
+        int fd = socket(PF_INET, SOCK_STREAM, 0);
+        sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = PF_INET;
+        sa.sin_port = htons(port);
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        EXPECT_EQ(0, connect(fd, (sockaddr*)&sa, sizeof(sa)));
+        return fd;
+    }
+
+    static void send_all(int fd, const string& data) {
+        size_t off = 0;
+        while (off < data.size()) {
+            auto r = send(fd, data.data() + off, data.size() - off, 0);
+            ASSERT_GT(r, 0);
+            off += (size_t)r;
+        }
+    }
+
+    // polls until count frames are dispatched or the timeout passed.
+    static void poll_for(tcp& in, record_dispatcher& disp, size_t count,
+        chrono::milliseconds timeout = chrono::milliseconds(1000)) {
+        auto deadline = chrono::steady_clock::now() + timeout;
+        while (disp.frames.size() < count && chrono::steady_clock::now() < deadline) {
+            in.poll(&disp);
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
+
+    TEST(TcpTest, FramesPerRead) {
+        tcp in(test_port, 4);
+        record_dispatcher disp;
+        int fd = connect_to(test_port);
+        auto f1 = make_frame(10, 1), f2 = make_frame(200, 2), f3 = make_frame(3000, 3);
+        // keepalives are skipped.
+        send_all(fd, prefixed(f1) + prefixed("") + prefixed(f2) + prefixed(f3) + prefixed(""));
+        poll_for(in, disp, 3);
+        ASSERT_EQ(3, disp.frames.size());
+        EXPECT_EQ(f1, disp.frames[0]);
+        EXPECT_EQ(f2, disp.frames[1]);
+        EXPECT_EQ(f3, disp.frames[2]);
+        disp.finish(3);
+        close(fd);
+    }
+
+    TEST(TcpTest, SplitPrefix) {
+        tcp in(test_port, 4);
+        record_dispatcher disp;
+        int fd = connect_to(test_port);
+        auto f = make_frame(100, 1), data = prefixed(f);
+        send_all(fd, data.substr(0, 2));
+        poll_for(in, disp, 1, chrono::milliseconds(100));
+        EXPECT_TRUE(disp.frames.empty());
+        send_all(fd, data.substr(2, 50));
+        poll_for(in, disp, 1, chrono::milliseconds(100));
+        EXPECT_TRUE(disp.frames.empty());
+        send_all(fd, data.substr(52));
+        poll_for(in, disp, 1);
+        ASSERT_EQ(1, disp.frames.size());
+        EXPECT_EQ(f, disp.frames[0]);
+        disp.finish(1);
+        close(fd);
+    }
+
+    TEST(TcpTest, LargeFrame) {
+        tcp in(test_port, 4);
+        record_dispatcher disp;
+        int fd = connect_to(test_port);
+        // larger than a read, the rest goes straight into the buffer.
+        auto f1 = make_frame(1 << 20, 1), f2 = make_frame(64, 2);
+        thread sender([fd, &f1, &f2] { send_all(fd, prefixed(f1) + prefixed(f2)); });
+        poll_for(in, disp, 2);
+        sender.join();
+        ASSERT_EQ(2, disp.frames.size());
+        EXPECT_TRUE(f1 == disp.frames[0]);
+        EXPECT_EQ(f2, disp.frames[1]);
+        disp.finish(2);
+
+        // frames over max_frame close the connection.
+        tcp small(test_port + 1, 4, 1000);
+        int fd2 = connect_to(test_port + 1);
+        send_all(fd2, prefixed(make_frame(2000, 3)));
+        record_dispatcher disp2;
+        poll_for(small, disp2, 1, chrono::milliseconds(100));
+        EXPECT_TRUE(disp2.frames.empty());
+        char c;
+        EXPECT_EQ(0, recv(fd2, &c, 1, 0));
+        close(fd2);
+        close(fd);
+    }
+
+    TEST(TcpTest, PoolExhaustion) {
+        tcp in(test_port, 2);
+        record_dispatcher disp;
+        int fd = connect_to(test_port);
+        vector<string> frames;
+        string data;
+        for (int i = 0; i < 4; i ++) {
+            frames.push_back(make_frame(500, i));
+            data += prefixed(frames.back());
+        }
+        send_all(fd, data);
+        poll_for(in, disp, 3, chrono::milliseconds(100));
+        // the connection waits for a buffer.
+        ASSERT_EQ(2, disp.frames.size());
+        disp.finish(1);
+        poll_for(in, disp, 3);
+        ASSERT_EQ(3, disp.frames.size());
+        disp.finish(2);
+        poll_for(in, disp, 4);
+        ASSERT_EQ(4, disp.frames.size());
+        for (size_t i = 0; i < frames.size(); i ++) {
+            EXPECT_EQ(frames[i], disp.frames[i]);
+        }
+        disp.finish(1);
+
+        // a paused connection reset by the peer is closed.
+        for (int i = 0; i < 3; i ++) send_all(fd, prefixed(frames[i]));
+        poll_for(in, disp, 7, chrono::milliseconds(100));
+        ASSERT_EQ(6, disp.frames.size());
+        linger lg = { 1, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+        close(fd);
+        for (int i = 0; i < 10; i ++) in.poll(&disp);
+        disp.finish(2);
+        poll_for(in, disp, 7, chrono::milliseconds(100));
+        EXPECT_EQ(6, disp.frames.size());
+    }
+}
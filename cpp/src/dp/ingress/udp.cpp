@@ -2,96 +2,690 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/time.h>
 #include <errno.h>
 #include <string.h>
 #include <cstdlib>
 #include <stdexcept>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <glog/logging.h>
 
 #include "dp/operators.h"
 #include "dp/types.h"
 #include "dp/ingress/udp.h"
 #include "dp/graph_def.h"
 #include "dp/util/error.h"
+#include "dp/util/feedback.h"
+#include "net.h"
 
 namespace dp::in {
     using namespace std;
 
-    static constexpr size_t buf_size = 0x10000;
+    // lets the receiving threads notice stop.
+    static constexpr int recv_timeout_ms = 200;
+    // room for the SCM_TIMESTAMPNS and SO_RXQ_OVFL of a datagram.
+    static constexpr size_t control_len =
+        CMSG_SPACE(sizeof(timespec)) + CMSG_SPACE(sizeof(uint32_t));
+    // how many times the load is sampled per feedback interval.
+    static constexpr int load_samples = 10;
+    // feedback intervals without frames before a source is forgotten.
+    static constexpr int max_idle_intervals = 5;
+    // sources counted apart, the others are summed up as other_source.
+    static constexpr size_t max_sources = 1024;
+    static const char* other_source = "*";
 
-    udp::udp(uint16_t port, size_t buf_count)
-    : m_pool(buf_count) {
-        m_socket = socket(PF_INET, SOCK_DGRAM, 0);
-        if (m_socket < 0) {
+    static int open_socket(uint16_t port, bool reuse_port) {
+        int sock = socket(PF_INET, SOCK_DGRAM, 0);
+        if (sock < 0) {
             throw runtime_error(errmsg("socket"));
         }
         int en = 1;
-        setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &en, sizeof(en));
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &en, sizeof(en));
+        if (reuse_port && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &en, sizeof(en)) < 0) {
+            close(sock);
+            throw runtime_error(errmsg("setsockopt SO_REUSEPORT"));
+        }
+        timeval tv;
+        tv.tv_sec = 0;
+        tv.tv_usec = recv_timeout_ms * 1000;
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        // frames are timed from the kernel receive if it can tell.
+        setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &en, sizeof(en));
+        // datagrams carry the number the socket dropped so far.
+        setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &en, sizeof(en));
         sockaddr_in sa;
         memset(&sa, 0, sizeof(sa));
         sa.sin_family = PF_INET;
         sa.sin_port = htons(port);
         sa.sin_addr.s_addr = INADDR_ANY;
-        if (bind(m_socket, (sockaddr*)&sa, sizeof(sa)) < 0) {
+        if (bind(sock, (sockaddr*)&sa, sizeof(sa)) < 0) {
+            close(sock);
             throw runtime_error(errmsg("bind"));
         }
+        return sock;
+    }
 
-        m_bufs = new char[buf_size*buf_count];
+    // what the kernel tells about a datagram.
+    struct rx_info {
+        // the receive time, or now without one.
+        int64_t received;
+        // datagrams the socket dropped since it was opened,
+        // only sent once there are any.
+        uint32_t drops;
+        bool truncated;
+    };
+
+    static rx_info read_control(msghdr& msg) {
+        rx_info info;
+        info.received = 0;
+        info.drops = 0;
+        info.truncated = (msg.msg_flags & MSG_TRUNC) != 0;
+        for (auto c = CMSG_FIRSTHDR(&msg); c != nullptr; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level != SOL_SOCKET) continue;
+            if (c->cmsg_type == SCM_TIMESTAMPNS) {
+                timespec ts;
+                memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+                info.received = frame_latency::from_realtime(ts);
+            } else if (c->cmsg_type == SO_RXQ_OVFL) {
+                memcpy(&info.drops, CMSG_DATA(c), sizeof(info.drops));
+            }
+        }
+        if (info.received == 0) info.received = frame_latency::now();
+        return info;
+    }
+
+    // receives a datagram into buf, with what the kernel tells about it.
+    static int receive_one(int sock, void* buf, size_t len, int flags,
+        sockaddr_in& sa, rx_info& info) {
+        iovec iov;
+        iov.iov_base = buf;
+        iov.iov_len = len;
+        char control[control_len];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &sa;
+        msg.msg_namelen = sizeof(sa);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        int r = recvmsg(sock, &msg, flags);
+        if (r > 0) info = read_control(msg);
+        return r;
+    }
+
+    udp::udp(uint16_t port, size_t buf_count, size_t threads, size_t batch,
+        bool use_uring, size_t frame_size, size_t datagram_size)
+    : m_batch(batch > 0 ? batch : 1), m_buf_size(datagram_size), m_bufs(nullptr),
+      m_chunks(buf_count, frame_size),
+      m_group(nullptr), m_disp(nullptr), m_held(0), m_starved(false),
+      m_datagrams(0), m_kernel_drops(0), m_pool_waits(0),
+      m_feedback_interval(0), m_feedback_sent(0) {
+        if (threads == 0) threads = 1;
+        // every thread may hold a full batch while the graphs
+        // still work on the previous one.
+        if (buf_count < threads * m_batch * 2) {
+            buf_count = threads * m_batch * 2;
+        }
+        try {
+            for (size_t i = 0; i < threads; i ++) {
+                m_sockets.push_back(open_socket(port, threads > 1));
+            }
+        } catch (const exception&) {
+            for (auto sock : m_sockets) close(sock);
+            throw;
+        }
+        m_drop_marks.assign(m_sockets.size(), 0);
+        m_pool.resize(buf_count);
+        if (use_uring && !uring::supported()) {
+            LOG(WARNING) << "io_uring not available, receive with threads";
+        } else if (use_uring) {
+            try {
+                m_io.reset(new uring());
+                m_group = m_io->add_buffer_group((uint16_t)buf_count, m_buf_size);
+            } catch (const exception&) {
+                m_io.reset();
+                for (auto sock : m_sockets) close(sock);
+                throw;
+            }
+        }
+        // io_uring receives into the buffers of its group instead.
+        if (!m_io) m_bufs = new char[m_buf_size*buf_count];
     }
 
     udp::~udp() {
-        if (m_socket >= 0) {
-            close(m_socket);
+        if (m_feedback.joinable()) {
+            stop();
+            m_feedback.join();
         }
-        delete (char*)m_bufs;
+        m_io.reset();
+        for (auto sock : m_sockets) {
+            close(sock);
+        }
+        delete [] (char*)m_bufs;
     }
 
-    bool udp::prepare_session(session& session, bool nowait) {
-        size_t idx = m_pool.get(nowait);
-        if (idx == index_pool::none) return false;
-        buf_ref ref;
-        ref.ptr = (char*)m_bufs + buf_size * idx;
-        sockaddr_in sa;
-        socklen_t salen = sizeof(sa);
-        int r = recvfrom(m_socket, ref.ptr, buf_size, 0, (sockaddr*)&sa, &salen);
-        if (r <= 0) return false;
-        ref.len = (size_t)r;
+    void udp::set_fairness(size_t depth, const unordered_map<string, size_t>& weights) {
+        if (depth == 0) {
+            m_fair.reset();
+            return;
+        }
+        m_fair.reset(new fair_queue<session>(depth));
+        for (auto& w : weights) {
+            m_fair->set_weight(w.first, w.second);
+        }
+    }
 
-        image_id id;
-        if (!image_id::extract(ref, id)) {
-            char str[64];
-            sprintf(str, "%08x", sa.sin_addr.s_addr);
-            id.src = str;
-            image_id::inject(ref, buf_size, id);
+    void udp::set_receive_buffer(size_t bytes) {
+        int size = (int)bytes;
+        for (auto sock : m_sockets) {
+            // past net.core.rmem_max, which only privileged ones may do.
+            if (setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == 0) continue;
+            if (setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0) {
+                throw runtime_error(errmsg("setsockopt SO_RCVBUF"));
+            }
+        }
+        // the kernel doubles the size for its overhead,
+        // capped by net.core.rmem_max.
+        int actual = 0;
+        socklen_t len = sizeof(actual);
+        getsockopt(m_sockets[0], SOL_SOCKET, SO_RCVBUF, &actual, &len);
+        if ((size_t)actual < bytes * 2) {
+            LOG(WARNING) << "receive buffer is " << actual / 2 << " bytes instead of "
+                << bytes << ", see net.core.rmem_max";
         }
+    }
+
+    void udp::set_feedback(chrono::milliseconds interval) {
+        m_feedback_interval = interval;
+    }
+
+    udp::stats udp::get_stats() {
+        stats st;
+        st.datagrams = m_datagrams.load();
+        st.kernel_drops = m_kernel_drops.load();
+        st.pool_waits = m_pool_waits.load();
+        st.feedback = m_feedback_sent.load();
+        st.chunks = m_chunks.get_stats();
+        unique_lock<mutex> lock(m_stats_mutex);
+        st.sources = m_sources;
+        return st;
+    }
+
+    string udp::stats_line() {
+        auto st = get_stats();
+        source_stats total;
+        for (auto& p : st.sources) {
+            total.frames += p.second.frames;
+            total.truncated += p.second.truncated;
+            total.rejected += p.second.rejected;
+            total.coalesced += p.second.coalesced;
+        }
+        char str[256];
+        snprintf(str, sizeof(str), "datagrams=%lu kernel_drops=%lu pool_waits=%lu "
+            "frames=%lu truncated=%lu rejected=%lu coalesced=%lu chunks_dropped=%lu sources=%lu feedback=%lu",
+            (unsigned long)st.datagrams, (unsigned long)st.kernel_drops,
+            (unsigned long)st.pool_waits, (unsigned long)total.frames,
+            (unsigned long)total.truncated, (unsigned long)total.rejected,
+            (unsigned long)total.coalesced,
+            (unsigned long)(st.chunks.dropped + st.chunks.expired + st.chunks.evicted),
+            (unsigned long)st.sources.size(), (unsigned long)st.feedback);
+        return str;
+    }
+
+    udp::source_stats& udp::source(const string& name) {
+        auto it = m_sources.find(name);
+        if (it != m_sources.end()) return it->second;
+        if (m_sources.size() >= max_sources) return m_sources[other_source];
+        return m_sources[name];
+    }
 
-        session.initializer = [this, ref] (graph *g) {
-            g->var(input_var())->set<buf_ref>(ref);
+    void udp::count_received(size_t index, uint32_t drops) {
+        m_datagrams ++;
+        // the count is per socket, which one thread receives on at a time.
+        if (drops > m_drop_marks[index]) {
+            m_kernel_drops += drops - m_drop_marks[index];
+            m_drop_marks[index] = drops;
+        }
+    }
+
+    void udp::count_truncated(const sockaddr_in& sa) {
+        unique_lock<mutex> lock(m_stats_mutex);
+        source(address_source(sa)).truncated ++;
+    }
+
+    void udp::run(dispatcher *disp) {
+        start_feedback(disp);
+        thread forwarder;
+        if (m_fair) {
+            forwarder = thread([this, disp] { forward(disp); });
+        }
+        if (m_io) {
+            m_disp = disp;
+            m_armed.assign(m_sockets.size(), false);
+            for (size_t i = 0; i < m_sockets.size(); i ++) {
+                arm(i);
+            }
+            m_io->run();
+        } else {
+            vector<thread> threads;
+            for (size_t i = 1; i < m_sockets.size(); i ++) {
+                threads.push_back(thread([this, i, disp] {
+                    receive(i, disp);
+                }));
+            }
+            receive(0, disp);
+            for (auto& t : threads) t.join();
+        }
+        if (m_fair) {
+            m_fair->close();
+            forwarder.join();
+        }
+        if (m_feedback.joinable()) m_feedback.join();
+    }
+
+    void udp::start_feedback(dispatcher *disp) {
+        if (m_feedback_interval.count() <= 0 || m_feedback.joinable()) return;
+        m_feedback = thread([this, disp] { feedback(disp); });
+    }
+
+    // samples the load of disp through the interval, then has a
+    // rate_controller decide the feedback of every source from its
+    // counters since the last interval. Sources which sent nothing are
+    // left alone, and forgotten after max_idle_intervals, so one which
+    // comes back starts over unlimited.
+    void udp::feedback(dispatcher *disp) {
+        struct mark {
+            uint64_t frames;
+            uint64_t lost;
+            int idle;
         };
-        session.finalizer = [this, idx] (graph *g) {
+        rate_controller ctl;
+        // per source at the last interval.
+        unordered_map<string, mark> marks;
+        auto last = chrono::steady_clock::now();
+        double load = 0;
+        int samples = 0;
+        auto tick = max(m_feedback_interval / load_samples, chrono::milliseconds(1));
+        unique_lock<mutex> lock(m_feedback_mutex);
+        while (running()) {
+            if (m_feedback_cv.wait_for(lock, tick,
+                [this] { return !running(); })) break;
+            load += disp->load();
+            if (++ samples < load_samples) continue;
+            auto now = chrono::steady_clock::now();
+            double sec = chrono::duration<double>(now - last).count();
+            last = now;
+            load /= samples;
+
+            vector<pair<string, source_stats>> sources;
+            unordered_map<string, sockaddr_in> addrs;
+            {
+                unique_lock<mutex> stats_lock(m_stats_mutex);
+                sources.assign(m_sources.begin(), m_sources.end());
+                addrs = m_addrs;
+            }
+            vector<string> idle;
+            for (auto& src : sources) {
+                auto addr = addrs.find(src.first);
+                if (addr == addrs.end()) continue;
+                uint64_t lost = src.second.rejected + src.second.coalesced;
+                auto it = marks.find(src.first);
+                if (it == marks.end()) {
+                    // counted from the next interval on.
+                    marks[src.first] = mark{src.second.frames, lost, 0};
+                    continue;
+                }
+                auto& m = it->second;
+                uint64_t frames = src.second.frames - m.frames;
+                uint64_t lost_since = lost - m.lost;
+                m.frames = src.second.frames;
+                m.lost = lost;
+                if (frames == 0 && lost_since == 0) {
+                    if (++ m.idle >= max_idle_intervals) idle.push_back(src.first);
+                    continue;
+                }
+                m.idle = 0;
+                size_t backlog = m_fair ? m_fair->size(src.first) : 0;
+                rate_feedback fb;
+                if (!ctl.update(src.first, load, sec, frames, lost_since, backlog, fb)) continue;
+                uint8_t buf[rate_feedback::size];
+                fb.encode(buf);
+                if (sendto(m_sockets[0], buf, sizeof(buf), MSG_DONTWAIT,
+                    (const sockaddr*)&addr->second, sizeof(sockaddr_in)) == (ssize_t)sizeof(buf)) {
+                    m_feedback_sent ++;
+                }
+            }
+            if (!idle.empty()) {
+                unique_lock<mutex> stats_lock(m_stats_mutex);
+                for (auto& name : idle) {
+                    ctl.remove(name);
+                    marks.erase(name);
+                    m_addrs.erase(name);
+                }
+            }
+            load = 0;
+            samples = 0;
+        }
+    }
+
+    void udp::forward(dispatcher *disp) {
+        session s;
+        while (m_fair->get(s)) {
+            if (running()) {
+                disp->dispatch(s);
+            } else if (s.dropped) {
+                s.dropped();
+            }
+        }
+    }
+
+    void udp::deliver(session& s, const sockaddr_in& sa, dispatcher *disp, bool nowait) {
+        {
+            unique_lock<mutex> lock(m_stats_mutex);
+            source(s.source).frames ++;
+            if (m_feedback_interval.count() > 0 &&
+                (m_addrs.size() < max_sources || m_addrs.find(s.source) != m_addrs.end())) {
+                m_addrs[s.source] = sa;
+            }
+        }
+        if (!m_fair) {
+            // a refused session is still ours, see dispatcher::offer.
+            if (!nowait) {
+                disp->dispatch(s);
+            } else if (!disp->offer(s)) {
+                {
+                    unique_lock<mutex> lock(m_stats_mutex);
+                    source(s.source).rejected ++;
+                }
+                if (s.dropped) s.dropped();
+            }
+            return;
+        }
+        session displaced;
+        if (m_fair->put(s.source, move(s), displaced)) {
+            {
+                unique_lock<mutex> lock(m_stats_mutex);
+                source(displaced.source).coalesced ++;
+            }
+            if (displaced.dropped) displaced.dropped();
+        }
+    }
+
+    size_t udp::take_buffer() {
+        size_t idx = m_pool.get(true);
+        if (idx != index_pool::none) return idx;
+        m_pool_waits ++;
+        while (idx == index_pool::none && evict()) {
+            idx = m_pool.get(true);
+        }
+        return idx == index_pool::none ? m_pool.get() : idx;
+    }
+
+    bool udp::evict() {
+        session s;
+        if (!m_fair || !m_fair->evict(s)) return false;
+        {
+            unique_lock<mutex> lock(m_stats_mutex);
+            source(s.source).coalesced ++;
+        }
+        if (s.dropped) s.dropped();
+        return true;
+    }
+
+    void udp::receive(size_t index, dispatcher *disp) {
+        int sock = m_sockets[index];
+        vector<size_t> idx(m_batch);
+        vector<mmsghdr> msgs(m_batch);
+        vector<iovec> iovs(m_batch);
+        vector<sockaddr_in> addrs(m_batch);
+        vector<char> controls(m_batch * control_len);
+        while (running()) {
+            // wait for one free buffer, take what else is free now.
+            size_t n = 0;
+            idx[n ++] = take_buffer();
+            while (n < m_batch) {
+                size_t i = m_pool.get(true);
+                if (i == index_pool::none) break;
+                idx[n ++] = i;
+            }
+            for (size_t i = 0; i < n; i ++) {
+                iovs[i].iov_base = (char*)m_bufs + m_buf_size * idx[i];
+                iovs[i].iov_len = m_buf_size;
+                memset(&msgs[i], 0, sizeof(mmsghdr));
+                msgs[i].msg_hdr.msg_name = &addrs[i];
+                msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+                msgs[i].msg_hdr.msg_control = &controls[i * control_len];
+                msgs[i].msg_hdr.msg_controllen = control_len;
+            }
+            int r = recvmmsg(sock, msgs.data(), (unsigned int)n, MSG_WAITFORONE, nullptr);
+            size_t got = r > 0 ? (size_t)r : 0;
+            if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                LOG(ERROR) << errmsg("recvmmsg");
+            }
+            for (size_t i = got; i < n; i ++) {
+                m_pool.put(idx[i]);
+            }
+            for (size_t i = 0; i < got; i ++) {
+                auto info = read_control(msgs[i].msg_hdr);
+                count_received(index, info.drops);
+                if (info.truncated) count_truncated(addrs[i]);
+                if (msgs[i].msg_len == 0 || info.truncated) {
+                    m_pool.put(idx[i]);
+                    continue;
+                }
+                session s;
+                size_t n = idx[i];
+                if (make_session(s, (char*)m_bufs + m_buf_size * n, msgs[i].msg_len,
+                    m_buf_size, addrs[i], info.received, [this, n] { m_pool.put(n); })) {
+                    deliver(s, addrs[i], disp);
+                }
+            }
+        }
+    }
+
+    void udp::stop() {
+        ingress::stop();
+        if (m_io) m_io->stop();
+        {
+            unique_lock<mutex> lock(m_feedback_mutex);
+        }
+        m_feedback_cv.notify_all();
+    }
+
+    void udp::arm(size_t index) {
+        m_armed[index] = true;
+        m_io->recvmsg_multishot(m_sockets[index], m_group, [this, index] (int res, uint32_t flags) {
+            auto msg = uring::parse(m_group, res, flags, control_len);
+            if (msg.payload != nullptr) {
+                uint16_t bid = uring::buffer_id(flags);
+                m_held ++;
+                sockaddr_in sa;
+                memset(&sa, 0, sizeof(sa));
+                if (msg.from != nullptr) sa = *msg.from;
+                msghdr hdr;
+                memset(&hdr, 0, sizeof(hdr));
+                hdr.msg_control = (void*)msg.control;
+                hdr.msg_controllen = msg.control_len;
+                auto info = read_control(hdr);
+                count_received(index, info.drops);
+                if (msg.truncated) count_truncated(sa);
+                if (msg.len == 0 || msg.truncated) {
+                    release(bid);
+                } else {
+                    session s;
+                    if (make_session(s, msg.payload, msg.len, msg.len + msg.room,
+                        sa, info.received, [this, bid] { release(bid); })) {
+                        deliver(s, sa, m_disp);
+                    }
+                }
+            }
+            if (uring::more(flags)) return;
+            m_armed[index] = false;
+            if (!running()) return;
+            if (res != -ENOBUFS) {
+                if (res < 0) LOG(ERROR) << "recvmsg: " << strerror(-res);
+                arm(index);
+                return;
+            }
+            // resumes when a buffer comes back, unless one already did.
+            m_pool_waits ++;
+            m_starved = true;
+            // a waiting frame makes room, its release rearms.
+            while (m_starved.load() && evict()) { }
+            if (m_held.load() < m_group->count() && m_starved.exchange(false)) {
+                rearm();
+            }
+        }, control_len);
+    }
+
+    void udp::rearm() {
+        for (size_t i = 0; i < m_armed.size(); i ++) {
+            if (!m_armed[i]) arm(i);
+        }
+    }
+
+    void udp::release(uint16_t bid) {
+        m_group->put(bid);
+        m_held --;
+        if (m_starved.exchange(false)) {
+            m_io->post([this] { rearm(); });
+        }
+    }
+
+    int udp::poll_fd() const {
+        return !m_io && !m_fair && m_sockets.size() == 1 ? m_sockets[0] : -1;
+    }
+
+    bool udp::poll(dispatcher *disp) {
+        start_feedback(disp);
+        while (running()) {
+            size_t idx = m_pool.get(true);
+            if (idx == index_pool::none) {
+                m_pool_waits ++;
+                return false;
+            }
+            char *buf = (char*)m_bufs + m_buf_size * idx;
+            sockaddr_in sa;
+            rx_info info;
+            int r = receive_one(m_sockets[0], buf, m_buf_size, MSG_DONTWAIT, sa, info);
+            if (r <= 0) {
+                m_pool.put(idx);
+                if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    LOG(ERROR) << errmsg("recvmsg");
+                }
+                return true;
+            }
+            count_received(0, info.drops);
+            if (info.truncated) {
+                count_truncated(sa);
+                m_pool.put(idx);
+                continue;
+            }
+            session s;
+            if (make_session(s, buf, (size_t)r, m_buf_size, sa, info.received, [this, idx] { m_pool.put(idx); })) {
+                deliver(s, sa, disp, true);
+            }
+        }
+        return true;
+    }
+
+    bool udp::prepare_session(session& session, bool nowait) {
+        // with io_uring, frames only come through run.
+        if (m_bufs == nullptr) return false;
+        size_t idx = m_pool.get(nowait);
+        if (idx == index_pool::none) {
+            m_pool_waits ++;
+            return false;
+        }
+        sockaddr_in sa;
+        rx_info info;
+        int r = receive_one(m_sockets[0], (char*)m_bufs + m_buf_size * idx, m_buf_size, 0, sa, info);
+        if (r <= 0) {
             m_pool.put(idx);
-        };
+            return false;
+        }
+        count_received(0, info.drops);
+        if (info.truncated) {
+            count_truncated(sa);
+            m_pool.put(idx);
+            return false;
+        }
+        return make_session(session, (char*)m_bufs + m_buf_size * idx, (size_t)r,
+            m_buf_size, sa, info.received, [this, idx] { m_pool.put(idx); });
+    }
+
+    bool udp::make_session(session& session, void* buf, size_t len, size_t cap,
+        const sockaddr_in& sa, int64_t received, function<void()> release) {
+        if (!datagram_session(session, input_var(), m_chunks, buf, len, cap, sa, release)) {
+            return false;
+        }
+        session.received = received;
         return true;
     }
 
-    struct factory : public dp::graph_def::ingress_factory {
+    // source:weight pairs separated by commas.
+    static unordered_map<string, size_t> weights_param(const dp::graph_def::params& arg, const string& key) {
+        unordered_map<string, size_t> weights;
+        auto str = dp::graph_def::param(arg, key);
+        size_t pos = 0;
+        while (pos < str.length()) {
+            auto end = str.find(',', pos);
+            if (end == string::npos) end = str.length();
+            auto item = str.substr(pos, end - pos);
+            auto colon = item.rfind(':');
+            int w = colon == string::npos ? 0 : atoi(item.c_str() + colon + 1);
+            if (colon == 0 || w <= 0) {
+                throw invalid_argument("invalid param " + key + ": " + str);
+            }
+            weights[item.substr(0, colon)] = (size_t)w;
+            pos = end + 1;
+        }
+        return weights;
+    }
+
+    struct udp_factory : public dp::graph_def::ingress_factory {
         ingress* create_ingress(
             const string& name,
             const string& type,
             const dp::graph_def::params& arg) {
-            int port = (int)udp::default_port;
-            auto port_str = arg.at("port");
-            if (!port_str.empty()) {
-                port = atoi(port_str.c_str());
-                if (port <= 0 || port > 65535) {
-                    throw invalid_argument("invalid param port: " + port_str);
-                }
+            auto port = dp::graph_def::int_param(arg, "port", udp::default_port, 1, 65535);
+            auto buf_count = dp::graph_def::int_param(arg, "buffers", 8, 1, 1024);
+            auto threads = dp::graph_def::int_param(arg, "threads", 1, 1, 1024);
+            auto batch = dp::graph_def::int_param(arg, "batch", 1, 1, 1024);
+            auto io = dp::graph_def::param(arg, "io");
+            if (!io.empty() && io != "threads" && io != "uring") {
+                throw invalid_argument("invalid param io: " + io);
+            }
+            auto frame_size = dp::graph_def::int_param(arg, "max_frame", max_frame_size, 1, 1L << 30);
+            auto datagram_size = dp::graph_def::int_param(arg, "max_datagram",
+                udp::default_datagram_size, (long)chunk_header::size + 1, udp::default_datagram_size);
+            unique_ptr<udp> in(new udp((uint16_t)port, (size_t)buf_count, (size_t)threads, (size_t)batch,
+                io == "uring", (size_t)frame_size, (size_t)datagram_size));
+            if (!dp::graph_def::param(arg, "fair").empty()) {
+                in->set_fairness((size_t)dp::graph_def::int_param(arg, "fair", 0, 0, 1024),
+                    weights_param(arg, "weights"));
+            }
+            if (!dp::graph_def::param(arg, "rcvbuf").empty()) {
+                in->set_receive_buffer((size_t)dp::graph_def::int_param(arg, "rcvbuf", 0, 1, 1L << 30));
+            }
+            if (!dp::graph_def::param(arg, "feedback").empty()) {
+                in->set_feedback(chrono::milliseconds(dp::graph_def::int_param(arg, "feedback", 0, 0, 60000)));
             }
-            return new udp((uint16_t)port);
+            return in.release();
         }
     };
 
     void udp::register_factory() {
-        static factory _factory;
+        static udp_factory _factory;
         dp::graph_def::ingress_registry::get()->add_factory("dp.udp", &_factory);
     }
 }
@@ -0,0 +1,222 @@
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include "gtest/gtest.h"
+
+#include "dp/types.h"
+#include "dp/ingress/udp.h"
+#include "dp/util/feedback.h"
+
+namespace dp::in {
+    using namespace std;
+
+    static constexpr uint16_t test_port = 22062;
+
+    // finishes every session right away, keeping the frame sizes.
+    struct size_dispatcher : public dispatcher {
+        graph g;
+        vector<size_t> sizes;
+
+        size_dispatcher() { g.def_var("input"); }
+
+        virtual bool dispatch(const session& s, bool nowait) {
+            s.initializer(&g);
+            sizes.push_back(g.var("input")->as<buf_ref>().len);
+            s.finalizer(&g);
+            return true;
+        }
+    };
+
+    // refuses nowait dispatches, and drops the others as drop_newest.
+    struct refusing_dispatcher : public dispatcher {
+        virtual bool dispatch(const session& s, bool nowait) {
+            if (!nowait && s.dropped) s.dropped();
+            return false;
+        }
+    };
+
+    // finishes every session right away, while claiming to be overloaded.
+    struct loaded_dispatcher : public dispatcher {
+        atomic<int> frames;
+
+        loaded_dispatcher() : frames(0) { }
+
+        virtual bool dispatch(const session& s, bool nowait) {
+            frames ++;
+            if (s.dropped) s.dropped();
+            return true;
+        }
+
+        virtual double load() const { return 2; }
+    };
+
+    struct sender {
+        int fd;
+        sockaddr_in to;
+
+        sender(uint16_t port) : fd(socket(PF_INET, SOCK_DGRAM, 0)) {
+            memset(&to, 0, sizeof(to));
+            to.sin_family = PF_INET;
+            to.sin_port = htons(port);
+            to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        }
+
+        ~sender() { close(fd); }
+
+        void send(size_t size) {
+            string data(size, 'x');
+            EXPECT_EQ((ssize_t)size, sendto(fd, data.data(), size, 0, (sockaddr*)&to, sizeof(to)));
+        }
+    };
+
+    static udp::source_stats total(udp& in) {
+        udp::source_stats t;
+        for (auto& p : in.get_stats().sources) {
+            t.frames += p.second.frames;
+            t.truncated += p.second.truncated;
+            t.rejected += p.second.rejected;
+        }
+        return t;
+    }
+
+    // polls until pred holds or a second passed.
+    template<typename P>
+    static void poll_until(udp& in, dispatcher *disp, P pred) {
+        auto deadline = chrono::steady_clock::now() + chrono::seconds(1);
+        while (!pred() && chrono::steady_clock::now() < deadline) {
+            in.poll(disp);
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
+
+    TEST(UdpTest, Truncated) {
+        udp in(test_port, 2, 1, 1, false, max_frame_size, 512);
+        sender out(test_port);
+        out.send(1000);
+        out.send(100);
+        size_dispatcher disp;
+        poll_until(in, &disp, [&disp] { return !disp.sizes.empty(); });
+        ASSERT_EQ(1, disp.sizes.size());
+        EXPECT_GE(disp.sizes[0], 100);
+        auto t = total(in);
+        EXPECT_EQ(1, t.frames);
+        EXPECT_EQ(1, t.truncated);
+        EXPECT_EQ(2, in.get_stats().datagrams);
+    }
+
+    TEST(UdpTest, Rejected) {
+        udp in(test_port, 2);
+        sender out(test_port);
+        refusing_dispatcher refusing;
+        // more than the buffers, which come back when refused.
+        for (int i = 0; i < 5; i ++) out.send(100);
+        poll_until(in, &refusing, [&in] { return total(in).rejected == 5; });
+        EXPECT_EQ(5, total(in).rejected);
+
+        size_dispatcher disp;
+        out.send(100);
+        poll_until(in, &disp, [&disp] { return !disp.sizes.empty(); });
+        EXPECT_EQ(1, disp.sizes.size());
+        EXPECT_EQ(6, total(in).frames);
+
+        // dropped by a blocking dispatch, not refused.
+        udp blocking(test_port + 1, 2);
+        sender out2(test_port + 1);
+        thread runner([&blocking, &refusing] { blocking.run(&refusing); });
+        for (int i = 0; i < 5; i ++) out2.send(100);
+        auto deadline = chrono::steady_clock::now() + chrono::seconds(1);
+        while (total(blocking).frames < 5 && chrono::steady_clock::now() < deadline) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        blocking.stop();
+        runner.join();
+        EXPECT_EQ(5, total(blocking).frames);
+        EXPECT_EQ(0, total(blocking).rejected);
+    }
+
+    TEST(UdpTest, FeedbackMultiplex) {
+        udp in(test_port, 8);
+        in.set_feedback(chrono::milliseconds(50));
+        loaded_dispatcher disp;
+        ingress::runner runner;
+        runner.set_multiplex(true);
+        runner.add(&in);
+        runner.start(&disp);
+
+        // the polled udp sees the load of the dispatcher behind the runner.
+        sender out(test_port);
+        vector<rate_feedback> feedback;
+        auto deadline = chrono::steady_clock::now() + chrono::seconds(2);
+        while (feedback.empty() && chrono::steady_clock::now() < deadline) {
+            out.send(100);
+            this_thread::sleep_for(chrono::milliseconds(5));
+            uint8_t buf[64];
+            auto r = recv(out.fd, buf, sizeof(buf), MSG_DONTWAIT);
+            rate_feedback fb;
+            if (r > 0 && rate_feedback::decode(buf, (size_t)r, fb)) feedback.push_back(fb);
+        }
+        runner.stop();
+        runner.join();
+        ASSERT_FALSE(feedback.empty());
+        EXPECT_EQ(200, feedback[0].load);
+        EXPECT_GT(feedback[0].max_fps_milli, 0);
+        EXPECT_GT(disp.frames.load(), 0);
+        EXPECT_GE(in.get_stats().feedback, 1);
+    }
+
+    // the feedback received by out so far.
+    static vector<rate_feedback> feedback_of(sender& out) {
+        vector<rate_feedback> feedback;
+        uint8_t buf[64];
+        ssize_t r;
+        while ((r = recv(out.fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+            rate_feedback fb;
+            if (rate_feedback::decode(buf, (size_t)r, fb)) feedback.push_back(fb);
+        }
+        return feedback;
+    }
+
+    // sends until some feedback comes back or a second passed.
+    static vector<rate_feedback> send_for_feedback(sender& out) {
+        vector<rate_feedback> feedback;
+        auto deadline = chrono::steady_clock::now() + chrono::seconds(1);
+        while (feedback.empty() && chrono::steady_clock::now() < deadline) {
+            out.send(100);
+            this_thread::sleep_for(chrono::milliseconds(5));
+            feedback = feedback_of(out);
+        }
+        return feedback;
+    }
+
+    TEST(UdpTest, FeedbackQuietSource) {
+        udp in(test_port, 8);
+        in.set_feedback(chrono::milliseconds(20));
+        loaded_dispatcher disp;
+        thread runner([&in, &disp] { in.run(&disp); });
+        sender out(test_port);
+        auto feedback = send_for_feedback(out);
+        ASSERT_FALSE(feedback.empty());
+        EXPECT_EQ(1, feedback[0].seq);
+
+        // quiet, it is left alone and then forgotten.
+        this_thread::sleep_for(chrono::milliseconds(200));
+        feedback_of(out);
+        this_thread::sleep_for(chrono::milliseconds(100));
+        EXPECT_TRUE(feedback_of(out).empty());
+
+        // back, it starts over unlimited.
+        feedback = send_for_feedback(out);
+        in.stop();
+        runner.join();
+        ASSERT_FALSE(feedback.empty());
+        EXPECT_EQ(1, feedback[0].seq);
+        EXPECT_EQ(100, feedback[0].quality);
+        EXPECT_GT(feedback[0].max_fps_milli, 1000);
+    }
+}
@@ -1,3 +1,7 @@
+#include <climits>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
 #include <opencv2/highgui/highgui.hpp>
 #include <glog/logging.h>
 
@@ -8,15 +12,28 @@ namespace dp::in {
     using namespace std;
     using namespace cv;
 
-    video_capture::video_capture() {
+    static constexpr size_t default_buffers = 3;
+    // lets a waiting session notice stop.
+    static constexpr int wait_timeout_ms = 200;
+    // the delay after a failed read, doubling up to the max.
+    static constexpr int min_backoff_ms = 10;
+    static constexpr int max_backoff_ms = 1000;
+
+    constexpr int video_capture::max_read_failures;
+
+    video_capture::video_capture()
+    : m_frames(default_buffers), m_free(default_buffers),
+      m_latest(index_pool::none), m_capturing(false) {
     }
 
     video_capture::video_capture(const ::std::string& fn)
-    : m_cap(fn) {
+    : m_cap(fn), m_frames(default_buffers), m_free(default_buffers),
+      m_latest(index_pool::none), m_capturing(false) {
     }
 
     video_capture::video_capture(int index)
-    : m_cap(index) {
+    : m_cap(index), m_frames(default_buffers), m_free(default_buffers),
+      m_latest(index_pool::none), m_capturing(false) {
     }
 
     video_capture::~video_capture() {
@@ -39,10 +56,121 @@ namespace dp::in {
         m_cap.set(CAP_PROP_FRAME_HEIGHT, h);
     }
 
+    void video_capture::set_fps(double fps) {
+        m_cap.set(CAP_PROP_FPS, fps);
+    }
+
+    void video_capture::set_buffers(size_t n) {
+        if (n < default_buffers) n = default_buffers;
+        m_frames.resize(n);
+        m_free.resize(n);
+    }
+
+    void video_capture::run(dispatcher *disp) {
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_capturing = true;
+        }
+        // keeps the driver from queuing frames behind our back.
+        m_cap.set(CAP_PROP_BUFFERSIZE, 1);
+        thread capture_thread([this] { capture(); });
+        ingress::run(disp);
+        capture_thread.join();
+    }
+
+    void video_capture::stop() {
+        ingress::stop();
+        m_cv.notify_all();
+    }
+
+    void video_capture::capture() {
+        // cameras and streams report no frame count.
+        double frame_count = m_cap.get(CAP_PROP_FRAME_COUNT);
+        double fps = m_cap.get(CAP_PROP_FPS);
+        bool is_file = frame_count > 0;
+        chrono::steady_clock::duration interval(0);
+        if (is_file && fps > 0) {
+            interval = chrono::duration_cast<chrono::steady_clock::duration>(
+                chrono::duration<double>(1 / fps));
+        }
+        auto next = chrono::steady_clock::now();
+        int failures = 0;
+        while (running()) {
+            if (interval.count() > 0) {
+                auto now = chrono::steady_clock::now();
+                if (next < now) {
+                    next = now;
+                } else {
+                    wait_until(next);
+                }
+                next += interval;
+            }
+            size_t slot = m_free.get(true);
+            bool ok;
+            if (slot == index_pool::none) {
+                ok = m_cap.grab();
+            } else {
+                // reads into the buffer in place, the size doesn't change.
+                ok = m_cap.read(m_frames[slot]) && !m_frames[slot].empty();
+                if (!ok) m_free.put(slot);
+            }
+            if (!ok) {
+                if (is_file && m_cap.get(CAP_PROP_POS_FRAMES) >= frame_count) break;
+                if (++ failures >= max_read_failures) {
+                    LOG(ERROR) << "video_capture: " << failures << " reads failed in a row";
+                    break;
+                }
+                int backoff = min_backoff_ms << (failures - 1);
+                if (backoff > max_backoff_ms) backoff = max_backoff_ms;
+                wait_until(chrono::steady_clock::now() + chrono::milliseconds(backoff));
+                next = chrono::steady_clock::now();
+                continue;
+            }
+            failures = 0;
+            if (slot == index_pool::none) continue;
+            size_t stale;
+            {
+                unique_lock<mutex> lock(m_mutex);
+                stale = m_latest;
+                m_latest = slot;
+            }
+            m_cv.notify_one();
+            if (stale != index_pool::none) {
+                m_free.put(stale);
+            }
+        }
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_capturing = false;
+        }
+        m_cv.notify_all();
+    }
+
+    // returns early on stop.
+    void video_capture::wait_until(chrono::steady_clock::time_point t) {
+        unique_lock<mutex> lock(m_mutex);
+        while (running() && chrono::steady_clock::now() < t) {
+            m_cv.wait_until(lock, t);
+        }
+    }
+
     bool video_capture::prepare_session(session& session, bool nowait) {
-        Mat frame;
-        m_cap >> frame;
-        if (frame.empty()) return false;
+        size_t slot;
+        {
+            unique_lock<mutex> lock(m_mutex);
+            while (m_latest == index_pool::none) {
+                if (nowait || !running()) return false;
+                if (!m_capturing) {
+                    // the end of a video file, or the device is gone.
+                    m_running = false;
+                    return false;
+                }
+                m_cv.wait_for(lock, chrono::milliseconds(wait_timeout_ms));
+            }
+            slot = m_latest;
+            m_latest = index_pool::none;
+        }
+        Mat frame = m_frames[slot];
         if (!m_show_name.empty()) {
             imshow(m_show_name.c_str(), frame);
             waitKey(1);
@@ -50,25 +178,41 @@ namespace dp::in {
         session.initializer = [this, frame] (graph *g) {
             g->var(input_var())->set<Mat>(frame);
         };
+        session.finalizer = [this, slot] (graph *g) {
+            m_free.put(slot);
+        };
+        session.dropped = [this, slot] {
+            m_free.put(slot);
+        };
         return true;
     }
 
-    struct factory : public dp::graph_def::ingress_factory {
+    struct video_capture_factory : public dp::graph_def::ingress_factory {
         ingress* create_ingress(
             const string& name,
             const string& type,
             const dp::graph_def::params& arg) {
-            int dev_index = 0;
-            auto dev_str = arg.at("dev");
-            if (!dev_str.empty()) {
-                dev_index = atoi(dev_str.c_str());
+            auto dev_index = dp::graph_def::int_param(arg, "dev", 0, INT_MIN, INT_MAX);
+            unique_ptr<video_capture> cap(new video_capture((int)dev_index));
+            auto w = dp::graph_def::int_param(arg, "width", 0, 1, INT_MAX);
+            auto h = dp::graph_def::int_param(arg, "height", 0, 1, INT_MAX);
+            if (w > 0 && h > 0) {
+                cap->set_frame_size((int)w, (int)h);
+            }
+            auto fps = dp::graph_def::int_param(arg, "fps", 0, 1, INT_MAX);
+            if (fps > 0) {
+                cap->set_fps((int)fps);
+            }
+            auto buffers = dp::graph_def::int_param(arg, "buffers", 0, 1, INT_MAX);
+            if (buffers > 0) {
+                cap->set_buffers((size_t)buffers);
             }
-            return new video_capture(dev_index);
+            return cap.release();
         }
     };
 
     void video_capture::register_factory() {
-        static factory _factory;
+        static video_capture_factory _factory;
         dp::graph_def::ingress_registry::get()->add_factory("dp.videocap", &_factory);
     }
 }
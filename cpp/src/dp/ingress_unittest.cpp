@@ -0,0 +1,217 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/eventfd.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <chrono>
+#include <thread>
+#include "gtest/gtest.h"
+
+#include "dp/graph.h"
+#include "dp/dispatch.h"
+#include "dp/ingress.h"
+#include "dp/util/queue.h"
+
+namespace dp {
+    using namespace std;
+
+    static size_t thread_count() {
+        size_t n = 0;
+        DIR *dir = opendir("/proc/self/task");
+        while (auto ent = readdir(dir)) {
+            if (ent->d_name[0] != '.') n ++;
+        }
+        closedir(dir);
+        return n;
+    }
+
+    // a pollable ingress emitting the frames pushed to it.
+    struct pushed_ingress : public ingress {
+        string name;
+        int fd;
+        atomic<int> pending;
+        atomic<int> dropped;
+        uint64_t seq;
+
+        pushed_ingress(const string& n)
+        : name(n), fd(eventfd(0, EFD_NONBLOCK)), pending(0), dropped(0), seq(0) { }
+        ~pushed_ingress() { close(fd); }
+
+        void push(int n) {
+            pending += n;
+            uint64_t one = 1;
+            EXPECT_EQ(sizeof(one), write(fd, &one, sizeof(one)));
+        }
+
+        virtual int poll_fd() const { return fd; }
+
+    protected:
+        virtual bool prepare_session(session& s, bool nowait) {
+            if (pending.load() == 0) {
+                uint64_t val;
+                if (read(fd, &val, sizeof(val)) < 0) { }
+                if (pending.load() == 0) return false;
+            }
+            pending --;
+            s.source = name;
+            s.seq = ++ seq;
+            string val = name + "/" + to_string(s.seq);
+            s.initializer = [val] (graph *g) {
+                g->var("input")->set<string>(val);
+            };
+            s.dropped = [this] { dropped ++; };
+            return true;
+        }
+    };
+
+    // a single graph held in its op until the gate opens,
+    // with no queue in front of it.
+    struct gated_graph {
+        graph g;
+        mutex gate_mutex;
+        condition_variable gate_cv;
+        bool opened;
+        queue<string> done;
+        graph_dispatcher disp;
+
+        gated_graph() : g("gated"), opened(false) {
+            g.def_vars({"input", "out"});
+            g.add_op("wait", {"input"}, {"out"}, [this] (graph::ctx ctx) {
+                unique_lock<mutex> lock(gate_mutex);
+                while (!opened) gate_cv.wait(lock);
+                ctx.out(0)->set<string>(ctx.in(0)->as<string>());
+            });
+            disp.add_graph(&g);
+            disp.set_queue(0, overflow_policy::block);
+            disp.set_completion([this] (graph *g) {
+                done.put(g->var("out")->as<string>());
+            });
+        }
+
+        ~gated_graph() { open(); }
+
+        void open() {
+            unique_lock<mutex> lock(gate_mutex);
+            opened = true;
+            gate_cv.notify_all();
+        }
+    };
+
+    TEST(IngressTest, Multiplex) {
+        gated_graph gg;
+        vector<unique_ptr<pushed_ingress>> ingresses;
+        ingress::runner runner;
+        runner.set_multiplex(true);
+        for (int i = 0; i < 20; i ++) {
+            ingresses.push_back(unique_ptr<pushed_ingress>(new pushed_ingress("cam" + to_string(i))));
+            runner.add(ingresses.back().get());
+        }
+        size_t threads = thread_count();
+        runner.start(&gg.disp);
+        EXPECT_EQ(threads + 1, thread_count());
+
+        // the graph is stuck, so all but the first are held.
+        for (auto& in : ingresses) in->push(5);
+        this_thread::sleep_for(chrono::milliseconds(50));
+        EXPECT_GT(gg.disp.stats().rejected, 0);
+        gg.open();
+
+        map<string, int> last;
+        for (int i = 0; i < 100; i ++) {
+            string val = gg.done.get();
+            auto pos = val.find('/');
+            int seq = atoi(val.substr(pos + 1).c_str());
+            EXPECT_EQ(last[val.substr(0, pos)] + 1, seq);
+            last[val.substr(0, pos)] = seq;
+        }
+        for (auto& in : ingresses) EXPECT_EQ(0, in->pending.load());
+        runner.stop();
+        runner.join();
+    }
+
+    TEST(IngressTest, MultiplexSkipsUnpollable) {
+        struct plain : public ingress {
+            virtual void run(dispatcher*) {
+                while (running()) this_thread::sleep_for(chrono::milliseconds(1));
+            }
+        } a, b;
+        pushed_ingress c("c");
+        gated_graph gg;
+        gg.open();
+        ingress::runner runner;
+        runner.set_multiplex(true);
+        runner.add(&a);
+        runner.add(&b);
+        runner.add(&c);
+        size_t threads = thread_count();
+        runner.start(&gg.disp);
+        EXPECT_EQ(threads + 3, thread_count());
+        c.push(1);
+        EXPECT_EQ("c/1", gg.done.get());
+        runner.stop();
+        runner.join();
+    }
+
+    TEST(IngressTest, MultiplexHeld) {
+        // tells the sessions dispatched from those held.
+        struct counting_ingress : public pushed_ingress {
+            atomic<int> taken, held;
+
+            counting_ingress() : pushed_ingress("cam"), taken(0), held(0) { }
+
+            virtual bool poll(dispatcher *disp) {
+                session s;
+                while (prepare_session(s, true)) {
+                    (disp->dispatch(s, true) ? taken : held) ++;
+                }
+                return true;
+            }
+        } in;
+        gated_graph gg;
+        ingress::runner runner;
+        runner.set_multiplex(true);
+        runner.add(&in);
+        runner.start(&gg.disp);
+        in.push(3);
+        this_thread::sleep_for(chrono::milliseconds(50));
+        EXPECT_EQ(1, in.taken.load());
+        EXPECT_EQ(2, in.held.load());
+        gg.open();
+        for (int i = 1; i <= 3; i ++) EXPECT_EQ("cam/" + to_string(i), gg.done.get());
+        EXPECT_EQ(0, in.dropped.load());
+        runner.stop();
+        runner.join();
+    }
+
+    TEST(IngressTest, MultiplexEpollError) {
+        // epoll refuses the fd of /dev/null.
+        struct unpollable : public pushed_ingress {
+            int null_fd;
+
+            unpollable() : pushed_ingress("null"), null_fd(open("/dev/null", O_RDONLY)) { }
+            ~unpollable() { close(null_fd); }
+
+            virtual int poll_fd() const { return null_fd; }
+        } bad;
+        pushed_ingress cam("cam");
+        gated_graph gg;
+        ingress::runner runner;
+        runner.set_multiplex(true);
+        runner.add(&cam);
+        runner.add(&bad);
+        // the first is taken and the second held, before the error.
+        cam.push(2);
+        runner.start(&gg.disp);
+        // the poll thread ends by itself.
+        runner.join();
+        EXPECT_EQ(1, cam.dropped.load());
+        gg.open();
+        EXPECT_EQ("cam/1", gg.done.get());
+    }
+}
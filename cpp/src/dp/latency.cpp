@@ -0,0 +1,94 @@
+#include <cstdio>
+#include <cmath>
+
+#include "dp/latency.h"
+
+namespace dp {
+    using namespace std;
+
+    constexpr size_t latency_histogram::sub_buckets;
+    constexpr size_t latency_histogram::bucket_count;
+
+    void frame_latency::resize(size_t op_count) {
+        m_ops.reset(new span[op_count]);
+        m_op_count = op_count;
+    }
+
+    void frame_latency::clear() {
+        received = dispatched = started = executed = 0;
+        finalizer.begin = finalizer.end = 0;
+        for (size_t i = 0; i < m_op_count; i ++) {
+            m_ops[i].begin = m_ops[i].end = 0;
+        }
+    }
+
+    int64_t frame_latency::from_realtime(const timespec& ts) {
+        timespec real;
+        clock_gettime(CLOCK_REALTIME, &real);
+        int64_t mono = now();
+        int64_t age = (int64_t)(real.tv_sec - ts.tv_sec) * 1000000000 +
+            (real.tv_nsec - ts.tv_nsec);
+        // a clock step may put ts in the future.
+        return age > 0 ? mono - age : mono;
+    }
+
+    latency_histogram::latency_histogram()
+    : m_buckets(bucket_count, 0), m_count(0), m_sum(0), m_max(0) {
+    }
+
+    size_t latency_histogram::bucket(uint64_t ns) {
+        if (ns < sub_buckets) return (size_t)ns;
+        size_t shift = 63 - __builtin_clzll(ns) - sub_bits;
+        return (shift + 1) * sub_buckets + (size_t)((ns >> shift) & (sub_buckets - 1));
+    }
+
+    uint64_t latency_histogram::lower_bound(size_t b) {
+        if (b < sub_buckets) return b;
+        size_t shift = b / sub_buckets - 1;
+        return (uint64_t)(sub_buckets + b % sub_buckets) << shift;
+    }
+
+    void latency_histogram::add(int64_t ns) {
+        if (ns < 0) ns = 0;
+        m_buckets[bucket((uint64_t)ns)] ++;
+        m_count ++;
+        m_sum += ns;
+        if (ns > m_max) m_max = ns;
+    }
+
+    void latency_histogram::merge(const latency_histogram& h) {
+        for (size_t i = 0; i < bucket_count; i ++) {
+            m_buckets[i] += h.m_buckets[i];
+        }
+        m_count += h.m_count;
+        m_sum += h.m_sum;
+        if (h.m_max > m_max) m_max = h.m_max;
+    }
+
+    int64_t latency_histogram::percentile(double p) const {
+        if (m_count == 0) return 0;
+        uint64_t rank = (uint64_t)ceil(p * m_count);
+        if (rank >= m_count) return m_max;
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < bucket_count; i ++) {
+            seen += m_buckets[i];
+            if (seen < rank) continue;
+            // the middle of the bucket.
+            uint64_t lo = lower_bound(i), hi = lower_bound(i + 1);
+            int64_t val = (int64_t)(lo + (hi - lo) / 2);
+            return val < m_max ? val : m_max;
+        }
+        return m_max;
+    }
+
+    string latency_histogram::summary() const {
+        char str[256];
+        snprintf(str, sizeof(str),
+            "n=%lu mean=%.3fms p50=%.3fms p90=%.3fms p99=%.3fms max=%.3fms",
+            (unsigned long)m_count, mean() / 1e6,
+            percentile(0.5) / 1e6, percentile(0.9) / 1e6,
+            percentile(0.99) / 1e6, m_max / 1e6);
+        return str;
+    }
+}
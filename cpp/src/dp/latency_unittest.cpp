@@ -0,0 +1,103 @@
+#include <string>
+#include <chrono>
+#include <thread>
+#include <ctime>
+#include "gtest/gtest.h"
+
+#include "dp/graph.h"
+#include "dp/dispatch.h"
+#include "dp/latency.h"
+#include "dp/util/queue.h"
+
+namespace dp {
+    using namespace std;
+
+    TEST(LatencyTest, Histogram) {
+        latency_histogram h;
+        EXPECT_EQ(0, h.percentile(0.5));
+        for (int64_t i = 1; i <= 1000; i ++) {
+            h.add(i * 1000);
+        }
+        EXPECT_EQ(1000, h.count());
+        EXPECT_EQ(1000000, h.max());
+        EXPECT_DOUBLE_EQ(500500, h.mean());
+        auto near = [] (int64_t expected, int64_t actual) {
+            int64_t margin = expected / (int64_t)latency_histogram::sub_buckets;
+            return actual >= expected - margin && actual <= expected + margin;
+        };
+        EXPECT_TRUE(near(500000, h.percentile(0.5))) << h.percentile(0.5);
+        EXPECT_TRUE(near(990000, h.percentile(0.99))) << h.percentile(0.99);
+        EXPECT_EQ(1000000, h.percentile(1));
+
+        latency_histogram o;
+        o.add(5);
+        o.merge(h);
+        EXPECT_EQ(1001, o.count());
+        EXPECT_EQ(5, o.percentile(0));
+    }
+
+    TEST(LatencyTest, FromRealtime) {
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec --;
+        int64_t ago = frame_latency::now() - frame_latency::from_realtime(ts);
+        EXPECT_GE(ago, 999000000);
+        EXPECT_LT(ago, 1100000000);
+    }
+
+    TEST(LatencyTest, Dispatch) {
+        graph g("timed");
+        g.def_vars({"input", "a", "b"});
+        g.add_op("first", {"input"}, {"a"}, [] (graph::ctx ctx) {
+            this_thread::sleep_for(chrono::milliseconds(10));
+            ctx.out(0)->set<int>(ctx.in(0)->as<int>());
+        });
+        g.add_op("second", {"a"}, {"b"}, [] (graph::ctx ctx) {
+            // sees the op it depends on completed, itself running.
+            const auto& l = ctx.latency();
+            EXPECT_EQ(2, l.op_count());
+            EXPECT_EQ("first", ctx.op_name(0));
+            EXPECT_GE(l.op(0).end - l.op(0).begin, 10000000);
+            EXPECT_GT(l.op(1).begin, 0);
+            EXPECT_EQ(0, l.op(1).end);
+            EXPECT_LE(l.received, l.dispatched);
+            ctx.out(0)->set<int>(ctx.in(0)->as<int>());
+        });
+        graph_dispatcher disp;
+        disp.add_graph(&g);
+        queue<int64_t> done;
+
+        session s;
+        s.received = frame_latency::now() - 5000000;
+        s.initializer = [] (graph *g) { g->var("input")->set<int>(1); };
+        s.finalizer = [&done] (graph *g) {
+            this_thread::sleep_for(chrono::milliseconds(2));
+            done.put(g->latency().received);
+        };
+        disp.dispatch(s);
+        EXPECT_EQ(s.received, done.get());
+
+        // finalized() records right after the finalizer returns.
+        latency_stats st;
+        for (int i = 0; i < 100 && st.total.count() == 0; i ++) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+            st = disp.latency();
+        }
+        EXPECT_EQ(1, st.total.count());
+        EXPECT_GE(st.ingress.max(), 5000000);
+        EXPECT_GE(st.exec.max(), 10000000);
+        EXPECT_GE(st.finalize.max(), 2000000);
+        EXPECT_GE(st.total.max(), 17000000);
+
+        // without a receive time, latency starts with dispatch.
+        s.received = 0;
+        disp.dispatch(s);
+        done.get();
+        for (int i = 0; i < 100 && st.total.count() < 2; i ++) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+            st = disp.latency();
+        }
+        EXPECT_EQ(2, st.total.count());
+        EXPECT_EQ(1, st.ingress.count());
+    }
+}
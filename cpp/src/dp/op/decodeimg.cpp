@@ -9,7 +9,7 @@ namespace dp::op {
     using namespace cv;
 
     void decode_image::operator() (graph::ctx ctx) {
-        const buf_ref& buf = ctx.in(0)->as<buf_ref>();
+        const buf_ref& buf = ctx.in<buf_ref>(0);
         auto img = imdecode(Mat(1, buf.len, CV_8UC1, buf.ptr), 1);
         ctx.out(0)->set<Mat>(img);
         ctx.out(1)->set<image_size>(image_size(img.cols, img.rows));
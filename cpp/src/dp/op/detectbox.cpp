@@ -5,9 +5,9 @@ namespace dp::op {
     using namespace std;
 
     void detect_boxes_json::operator() (graph::ctx ctx) {
-        const auto& sz = ctx.in(0)->as<dp::image_size>();
-        const auto& id = ctx.in(1)->as<dp::image_id>();
-        const auto& boxes = ctx.in(2)->as<vector<dp::detect_box>>();
+        const auto& sz = ctx.in<dp::image_size>(0);
+        const auto& id = ctx.in<dp::image_id>(1);
+        const auto& boxes = ctx.in<vector<dp::detect_box>>(2);
         char cstr[1024];
         sprintf(cstr, "{\"src\":\"%s\",\"seq\":%lu,\"size\":[%d,%d],\"boxes\":[",
             id.src.c_str(), id.seq, sz.w, sz.h);
@@ -17,7 +17,30 @@ namespace dp::op {
                 b.category, b.confidence, b.x0, b.y0, b.x1, b.y1);
             str += cstr;
         }
-        str = str.substr(0, str.length()-1) + "]}";
+        if (!boxes.empty()) str.pop_back();
+        str += "]";
+        if (latency) str += latency_json(ctx);
+        str += "}";
         ctx.out(0)->set<string>(str);
     }
+
+    // the stages so far in microseconds, the ops which completed by now.
+    string detect_boxes_json::latency_json(graph::ctx ctx) {
+        const auto& l = ctx.latency();
+        auto now = frame_latency::now();
+        char cstr[256];
+        sprintf(cstr, ",\"latency_us\":{\"ingress\":%ld,\"wait\":%ld,\"ops\":{",
+            (long)(l.dispatched - l.received) / 1000, (long)(l.started - l.dispatched) / 1000);
+        string str(cstr);
+        bool first = true;
+        for (size_t i = 0; i < l.op_count(); i ++) {
+            int64_t begin = l.op(i).begin, end = l.op(i).end;
+            if (end == 0) continue;
+            if (!first) str += ",";
+            str += "\"" + ctx.op_name(i) + "\":" + to_string((end - begin) / 1000);
+            first = false;
+        }
+        sprintf(cstr, "},\"total\":%ld}", (long)(now - l.received) / 1000);
+        return str + cstr;
+    }
 }
@@ -1,3 +1,5 @@
+#include <opencv2/core/core.hpp>
+
 #include "dp/types.h"
 #include "dp/operators.h"
 #include "dp/graph_def.h"
@@ -9,16 +11,23 @@ namespace dp::op {
         function<dp::graph::op_func(
             const string&, const string&, 
             const dp::graph_def::params&)> func;
+        dp::graph::op_sig sig;
 
         wrap_factory(function<dp::graph::op_func(
             const string&, const string&, 
-            const dp::graph_def::params&)> f) : func(f) {}
+            const dp::graph_def::params&)> f,
+            const dp::graph::op_sig& s = dp::graph::op_sig()) : func(f), sig(s) {}
 
         dp::graph::op_func create_op(
             const string& name, const string& type,
             const dp::graph_def::params& args) {
             return func(name, type, args);
         }
+
+        dp::graph::op_sig signature(const string& type,
+            const dp::graph_def::params& args) {
+            return sig;
+        }
     };
 
     template<typename T>
@@ -28,6 +37,11 @@ namespace dp::op {
             const dp::graph_def::params& args) {
             return T();
         }
+
+        dp::graph::op_sig signature(const string& type,
+            const dp::graph_def::params& args) {
+            return T::signature();
+        }
     };
 
     void register_factories() {
@@ -45,14 +59,30 @@ namespace dp::op {
                     suffix = it->second;
                 }
                 return save_image(prefix, suffix);
-            }
+            }, save_image::signature()
+        );
+        static wrap_factory detectboxesjson_f(
+            [] (const string& name, const string& type,
+                const dp::graph_def::params& args) {
+                return detect_boxes_json(dp::graph_def::bool_param(args, "latency"));
+            }, detect_boxes_json::signature()
+        );
+        static wrap_factory shmpub_f(
+            [] (const string& name, const string& type,
+                const dp::graph_def::params& args) {
+                auto path = dp::graph_def::param(args, "path");
+                if (path.empty()) {
+                    throw invalid_argument("missing param path");
+                }
+                return shm_pub(path);
+            }, shm_pub::signature()
         );
-        static noparams_factory<detect_boxes_json> detectboxesjson_f;
 
         auto reg = dp::graph_def::op_registry::get();
         reg->add_factory("dp.image_id", &imageid_f);
         reg->add_factory("dp.decode_image", &decodeimg_f);
         reg->add_factory("dp.save_image", &saveimg_f);
         reg->add_factory("dp.detect_boxes_json", &detectboxesjson_f);
+        reg->add_factory("dp.shm_pub", &shmpub_f);
     }
 }
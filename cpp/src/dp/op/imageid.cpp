@@ -6,7 +6,7 @@ namespace dp::op {
 
     void image_id::operator() (graph::ctx ctx) {
         dp::image_id id;
-        dp::image_id::extract(ctx.in(0)->as<buf_ref>(), id);
+        dp::image_id::extract(ctx.in<buf_ref>(0), id);
         ctx.out(0)->set<dp::image_id>(id);
     }
 }
@@ -9,8 +9,8 @@ namespace dp::op {
     using namespace std;
 
     void save_image::operator() (graph::ctx ctx) {
-        const buf_ref& buf = ctx.in(0)->as<buf_ref>();
-        const dp::image_id& imgid = ctx.in(1)->as<dp::image_id>();
+        const buf_ref& buf = ctx.in<buf_ref>(0);
+        const dp::image_id& imgid = ctx.in<dp::image_id>(1);
         if (imgid.seq == 0) return;
         char seq_str[64];
         sprintf(seq_str, "%lu", imgid.seq);
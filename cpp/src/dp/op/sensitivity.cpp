@@ -21,8 +21,8 @@ namespace dp::op {
     }
 
     void sensitivity::operator() (graph::ctx ctx) {
-        const image_size& sz = ctx.in(0)->as<image_size>();
-        const vector<detect_box>& boxes = ctx.in(2)->as<vector<detect_box>>();
+        const image_size& sz = ctx.in<image_size>(0);
+        const vector<detect_box>& boxes = ctx.in<vector<detect_box>>(2);
         vector<float> levels;
         for (auto& b : boxes) {
             if (b.category >= 0 && b.category < categories.size()) {
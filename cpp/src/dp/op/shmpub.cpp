@@ -0,0 +1,14 @@
+#include <glog/logging.h>
+
+#include "dp/operators.h"
+#include "dp/ingress/shm.h"
+
+namespace dp::op {
+    using namespace std;
+
+    void shm_pub::operator() (graph::ctx ctx) {
+        if (dp::in::shm::publish(path, ctx.in<string>(0)) == 0) {
+            VLOG(3) << "shm_pub: no producer on " << path;
+        }
+    }
+}
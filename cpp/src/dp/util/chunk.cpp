@@ -0,0 +1,206 @@
+#include <arpa/inet.h>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+
+#include "dp/util/chunk.h"
+
+namespace dp {
+    using namespace std;
+
+    constexpr uint16_t chunk_header::magic;
+    constexpr uint8_t chunk_header::version;
+    constexpr size_t chunk_header::size;
+
+    static void put16(uint8_t *p, uint16_t v) {
+        v = htons(v);
+        memcpy(p, &v, sizeof(v));
+    }
+
+    static void put32(uint8_t *p, uint32_t v) {
+        v = htonl(v);
+        memcpy(p, &v, sizeof(v));
+    }
+
+    static uint16_t get16(const uint8_t *p) {
+        uint16_t v;
+        memcpy(&v, p, sizeof(v));
+        return ntohs(v);
+    }
+
+    static uint32_t get32(const uint8_t *p) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return ntohl(v);
+    }
+
+    void chunk_header::encode(void *buf) const {
+        uint8_t *p = (uint8_t*)buf;
+        put16(p, magic);
+        p[2] = version;
+        p[3] = 0;
+        put32(p + 4, frame);
+        put16(p + 8, index);
+        put16(p + 10, count);
+        put32(p + 12, frame_size);
+        put32(p + 16, offset);
+    }
+
+    bool chunk_header::decode(const void *buf, size_t len, chunk_header& h) {
+        const uint8_t *p = (const uint8_t*)buf;
+        if (len < size || get16(p) != magic || p[2] != version) return false;
+        h.frame = get32(p + 4);
+        h.index = get16(p + 8);
+        h.count = get16(p + 10);
+        h.frame_size = get32(p + 12);
+        h.offset = get32(p + 16);
+        return h.count > 0 && h.index < h.count;
+    }
+
+    size_t encode_chunks(uint32_t frame, const void *data, size_t size,
+        size_t chunk_size, vector<uint8_t>& out) {
+        size_t payload = chunk_size - chunk_header::size;
+        size_t count = size == 0 ? 1 : (size + payload - 1) / payload;
+        if (count > 0xffff) {
+            throw invalid_argument("too many chunks: " + to_string(count));
+        }
+        out.resize(size + count * chunk_header::size);
+        chunk_header h;
+        h.frame = frame;
+        h.count = (uint16_t)count;
+        h.frame_size = (uint32_t)size;
+        uint8_t *p = out.data();
+        for (size_t i = 0; i < count; i ++) {
+            size_t off = i * payload;
+            size_t len = size - off < payload ? size - off : payload;
+            h.index = (uint16_t)i;
+            h.offset = (uint32_t)off;
+            h.encode(p);
+            memcpy(p + chunk_header::size, (const uint8_t*)data + off, len);
+            p += chunk_header::size + len;
+        }
+        return count;
+    }
+
+    size_t encode_stream_prefix(size_t size, void *buf) {
+        uint8_t *p = (uint8_t*)buf;
+        if (size < 0xffff) {
+            uint16_t sz = (uint16_t)size;
+            memcpy(p, &sz, sizeof(sz));
+            return sizeof(sz);
+        }
+        uint16_t esc = 0xffff;
+        uint32_t sz = (uint32_t)size;
+        memcpy(p, &esc, sizeof(esc));
+        memcpy(p + sizeof(esc), &sz, sizeof(sz));
+        return sizeof(esc) + sizeof(sz);
+    }
+
+    reassembler::reassembler(size_t slots, size_t frame_size, chrono::milliseconds timeout)
+    : m_frame_size(frame_size), m_timeout(timeout), m_pool(slots), m_bufs(slots) {
+    }
+
+    size_t reassembler::feed(uint64_t src, const void *data, size_t len, size_t& frame_len) {
+        chunk_header h;
+        size_t payload = len - chunk_header::size;
+        unique_lock<mutex> lock(m_mutex);
+        auto now = clock::now();
+        expire(now);
+        if (!chunk_header::decode(data, len, h) ||
+            h.frame_size > m_frame_size ||
+            (size_t)h.offset + payload > h.frame_size) {
+            m_stats.dropped ++;
+            return index_pool::none;
+        }
+
+        auto key = make_pair(src, h.frame);
+        auto it = m_partials.find(key);
+        if (it == m_partials.end()) {
+            size_t slot = take_slot();
+            if (slot == index_pool::none) {
+                m_stats.dropped ++;
+                return index_pool::none;
+            }
+            partial p;
+            p.slot = slot;
+            p.frame_size = h.frame_size;
+            p.received = 0;
+            p.chunk_payload = 0;
+            p.bytes = 0;
+            p.got.resize(h.count);
+            p.deadline = now + m_timeout;
+            it = m_partials.insert(make_pair(key, move(p))).first;
+        }
+        auto& p = it->second;
+        if (p.frame_size != h.frame_size || p.got.size() != h.count) {
+            m_stats.dropped ++;
+            return index_pool::none;
+        }
+        // all but the last chunk carry the same payload at index times
+        // it, the last one ends the frame, so a frame completing with
+        // frame_size bytes has no gaps or overlaps.
+        bool last = h.index + 1 == h.count;
+        if (last ? (size_t)h.offset + payload != h.frame_size :
+            payload == 0 || (p.chunk_payload != 0 && payload != p.chunk_payload) ||
+            (size_t)h.offset != (size_t)h.index * payload) {
+            m_stats.dropped ++;
+            return index_pool::none;
+        }
+        if (p.got[h.index]) return index_pool::none;
+        p.got[h.index] = true;
+        if (!last) p.chunk_payload = payload;
+        p.bytes += payload;
+        memcpy(m_bufs[p.slot].get() + h.offset, (const uint8_t*)data + chunk_header::size, payload);
+        if (++ p.received < p.got.size()) return index_pool::none;
+        if (p.bytes != p.frame_size) {
+            m_pool.put(p.slot);
+            m_partials.erase(it);
+            m_stats.dropped ++;
+            return index_pool::none;
+        }
+
+        size_t slot = p.slot;
+        frame_len = p.frame_size;
+        m_partials.erase(it);
+        m_stats.completed ++;
+        return slot;
+    }
+
+    void reassembler::release(size_t slot) {
+        m_pool.put(slot);
+    }
+
+    reassembler::stats reassembler::get_stats() {
+        unique_lock<mutex> lock(m_mutex);
+        return m_stats;
+    }
+
+    void reassembler::expire(clock::time_point now) {
+        for (auto it = m_partials.begin(); it != m_partials.end(); ) {
+            if (it->second.deadline <= now) {
+                m_pool.put(it->second.slot);
+                it = m_partials.erase(it);
+                m_stats.expired ++;
+            } else {
+                it ++;
+            }
+        }
+    }
+
+    size_t reassembler::take_slot() {
+        size_t slot = m_pool.get(true);
+        if (slot == index_pool::none && !m_partials.empty()) {
+            auto oldest = m_partials.begin();
+            for (auto it = m_partials.begin(); it != m_partials.end(); it ++) {
+                if (it->second.deadline < oldest->second.deadline) oldest = it;
+            }
+            slot = oldest->second.slot;
+            m_partials.erase(oldest);
+            m_stats.evicted ++;
+        }
+        if (slot != index_pool::none && !m_bufs[slot]) {
+            m_bufs[slot].reset(new char[m_frame_size]);
+        }
+        return slot;
+    }
+}
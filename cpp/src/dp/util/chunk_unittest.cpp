@@ -0,0 +1,160 @@
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include "gtest/gtest.h"
+
+#include "dp/util/chunk.h"
+
+namespace dp {
+    using namespace std;
+
+    static vector<uint8_t> make_frame(size_t size) {
+        vector<uint8_t> frame(size);
+        for (size_t i = 0; i < size; i ++) frame[i] = (uint8_t)(i * 7);
+        return frame;
+    }
+
+    // returns the chunks of an encoded frame.
+    static vector<vector<uint8_t>> split(const vector<uint8_t>& out, size_t chunk_size) {
+        vector<vector<uint8_t>> chunks;
+        for (size_t off = 0; off < out.size(); off += chunk_size) {
+            size_t len = out.size() - off < chunk_size ? out.size() - off : chunk_size;
+            chunks.push_back(vector<uint8_t>(out.begin() + off, out.begin() + off + len));
+        }
+        return chunks;
+    }
+
+    TEST(ChunkTest, Header) {
+        chunk_header h;
+        h.frame = 0x01020304;
+        h.index = 2;
+        h.count = 3;
+        h.frame_size = 100000;
+        h.offset = 2760;
+        uint8_t buf[chunk_header::size];
+        h.encode(buf);
+        chunk_header d;
+        ASSERT_TRUE(chunk_header::decode(buf, sizeof(buf), d));
+        EXPECT_EQ(h.frame, d.frame);
+        EXPECT_EQ(h.index, d.index);
+        EXPECT_EQ(h.count, d.count);
+        EXPECT_EQ(h.frame_size, d.frame_size);
+        EXPECT_EQ(h.offset, d.offset);
+        EXPECT_FALSE(chunk_header::decode(buf, sizeof(buf) - 1, d));
+        uint8_t jpeg[chunk_header::size] = { 0xff, 0xd8 };
+        EXPECT_FALSE(chunk_header::decode(jpeg, sizeof(jpeg), d));
+    }
+
+    TEST(ChunkTest, StreamPrefix) {
+        uint8_t buf[max_stream_prefix];
+        EXPECT_EQ(2, encode_stream_prefix(1000, buf));
+        EXPECT_EQ(1000, *(uint16_t*)buf);
+        EXPECT_EQ(6, encode_stream_prefix(200000, buf));
+        EXPECT_EQ(0xffff, *(uint16_t*)buf);
+        uint32_t sz;
+        memcpy(&sz, buf + 2, sizeof(sz));
+        EXPECT_EQ(200000, sz);
+    }
+
+    TEST(ReassemblerTest, OutOfOrder) {
+        auto frame = make_frame(10000);
+        vector<uint8_t> out;
+        EXPECT_EQ(8, encode_chunks(7, frame.data(), frame.size(), 1400, out));
+        auto chunks = split(out, 1400);
+        ASSERT_EQ(8, chunks.size());
+
+        reassembler r(2, 0x10000);
+        size_t len = 0;
+        for (size_t i = chunks.size(); i > 1; i --) {
+            auto& c = chunks[i - 1];
+            EXPECT_EQ(index_pool::none, r.feed(1, c.data(), c.size(), len));
+        }
+        // duplicates are ignored.
+        EXPECT_EQ(index_pool::none, r.feed(1, chunks[3].data(), chunks[3].size(), len));
+        size_t slot = r.feed(1, chunks[0].data(), chunks[0].size(), len);
+        ASSERT_NE(index_pool::none, slot);
+        ASSERT_EQ(frame.size(), len);
+        EXPECT_EQ(0, memcmp(frame.data(), r.buf(slot), len));
+        r.release(slot);
+        EXPECT_EQ(1, r.get_stats().completed);
+    }
+
+    TEST(ReassemblerTest, Sources) {
+        auto frame1 = make_frame(3000), frame2 = make_frame(2000);
+        vector<uint8_t> out1, out2;
+        encode_chunks(1, frame1.data(), frame1.size(), 1400, out1);
+        encode_chunks(1, frame2.data(), frame2.size(), 1400, out2);
+        auto c1 = split(out1, 1400), c2 = split(out2, 1400);
+
+        reassembler r(2, 0x10000);
+        size_t len = 0;
+        EXPECT_EQ(index_pool::none, r.feed(1, c1[0].data(), c1[0].size(), len));
+        EXPECT_EQ(index_pool::none, r.feed(2, c2[0].data(), c2[0].size(), len));
+        EXPECT_EQ(index_pool::none, r.feed(1, c1[1].data(), c1[1].size(), len));
+        size_t s2 = r.feed(2, c2[1].data(), c2[1].size(), len);
+        ASSERT_NE(index_pool::none, s2);
+        EXPECT_EQ(frame2.size(), len);
+        size_t s1 = r.feed(1, c1[2].data(), c1[2].size(), len);
+        ASSERT_NE(index_pool::none, s1);
+        EXPECT_EQ(frame1.size(), len);
+        EXPECT_EQ(0, memcmp(frame1.data(), r.buf(s1), len));
+        EXPECT_NE(s1, s2);
+    }
+
+    TEST(ReassemblerTest, ExpireAndEvict) {
+        auto frame = make_frame(3000);
+        vector<uint8_t> out;
+        encode_chunks(1, frame.data(), frame.size(), 1400, out);
+        auto c = split(out, 1400);
+
+        reassembler r(1, 0x10000, chrono::milliseconds(20));
+        size_t len = 0;
+        EXPECT_EQ(index_pool::none, r.feed(1, c[0].data(), c[0].size(), len));
+        // the only slot goes to the newer frame.
+        EXPECT_EQ(index_pool::none, r.feed(2, c[0].data(), c[0].size(), len));
+        EXPECT_EQ(1, r.get_stats().evicted);
+        this_thread::sleep_for(chrono::milliseconds(30));
+        EXPECT_EQ(index_pool::none, r.feed(2, c[1].data(), c[1].size(), len));
+        EXPECT_EQ(1, r.get_stats().expired);
+
+        // a frame larger than a slot is dropped.
+        reassembler small(1, 1000);
+        EXPECT_EQ(index_pool::none, small.feed(1, c[0].data(), c[0].size(), len));
+        EXPECT_EQ(1, small.get_stats().dropped);
+    }
+
+    TEST(ReassemblerTest, Coverage) {
+        auto frame = make_frame(3000);
+        vector<uint8_t> out;
+        encode_chunks(1, frame.data(), frame.size(), 1400, out);
+        auto c = split(out, 1400);
+        ASSERT_EQ(3, c.size());
+
+        reassembler r(2, 0x10000);
+        size_t len = 0;
+        // a chunk overlapping the one before it is dropped.
+        auto moved = c[1];
+        chunk_header h;
+        ASSERT_TRUE(chunk_header::decode(moved.data(), moved.size(), h));
+        h.offset -= 100;
+        h.encode(moved.data());
+        EXPECT_EQ(index_pool::none, r.feed(1, c[0].data(), c[0].size(), len));
+        EXPECT_EQ(index_pool::none, r.feed(1, moved.data(), moved.size(), len));
+        EXPECT_EQ(1, r.get_stats().dropped);
+        EXPECT_EQ(index_pool::none, r.feed(1, c[2].data(), c[2].size(), len));
+        size_t slot = r.feed(1, c[1].data(), c[1].size(), len);
+        ASSERT_NE(index_pool::none, slot);
+        EXPECT_EQ(0, memcmp(frame.data(), r.buf(slot), len));
+        r.release(slot);
+
+        // a short chunk leaves a gap after it.
+        auto shorter = c[0];
+        shorter.resize(shorter.size() - 100);
+        EXPECT_EQ(index_pool::none, r.feed(2, shorter.data(), shorter.size(), len));
+        EXPECT_EQ(index_pool::none, r.feed(2, c[1].data(), c[1].size(), len));
+        EXPECT_EQ(index_pool::none, r.feed(2, c[2].data(), c[2].size(), len));
+        EXPECT_EQ(2, r.get_stats().dropped);
+        EXPECT_EQ(1, r.get_stats().completed);
+    }
+}
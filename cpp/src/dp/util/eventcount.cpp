@@ -0,0 +1,27 @@
+#include <unistd.h>
+#include <climits>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "dp/util/eventcount.h"
+
+namespace dp {
+    using namespace std;
+
+    static_assert(sizeof(atomic<uint32_t>) == sizeof(uint32_t),
+        "futex requires a plain 32-bit word");
+
+    void event_count::wait(uint32_t key) {
+        while (m_epoch.load(memory_order_acquire) == key) {
+            syscall(SYS_futex, (uint32_t*)&m_epoch, FUTEX_WAIT_PRIVATE, key, nullptr, nullptr, 0);
+        }
+        m_waiters.fetch_sub(1);
+    }
+
+    void event_count::notify(bool all) {
+        atomic_thread_fence(memory_order_seq_cst);
+        if (m_waiters.load(memory_order_relaxed) == 0) return;
+        m_epoch.fetch_add(1, memory_order_release);
+        syscall(SYS_futex, (uint32_t*)&m_epoch, FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1, nullptr, nullptr, 0);
+    }
+}
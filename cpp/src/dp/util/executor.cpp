@@ -0,0 +1,113 @@
+#include "dp/util/executor.h"
+
+namespace dp {
+    using namespace std;
+
+    struct worker_ref {
+        executor *owner;
+        size_t index;
+    };
+
+    static thread_local worker_ref _current = { nullptr, 0 };
+
+    executor::executor(size_t threads)
+    : m_inbox(inbox_size), m_next(0), m_pending(0), m_stopping(false) {
+        if (threads == 0) {
+            threads = thread::hardware_concurrency();
+            if (threads < 2) threads = 2;
+        }
+        for (size_t i = 0; i < threads; i ++) {
+            m_workers.push_back(move(unique_ptr<worker>(new worker())));
+        }
+        for (size_t i = 0; i < threads; i ++) {
+            m_workers[i]->thread = thread([this, i] { run(i); });
+        }
+    }
+
+    executor::~executor() {
+        m_stopping = true;
+        m_idle.notify_all();
+        for (auto& w : m_workers) {
+            w->thread.join();
+        }
+    }
+
+    void executor::submit(task&& t) {
+        // count the task before it becomes visible, so a worker
+        // which pops it never observes the counter going below zero.
+        m_pending.fetch_add(1);
+        if (_current.owner != this && m_inbox.try_put(move(t))) {
+            m_idle.notify_one();
+            return;
+        }
+        size_t index;
+        if (_current.owner == this) {
+            index = _current.index;
+        } else {
+            index = m_next.fetch_add(1) % m_workers.size();
+        }
+        {
+            auto& w = m_workers[index];
+            unique_lock<mutex> lock(w->mutex);
+            w->tasks.push_back(move(t));
+        }
+        m_idle.notify_one();
+    }
+
+    bool executor::pop(size_t index, task& t) {
+        {
+            auto& w = m_workers[index];
+            unique_lock<mutex> lock(w->mutex);
+            if (!w->tasks.empty()) {
+                t = move(w->tasks.back());
+                w->tasks.pop_back();
+                m_pending.fetch_sub(1);
+                return true;
+            }
+        }
+        if (m_inbox.try_get(t)) {
+            m_pending.fetch_sub(1);
+            return true;
+        }
+        for (size_t n = 1; n < m_workers.size(); n ++) {
+            auto& w = m_workers[(index + n) % m_workers.size()];
+            unique_lock<mutex> lock(w->mutex);
+            if (!w->tasks.empty()) {
+                t = move(w->tasks.front());
+                w->tasks.pop_front();
+                m_pending.fetch_sub(1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void executor::run(size_t index) {
+        _current.owner = this;
+        _current.index = index;
+        task t;
+        while (true) {
+            if (pop(index, t)) {
+                t();
+                t = nullptr;
+                continue;
+            }
+            auto key = m_idle.prepare_wait();
+            if (m_pending.load() > 0) {
+                m_idle.cancel_wait();
+                continue;
+            }
+            if (m_stopping.load()) {
+                m_idle.cancel_wait();
+                break;
+            }
+            m_idle.wait(key);
+        }
+        _current.owner = nullptr;
+    }
+
+    executor* executor::get() {
+        static executor _executor;
+        return &_executor;
+    }
+}
@@ -0,0 +1,109 @@
+#include <arpa/inet.h>
+#include <cstring>
+#include <algorithm>
+
+#include "dp/util/feedback.h"
+
+namespace dp {
+    using namespace std;
+
+    constexpr uint16_t rate_feedback::magic;
+    constexpr uint8_t rate_feedback::version;
+    constexpr size_t rate_feedback::size;
+
+    constexpr double rate_controller::default_target;
+    constexpr double rate_controller::default_min_fps;
+    constexpr double rate_controller::lift_ratio;
+    constexpr double rate_controller::raise_ratio;
+    constexpr int rate_controller::quality_step;
+    constexpr int rate_controller::min_quality;
+
+    static void put16(uint8_t *p, uint16_t v) {
+        v = htons(v);
+        memcpy(p, &v, sizeof(v));
+    }
+
+    static void put32(uint8_t *p, uint32_t v) {
+        v = htonl(v);
+        memcpy(p, &v, sizeof(v));
+    }
+
+    static uint16_t get16(const uint8_t *p) {
+        uint16_t v;
+        memcpy(&v, p, sizeof(v));
+        return ntohs(v);
+    }
+
+    static uint32_t get32(const uint8_t *p) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return ntohl(v);
+    }
+
+    void rate_feedback::encode(void *buf) const {
+        uint8_t *p = (uint8_t*)buf;
+        put16(p, magic);
+        p[2] = version;
+        p[3] = 0;
+        put32(p + 4, seq);
+        put32(p + 8, max_fps_milli);
+        p[12] = quality;
+        p[13] = load;
+        put16(p + 14, backlog);
+    }
+
+    bool rate_feedback::decode(const void *buf, size_t len, rate_feedback& fb) {
+        const uint8_t *p = (const uint8_t*)buf;
+        if (len < size || get16(p) != magic || p[2] != version) return false;
+        fb.seq = get32(p + 4);
+        fb.max_fps_milli = get32(p + 8);
+        fb.quality = p[12];
+        fb.load = p[13];
+        fb.backlog = get16(p + 14);
+        return fb.quality > 0 && fb.quality <= 100;
+    }
+
+    rate_controller::rate_controller(double target, double min_fps)
+    : m_target(target > 0 ? target : default_target),
+      m_min_fps(min_fps > 0 ? min_fps : default_min_fps) {
+    }
+
+    bool rate_controller::update(const string& source, double load, double interval_sec,
+        uint64_t frames, uint64_t lost, size_t backlog, rate_feedback& fb) {
+        auto& st = m_sources[source];
+        bool limited = st.fps > 0 || st.quality < 100;
+        double rate = interval_sec > 0 ? (double)frames / interval_sec : 0;
+        if (load > 1.0 || lost > 0) {
+            // the share of the producer which brings the load to target.
+            double fps = rate * m_target / max(load, m_target);
+            if (lost > 0 && interval_sec > 0) {
+                fps = min(fps, (double)(frames > lost ? frames - lost : 0) / interval_sec);
+            }
+            if (st.fps > 0) fps = min(fps, st.fps);
+            if (fps < m_min_fps) {
+                fps = m_min_fps;
+                st.quality = max(st.quality - quality_step, min_quality);
+            }
+            st.fps = fps;
+        } else if (load < m_target) {
+            // quality comes back before the rate does.
+            if (st.quality < 100) {
+                st.quality = min(st.quality + quality_step, 100);
+            } else if (st.fps > 0) {
+                st.fps *= raise_ratio;
+                if (st.fps >= rate * lift_ratio) st.fps = 0;
+            }
+        }
+
+        if (st.fps == 0 && st.quality == 100 && !limited) {
+            m_sources.erase(source);
+            return false;
+        }
+        fb.seq = ++ st.seq;
+        fb.max_fps_milli = (uint32_t)(st.fps * 1000);
+        fb.quality = (uint8_t)st.quality;
+        fb.load = (uint8_t)min(load * 100 + 0.5, 255.0);
+        fb.backlog = (uint16_t)min<uint64_t>(backlog + lost, 0xffff);
+        return true;
+    }
+}
@@ -0,0 +1,85 @@
+#include <cstring>
+#include "gtest/gtest.h"
+
+#include "dp/util/feedback.h"
+
+namespace dp {
+    using namespace std;
+
+    TEST(FeedbackTest, Encode) {
+        rate_feedback fb;
+        fb.seq = 0x01020304;
+        fb.max_fps_milli = 12500;
+        fb.quality = 70;
+        fb.load = 180;
+        fb.backlog = 3;
+        uint8_t buf[rate_feedback::size];
+        fb.encode(buf);
+        EXPECT_EQ(0x44, buf[0]);
+        EXPECT_EQ(0x46, buf[1]);
+        rate_feedback d;
+        ASSERT_TRUE(rate_feedback::decode(buf, sizeof(buf), d));
+        EXPECT_EQ(fb.seq, d.seq);
+        EXPECT_EQ(fb.max_fps_milli, d.max_fps_milli);
+        EXPECT_EQ(fb.quality, d.quality);
+        EXPECT_EQ(fb.load, d.load);
+        EXPECT_EQ(fb.backlog, d.backlog);
+
+        EXPECT_FALSE(rate_feedback::decode(buf, sizeof(buf) - 1, d));
+        buf[2] = 2;
+        EXPECT_FALSE(rate_feedback::decode(buf, sizeof(buf), d));
+    }
+
+    TEST(FeedbackTest, Controller) {
+        rate_controller ctl(0.8, 1);
+        rate_feedback fb;
+        // nothing to tell while the pipeline keeps up.
+        EXPECT_FALSE(ctl.update("cam", 0.5, 1, 30, 0, 0, fb));
+
+        // 30 fps at twice the capacity are cut to what brings it to 0.8.
+        ASSERT_TRUE(ctl.update("cam", 2, 1, 30, 0, 0, fb));
+        EXPECT_EQ(1, fb.seq);
+        EXPECT_EQ(12000, fb.max_fps_milli);
+        EXPECT_EQ(100, fb.quality);
+        EXPECT_EQ(200, fb.load);
+
+        // lost frames cut it down to what got through.
+        ASSERT_TRUE(ctl.update("cam", 0.9, 1, 12, 4, 1, fb));
+        EXPECT_EQ(2, fb.seq);
+        EXPECT_EQ(8000, fb.max_fps_milli);
+        EXPECT_EQ(5, fb.backlog);
+
+        // held between target and full load.
+        ASSERT_TRUE(ctl.update("cam", 0.9, 1, 8, 0, 0, fb));
+        EXPECT_EQ(8000, fb.max_fps_milli);
+
+        // raised with spare capacity, and lifted once it is twice the
+        // rate sent, which is told once.
+        ASSERT_TRUE(ctl.update("cam", 0.5, 1, 8, 0, 0, fb));
+        EXPECT_EQ(10000, fb.max_fps_milli);
+        ASSERT_TRUE(ctl.update("cam", 0.5, 1, 5, 0, 0, fb));
+        EXPECT_EQ(0, fb.max_fps_milli);
+        EXPECT_EQ(100, fb.quality);
+        EXPECT_FALSE(ctl.update("cam", 0.5, 1, 5, 0, 0, fb));
+    }
+
+    TEST(FeedbackTest, Quality) {
+        rate_controller ctl(0.8, 2);
+        rate_feedback fb;
+        ASSERT_TRUE(ctl.update("cam", 4, 1, 2, 0, 0, fb));
+        EXPECT_EQ(2000, fb.max_fps_milli);
+        EXPECT_EQ(90, fb.quality);
+        ASSERT_TRUE(ctl.update("cam", 4, 1, 2, 0, 0, fb));
+        EXPECT_EQ(80, fb.quality);
+        for (int i = 0; i < 10; i ++) ctl.update("cam", 4, 1, 2, 0, 0, fb);
+        EXPECT_EQ(30, fb.quality);
+
+        // quality recovers before the rate.
+        ASSERT_TRUE(ctl.update("cam", 0.5, 1, 2, 0, 0, fb));
+        EXPECT_EQ(40, fb.quality);
+        EXPECT_EQ(2000, fb.max_fps_milli);
+
+        // other sources are on their own.
+        EXPECT_FALSE(ctl.update("other", 0.5, 1, 30, 0, 0, fb));
+    }
+}
@@ -0,0 +1,57 @@
+// queue_bench measures the throughput of ring against the mutex
+// based queue with several producers and consumers contending.
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <gflags/gflags.h>
+
+#include "dp/util/queue.h"
+
+DEFINE_int32(producers, 4, "producer threads");
+DEFINE_int32(consumers, 4, "consumer threads");
+DEFINE_int32(items, 1000000, "items put by each producer");
+DEFINE_int32(capacity, 1024, "ring capacity");
+
+using namespace std;
+
+template<typename Put, typename Get>
+static double run(Put put, Get get) {
+    vector<thread> threads;
+    auto start = chrono::steady_clock::now();
+    for (int p = 0; p < FLAGS_producers; p ++) {
+        threads.push_back(thread([put] {
+            for (int i = 0; i < FLAGS_items; i ++) put(i);
+        }));
+    }
+    long total = (long)FLAGS_producers * FLAGS_items;
+    for (int c = 0; c < FLAGS_consumers; c ++) {
+        long n = total / FLAGS_consumers + (c < total % FLAGS_consumers ? 1 : 0);
+        threads.push_back(thread([get, n] {
+            for (long i = 0; i < n; i ++) get();
+        }));
+    }
+    for (auto& t : threads) t.join();
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    return total / elapsed.count();
+}
+
+int main(int argc, char* argv[]) {
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+    dp::queue<int> q;
+    double mutex_rate = run(
+        [&q] (int v) { q.put(v); },
+        [&q] { q.get(); });
+
+    dp::ring<int> r(FLAGS_capacity);
+    double ring_rate = run(
+        [&r] (int v) { r.put(v); },
+        [&r] { int v; r.get(v); });
+
+    cout << FLAGS_producers << " producers, " << FLAGS_consumers << " consumers" << endl;
+    cout << "queue: " << (long)mutex_rate << " items/s" << endl;
+    cout << "ring:  " << (long)ring_rate << " items/s" << endl;
+    return 0;
+}
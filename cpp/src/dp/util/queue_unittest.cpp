@@ -0,0 +1,183 @@
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include "gtest/gtest.h"
+
+#include "dp/util/queue.h"
+#include "dp/util/pool.h"
+#include "dp/util/fair_queue.h"
+
+namespace dp {
+    using namespace std;
+
+    TEST(RingTest, PutGet) {
+        ring<string> r(3);
+        EXPECT_EQ(4, r.capacity());
+        for (int i = 0; i < 4; i ++) {
+            EXPECT_TRUE(r.try_put(to_string(i)));
+        }
+        EXPECT_FALSE(r.try_put("full"));
+        EXPECT_EQ(4, r.size());
+        string s;
+        for (int i = 0; i < 4; i ++) {
+            ASSERT_TRUE(r.try_get(s));
+            EXPECT_EQ(to_string(i), s);
+        }
+        EXPECT_FALSE(r.try_get(s));
+        EXPECT_EQ(0, r.size());
+    }
+
+    TEST(RingTest, Batch) {
+        ring<int> r(8);
+        int in[10] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+        EXPECT_EQ(8, r.put_n(in, 10));
+        EXPECT_EQ(0, r.put_n(in + 8, 2));
+        int out[5];
+        EXPECT_EQ(5, r.get_n(out, 5));
+        for (int i = 0; i < 5; i ++) EXPECT_EQ(i, out[i]);
+        EXPECT_EQ(2, r.put_n(in + 8, 2));
+        EXPECT_EQ(5, r.get_n(out, 5));
+        EXPECT_EQ(5, out[0]);
+        EXPECT_EQ(9, out[4]);
+        EXPECT_EQ(0, r.get_n(out, 5));
+    }
+
+    TEST(RingTest, Close) {
+        ring<int> r(2);
+        EXPECT_TRUE(r.put(1));
+        thread consumer([&r] {
+            int v;
+            EXPECT_TRUE(r.get(v));
+            EXPECT_EQ(1, v);
+            EXPECT_FALSE(r.get(v));
+        });
+        r.close();
+        consumer.join();
+        EXPECT_TRUE(r.closed());
+        EXPECT_FALSE(r.put(2));
+    }
+
+    TEST(RingTest, MultiProducerMultiConsumer) {
+        const int producers = 4, consumers = 4, count = 20000;
+        ring<int> r(16);
+        atomic<long> sum(0);
+        atomic<int> got(0);
+        vector<thread> threads;
+        for (int p = 0; p < producers; p ++) {
+            threads.push_back(thread([&r] {
+                for (int i = 1; i <= count; i ++) r.put(i);
+            }));
+        }
+        for (int c = 0; c < consumers; c ++) {
+            threads.push_back(thread([&] {
+                int v;
+                while (r.get(v)) {
+                    sum += v;
+                    got ++;
+                }
+            }));
+        }
+        for (int p = 0; p < producers; p ++) threads[p].join();
+        r.close();
+        for (size_t i = producers; i < threads.size(); i ++) threads[i].join();
+        EXPECT_EQ(producers * count, got.load());
+        EXPECT_EQ((long)producers * count * (count + 1) / 2, sum.load());
+    }
+
+    TEST(IndexPoolTest, GetPut) {
+        index_pool pool(3);
+        EXPECT_EQ(3, pool.size());
+        EXPECT_EQ(3, pool.available());
+        size_t a = pool.get(), b = pool.get(), c = pool.get();
+        EXPECT_NE(a, b);
+        EXPECT_NE(b, c);
+        EXPECT_EQ(index_pool::none, pool.get(true));
+        pool.put(b);
+        EXPECT_EQ(b, pool.get(true));
+    }
+
+    TEST(FairQueueTest, RoundRobin) {
+        fair_queue<string> q(4);
+        string d;
+        for (int i = 0; i < 4; i ++) {
+            EXPECT_FALSE(q.put("a", "a" + to_string(i), d));
+        }
+        EXPECT_FALSE(q.put("b", "b0", d));
+        EXPECT_FALSE(q.put("c", "c0", d));
+        EXPECT_FALSE(q.put("b", "b1", d));
+        EXPECT_EQ(7, q.size());
+        vector<string> order;
+        string v;
+        while (q.try_get(v)) order.push_back(v);
+        EXPECT_EQ(vector<string>({"a0", "b0", "c0", "a1", "b1", "a2", "a3"}), order);
+        EXPECT_EQ(0, q.size());
+    }
+
+    TEST(FairQueueTest, Weights) {
+        fair_queue<string> q(4);
+        q.set_weight("a", 3);
+        string d;
+        for (int i = 0; i < 4; i ++) {
+            q.put("a", "a" + to_string(i), d);
+            q.put("b", "b" + to_string(i), d);
+        }
+        vector<string> order;
+        string v;
+        while (q.try_get(v)) order.push_back(v);
+        EXPECT_EQ(vector<string>({"a0", "a1", "a2", "b0", "a3", "b1", "b2", "b3"}), order);
+    }
+
+    TEST(FairQueueTest, Coalesce) {
+        fair_queue<string> q;
+        string d;
+        EXPECT_FALSE(q.put("a", "a0", d));
+        EXPECT_TRUE(q.put("a", "a1", d));
+        EXPECT_EQ("a0", d);
+        EXPECT_TRUE(q.put("a", "a2", d));
+        EXPECT_EQ("a1", d);
+        q.put("b", "b0", d);
+        EXPECT_EQ(2, q.size());
+        string v;
+        ASSERT_TRUE(q.try_get(v));
+        EXPECT_EQ("a2", v);
+        ASSERT_TRUE(q.try_get(v));
+        EXPECT_EQ("b0", v);
+        EXPECT_EQ(2, q.get_stats().displaced);
+        EXPECT_EQ(2, q.get_stats().max_size);
+    }
+
+    TEST(FairQueueTest, Evict) {
+        fair_queue<string> q(4);
+        string d, v;
+        q.put("a", "a0", d);
+        q.put("b", "b0", d);
+        q.put("b", "b1", d);
+        ASSERT_TRUE(q.evict(v));
+        EXPECT_EQ("b0", v);
+        ASSERT_TRUE(q.evict(v));
+        EXPECT_TRUE(v == "a0" || v == "b1");
+        ASSERT_TRUE(q.evict(v));
+        EXPECT_FALSE(q.evict(v));
+        EXPECT_FALSE(q.try_get(v));
+        EXPECT_EQ(3, q.get_stats().evicted);
+        // an evicted key is no longer in turn.
+        q.put("c", "c0", d);
+        ASSERT_TRUE(q.try_get(v));
+        EXPECT_EQ("c0", v);
+    }
+
+    TEST(FairQueueTest, Close) {
+        fair_queue<int> q;
+        int d;
+        thread consumer([&q] {
+            int v, n = 0;
+            while (q.get(v)) n ++;
+            EXPECT_EQ(1, n);
+        });
+        q.put("a", 1, d);
+        this_thread::sleep_for(chrono::milliseconds(10));
+        q.close();
+        consumer.join();
+    }
+}
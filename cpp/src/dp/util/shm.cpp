@@ -0,0 +1,381 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+
+#include "dp/util/shm.h"
+#include "dp/util/error.h"
+
+namespace dp {
+    using namespace std;
+
+    constexpr size_t shm_channel::none;
+    constexpr size_t shm_channel::max_slots;
+    constexpr size_t shm_channel::max_slot_size;
+    constexpr size_t shm_channel::results_size;
+
+    static constexpr uint32_t shm_magic = 0x44505348;
+    static constexpr uint32_t shm_version = 1;
+    static constexpr size_t cache_line = 64;
+    static constexpr size_t page_size = 4096;
+
+    // the first message on the socket, from the producer asking for
+    // slots, then back from the consumer with what it granted.
+    struct hello {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t slots;
+        uint32_t slot_size;
+        char name[32];
+    };
+
+    // the positions only grow, and wrap around with the ring sizes,
+    // which are powers of 2. Each is written by one end only.
+    struct shm_channel::header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t slots;
+        uint32_t slot_size;
+        alignas(cache_line) atomic<uint32_t> ready_head;
+        alignas(cache_line) atomic<uint32_t> ready_tail;
+        alignas(cache_line) atomic<uint32_t> free_head;
+        alignas(cache_line) atomic<uint32_t> free_tail;
+        alignas(cache_line) atomic<uint32_t> results_head;
+        alignas(cache_line) atomic<uint32_t> results_tail;
+    };
+
+    static size_t align_up(size_t v, size_t align) {
+        return (v + align - 1) / align * align;
+    }
+
+    // header, ready ring of shm_frame, free ring of slot numbers,
+    // results ring, then the slots from a page boundary.
+    struct shm_layout {
+        size_t ready, free, results, slots, total;
+
+        shm_layout(size_t header_size, size_t slots_count, size_t slot_size) {
+            ready = align_up(header_size, cache_line);
+            free = ready + sizeof(shm_frame) * slots_count;
+            results = align_up(free + sizeof(uint32_t) * slots_count, cache_line);
+            slots = align_up(results + shm_channel::results_size, page_size);
+            total = slots + slot_size * slots_count;
+        }
+    };
+
+    static void signal(int fd) {
+        uint64_t one = 1;
+        if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            throw runtime_error(errmsg("eventfd write"));
+        }
+    }
+
+    static void send_fds(int sock, const hello& h, const int* fds, size_t count) {
+        iovec iov;
+        iov.iov_base = const_cast<hello*>(&h);
+        iov.iov_len = sizeof(h);
+        char ctrl[CMSG_SPACE(sizeof(int) * 3)];
+        memset(ctrl, 0, sizeof(ctrl));
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        if (count > 0) {
+            msg.msg_control = ctrl;
+            msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+            auto cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+            memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+        }
+        if (sendmsg(sock, &msg, MSG_NOSIGNAL) != (ssize_t)sizeof(h)) {
+            throw runtime_error(errmsg("shm sendmsg"));
+        }
+    }
+
+    // receives a hello, and the fds passed along into fds.
+    static size_t recv_fds(int sock, hello& h, int* fds, size_t count) {
+        iovec iov;
+        iov.iov_base = &h;
+        iov.iov_len = sizeof(h);
+        char ctrl[CMSG_SPACE(sizeof(int) * 3)];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctrl;
+        msg.msg_controllen = sizeof(ctrl);
+        ssize_t r = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (r < 0) {
+            throw runtime_error(errmsg("shm recvmsg"));
+        }
+        size_t n = 0;
+        for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+            size_t got = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < got; i ++) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + sizeof(int) * i, sizeof(fd));
+                if (n < count) fds[n ++] = fd; else close(fd);
+            }
+        }
+        if ((size_t)r != sizeof(h) || h.magic != shm_magic || h.version != shm_version) {
+            for (size_t i = 0; i < n; i ++) close(fds[i]);
+            throw runtime_error("shm: invalid hello");
+        }
+        return n;
+    }
+
+    shm_channel::shm_channel()
+    : m_sock(-1), m_memfd(-1), m_ready_fd(-1), m_done_fd(-1),
+      m_map(MAP_FAILED), m_map_len(0), m_header(nullptr), m_ready(nullptr), m_free(nullptr),
+      m_results(nullptr), m_slot_base(nullptr), m_slots(0), m_slot_size(0) {
+    }
+
+    shm_channel::~shm_channel() {
+        if (m_map != MAP_FAILED) munmap(m_map, m_map_len);
+        for (int fd : { m_sock, m_memfd, m_ready_fd, m_done_fd }) {
+            if (fd >= 0) close(fd);
+        }
+    }
+
+    shared_ptr<shm_channel> shm_channel::connect(const string& path,
+        size_t slots, size_t slot_size, const string& name) {
+        shared_ptr<shm_channel> ch(new shm_channel());
+        sockaddr_un sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        if (path.length() >= sizeof(sa.sun_path)) {
+            throw invalid_argument("shm path too long: " + path);
+        }
+        strcpy(sa.sun_path, path.c_str());
+        ch->m_sock = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (ch->m_sock < 0) {
+            throw runtime_error(errmsg("socket"));
+        }
+        if (::connect(ch->m_sock, (sockaddr*)&sa, sizeof(sa)) < 0) {
+            throw runtime_error(errmsg("connect " + path));
+        }
+
+        hello h;
+        memset(&h, 0, sizeof(h));
+        h.magic = shm_magic;
+        h.version = shm_version;
+        h.slots = (uint32_t)min(slots, max_slots);
+        h.slot_size = (uint32_t)min(slot_size, max_slot_size);
+        strncpy(h.name, name.c_str(), sizeof(h.name) - 1);
+        send_fds(ch->m_sock, h, nullptr, 0);
+
+        int fds[3];
+        if (recv_fds(ch->m_sock, h, fds, 3) != 3) {
+            throw runtime_error("shm: missing fds");
+        }
+        ch->m_memfd = fds[0];
+        ch->m_ready_fd = fds[1];
+        ch->m_done_fd = fds[2];
+        ch->m_name = name;
+        ch->m_slots = h.slots;
+        ch->m_slot_size = h.slot_size;
+        ch->map(false);
+        return ch;
+    }
+
+    shared_ptr<shm_channel> shm_channel::accept(int sock,
+        size_t slots_limit, size_t slot_size_limit) {
+        shared_ptr<shm_channel> ch(new shm_channel());
+        ch->m_sock = sock;
+        // a producer gone quiet doesn't hold up the caller.
+        timeval tv = { 1, 0 };
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        hello h;
+        recv_fds(sock, h, nullptr, 0);
+
+        size_t slots = 1;
+        while (slots < h.slots && slots < min(slots_limit, max_slots)) slots <<= 1;
+        size_t slot_size = align_up(max((size_t)h.slot_size, (size_t)1), cache_line);
+        slot_size = min(slot_size, min(slot_size_limit, max_slot_size));
+        ch->m_name = string(h.name, strnlen(h.name, sizeof(h.name)));
+        ch->m_slots = slots;
+        ch->m_slot_size = slot_size;
+
+        ch->m_memfd = memfd_create("dp-shm", MFD_CLOEXEC);
+        if (ch->m_memfd < 0) {
+            throw runtime_error(errmsg("memfd_create"));
+        }
+        shm_layout layout(sizeof(header), slots, slot_size);
+        if (ftruncate(ch->m_memfd, (off_t)layout.total) < 0) {
+            throw runtime_error(errmsg("ftruncate"));
+        }
+        ch->m_ready_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        ch->m_done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (ch->m_ready_fd < 0 || ch->m_done_fd < 0) {
+            throw runtime_error(errmsg("eventfd"));
+        }
+        ch->map(true);
+
+        h.slots = (uint32_t)slots;
+        h.slot_size = (uint32_t)slot_size;
+        int fds[3] = { ch->m_memfd, ch->m_ready_fd, ch->m_done_fd };
+        send_fds(sock, h, fds, 3);
+        return ch;
+    }
+
+    void shm_channel::map(bool init) {
+        shm_layout layout(sizeof(header), m_slots, m_slot_size);
+        struct stat st;
+        if (fstat(m_memfd, &st) < 0) {
+            throw runtime_error(errmsg("shm fstat"));
+        }
+        if ((size_t)st.st_size < layout.total) {
+            throw runtime_error("shm: mapping too small");
+        }
+        m_map_len = layout.total;
+        m_map = mmap(nullptr, m_map_len, PROT_READ | PROT_WRITE, MAP_SHARED, m_memfd, 0);
+        if (m_map == MAP_FAILED) {
+            throw runtime_error(errmsg("shm mmap"));
+        }
+        m_header = (header*)m_map;
+        m_ready = (shm_frame*)((char*)m_map + layout.ready);
+        m_free = (uint32_t*)((char*)m_map + layout.free);
+        m_results = (char*)m_map + layout.results;
+        m_slot_base = (char*)m_map + layout.slots;
+        if (init) {
+            m_header->magic = shm_magic;
+            m_header->version = shm_version;
+            m_header->slots = (uint32_t)m_slots;
+            m_header->slot_size = (uint32_t)m_slot_size;
+            // all slots start free, with the producer.
+            for (size_t i = 0; i < m_slots; i ++) m_free[i] = (uint32_t)i;
+            m_header->ready_head = 0;
+            m_header->ready_tail = 0;
+            m_header->free_head = (uint32_t)m_slots;
+            m_header->free_tail = 0;
+            m_header->results_head = 0;
+            m_header->results_tail = 0;
+        } else if (m_header->magic != shm_magic || m_header->version != shm_version ||
+            m_header->slots != m_slots || m_header->slot_size != m_slot_size) {
+            throw runtime_error("shm: invalid header");
+        }
+    }
+
+    void* shm_channel::slot(size_t index) const {
+        return m_slot_base + m_slot_size * index;
+    }
+
+    void shm_channel::clear(int fd) {
+        uint64_t val;
+        while (read(fd, &val, sizeof(val)) > 0) { }
+    }
+
+    size_t shm_channel::acquire() {
+        uint32_t tail = m_header->free_tail.load(memory_order_relaxed);
+        if (tail == m_header->free_head.load(memory_order_acquire)) return none;
+        size_t slot = m_free[tail & (m_slots - 1)];
+        m_header->free_tail.store(tail + 1, memory_order_release);
+        return slot < m_slots ? slot : none;
+    }
+
+    void shm_channel::publish(const shm_frame& frame) {
+        uint32_t head = m_header->ready_head.load(memory_order_relaxed);
+        m_ready[head & (m_slots - 1)] = frame;
+        m_header->ready_head.store(head + 1, memory_order_release);
+        signal(m_ready_fd);
+    }
+
+    bool shm_channel::wait(int timeout_ms) {
+        pollfd pfd;
+        pfd.fd = m_done_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int r = poll(&pfd, 1, timeout_ms);
+        if (r <= 0) return false;
+        clear(m_done_fd);
+        return true;
+    }
+
+    static void ring_copy(char *ring, size_t size, uint32_t pos, const void* data, size_t len) {
+        size_t at = pos & (size - 1), first = min(len, size - at);
+        memcpy(ring + at, data, first);
+        memcpy(ring, (const char*)data + first, len - first);
+    }
+
+    static void ring_read(const char *ring, size_t size, uint32_t pos, void* data, size_t len) {
+        size_t at = pos & (size - 1), first = min(len, size - at);
+        memcpy(data, ring + at, first);
+        memcpy((char*)data + first, ring, len - first);
+    }
+
+    bool shm_channel::take_result(string& msg) {
+        uint32_t tail = m_header->results_tail.load(memory_order_relaxed);
+        uint32_t head = m_header->results_head.load(memory_order_acquire);
+        if (head - tail < sizeof(uint32_t)) return false;
+        uint32_t len;
+        ring_read(m_results, results_size, tail, &len, sizeof(len));
+        if (len > head - tail - sizeof(len)) return false;
+        msg.resize(len);
+        if (len > 0) ring_read(m_results, results_size, tail + sizeof(len), &msg[0], len);
+        m_header->results_tail.store(tail + sizeof(len) + len, memory_order_release);
+        return true;
+    }
+
+    bool shm_channel::next(shm_frame& frame) {
+        while (true) {
+            uint32_t tail = m_header->ready_tail.load(memory_order_relaxed);
+            uint32_t head = m_header->ready_head.load(memory_order_acquire);
+            if (tail == head) return false;
+            if (head - tail > m_slots) {
+                // never more published than slots, skips what's broken.
+                m_header->ready_tail.store(head, memory_order_release);
+                return false;
+            }
+            frame = m_ready[tail & (m_slots - 1)];
+            m_header->ready_tail.store(tail + 1, memory_order_release);
+            // the producer is another process, so nothing it wrote is trusted.
+            if (frame.slot >= m_slots) continue;
+            bool valid = frame.len > 0 && frame.len <= m_slot_size;
+            if (valid && frame.fmt == shm_frame::raw) {
+                valid = frame.rows > 0 && frame.cols > 0 &&
+                    (uint64_t)frame.step * (uint64_t)frame.rows <= frame.len;
+            } else if (frame.fmt != shm_frame::encoded) {
+                valid = false;
+            }
+            if (valid) return true;
+            release(frame.slot);
+        }
+    }
+
+    void shm_channel::release(size_t slot) {
+        {
+            lock_guard<mutex> lock(m_mutex);
+            uint32_t head = m_header->free_head.load(memory_order_relaxed);
+            m_free[head & (m_slots - 1)] = (uint32_t)slot;
+            m_header->free_head.store(head + 1, memory_order_release);
+        }
+        signal(m_done_fd);
+    }
+
+    bool shm_channel::put_result(const void* data, size_t len) {
+        {
+            lock_guard<mutex> lock(m_mutex);
+            uint32_t head = m_header->results_head.load(memory_order_relaxed);
+            uint32_t tail = m_header->results_tail.load(memory_order_acquire);
+            size_t used = head - tail;
+            if (used > results_size || sizeof(uint32_t) + len > results_size - used) return false;
+            uint32_t len32 = (uint32_t)len;
+            ring_copy(m_results, results_size, head, &len32, sizeof(len32));
+            ring_copy(m_results, results_size, head + sizeof(len32), data, len);
+            m_header->results_head.store(head + sizeof(len32) + (uint32_t)len, memory_order_release);
+        }
+        signal(m_done_fd);
+        return true;
+    }
+}
@@ -0,0 +1,135 @@
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string>
+#include <thread>
+#include <cstring>
+#include "gtest/gtest.h"
+
+#include "dp/util/shm.h"
+
+namespace dp {
+    using namespace std;
+
+    // connects a producer and a consumer through a listening socket.
+    static void connect_pair(size_t slots, size_t slot_size,
+        shared_ptr<shm_channel>& producer, shared_ptr<shm_channel>& consumer) {
+        string path = "/tmp/dp-shm-test-" + to_string(getpid());
+        unlink(path.c_str());
+        int listener = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+        ASSERT_GE(listener, 0);
+        sockaddr_un sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        strcpy(sa.sun_path, path.c_str());
+        ASSERT_EQ(0, bind(listener, (sockaddr*)&sa, sizeof(sa)));
+        ASSERT_EQ(0, listen(listener, 1));
+        thread th([&] {
+            consumer = shm_channel::accept(::accept(listener, nullptr, nullptr), 8, 1 << 20);
+        });
+        producer = shm_channel::connect(path, slots, slot_size, "cam");
+        th.join();
+        close(listener);
+        unlink(path.c_str());
+    }
+
+    TEST(ShmTest, Handshake) {
+        shared_ptr<shm_channel> p, c;
+        connect_pair(3, 1000, p, c);
+        ASSERT_TRUE(p && c);
+        EXPECT_EQ(4, p->slots());
+        EXPECT_EQ(1024, p->slot_size());
+        EXPECT_EQ(4, c->slots());
+        EXPECT_EQ(1024, c->slot_size());
+        EXPECT_EQ("cam", c->name());
+
+        // limited by the consumer.
+        connect_pair(100, 8 << 20, p, c);
+        EXPECT_EQ(8, p->slots());
+        EXPECT_EQ(1 << 20, p->slot_size());
+    }
+
+    TEST(ShmTest, Frames) {
+        shared_ptr<shm_channel> p, c;
+        connect_pair(4, 256, p, c);
+        for (int round = 0; round < 3; round ++) {
+            for (uint32_t i = 0; i < 4; i ++) {
+                size_t slot = p->acquire();
+                ASSERT_NE(shm_channel::none, slot);
+                sprintf((char*)p->slot(slot), "frame %d.%u", round, i);
+                shm_frame f;
+                memset(&f, 0, sizeof(f));
+                f.slot = (uint32_t)slot;
+                f.len = 16;
+                f.fmt = shm_frame::encoded;
+                f.seq = i + 1;
+                p->publish(f);
+            }
+            EXPECT_EQ(shm_channel::none, p->acquire());
+            EXPECT_FALSE(p->wait(0));
+            for (uint32_t i = 0; i < 4; i ++) {
+                shm_frame f;
+                ASSERT_TRUE(c->next(f));
+                EXPECT_EQ(i + 1, f.seq);
+                char expected[32];
+                sprintf(expected, "frame %d.%u", round, i);
+                EXPECT_STREQ(expected, (const char*)c->slot(f.slot));
+                c->release(f.slot);
+            }
+            shm_frame f;
+            EXPECT_FALSE(c->next(f));
+            EXPECT_TRUE(p->wait(0));
+        }
+    }
+
+    TEST(ShmTest, InvalidFrames) {
+        shared_ptr<shm_channel> p, c;
+        connect_pair(2, 256, p, c);
+        size_t slot = p->acquire();
+        shm_frame f;
+        memset(&f, 0, sizeof(f));
+        f.slot = 7;
+        f.len = 10;
+        p->publish(f);
+        f.slot = (uint32_t)slot;
+        f.len = 1000;
+        p->publish(f);
+        EXPECT_FALSE(c->next(f));
+        // an invalid frame in a valid slot gives it back.
+        EXPECT_NE(shm_channel::none, p->acquire());
+        EXPECT_NE(shm_channel::none, p->acquire());
+        EXPECT_EQ(shm_channel::none, p->acquire());
+
+        f.slot = (uint32_t)slot;
+        f.len = 100;
+        f.fmt = shm_frame::raw;
+        f.rows = 10;
+        f.cols = 10;
+        f.step = 30;
+        p->publish(f);
+        EXPECT_FALSE(c->next(f));
+        EXPECT_EQ(slot, p->acquire());
+    }
+
+    TEST(ShmTest, Results) {
+        shared_ptr<shm_channel> p, c;
+        connect_pair(1, 64, p, c);
+        string msg;
+        EXPECT_FALSE(p->take_result(msg));
+        string big(shm_channel::results_size / 3, 'x');
+        for (int i = 0; i < 10; i ++) {
+            big[0] = (char)('0' + i);
+            ASSERT_TRUE(c->put_result(big.data(), big.size()));
+            ASSERT_TRUE(c->put_result(big.data(), big.size()));
+            EXPECT_FALSE(c->put_result(big.data(), big.size()));
+            for (int n = 0; n < 2; n ++) {
+                ASSERT_TRUE(p->take_result(msg));
+                EXPECT_EQ(big, msg);
+            }
+            EXPECT_FALSE(p->take_result(msg));
+        }
+        ASSERT_TRUE(c->put_result("", 0));
+        ASSERT_TRUE(p->take_result(msg));
+        EXPECT_TRUE(msg.empty());
+    }
+}
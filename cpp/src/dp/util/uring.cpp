@@ -0,0 +1,445 @@
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+#include <stdexcept>
+
+#include "dp/util/uring.h"
+#include "dp/util/error.h"
+
+namespace dp {
+    using namespace std;
+
+    static int io_uring_setup(unsigned entries, io_uring_params *p) {
+        return (int)syscall(__NR_io_uring_setup, entries, p);
+    }
+
+    static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+        return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+    }
+
+    static int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+        return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+    }
+
+    struct uring::op {
+        handler fn;
+        bool multishot;
+        msghdr msg;
+        sockaddr_in addr;
+        vector<iovec> iov;
+        __kernel_timespec ts;
+
+        op(handler&& f) : fn(move(f)), multishot(false) {
+            memset(&msg, 0, sizeof(msg));
+            memset(&addr, 0, sizeof(addr));
+        }
+    };
+
+    struct uring::sq_ring {
+        void *ptr;
+        size_t size;
+        unsigned *head, *tail, *array;
+        unsigned mask, entries;
+    };
+
+    struct uring::cq_ring {
+        void *ptr;
+        size_t size;
+        unsigned *head, *tail;
+        io_uring_cqe *cqes;
+        unsigned mask;
+    };
+
+    uring::uring(unsigned entries)
+    : m_fd(-1), m_sqes(nullptr), m_sqes_size(0), m_to_submit(0),
+      m_next_op(1), m_event_fd(-1), m_stopping(false) {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        m_fd = io_uring_setup(entries, &p);
+        if (m_fd < 0) {
+            throw runtime_error(errmsg("io_uring_setup"));
+        }
+
+        m_sq.reset(new sq_ring());
+        m_cq.reset(new cq_ring());
+        m_sq->size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        m_cq->size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap && m_cq->size > m_sq->size) m_sq->size = m_cq->size;
+        m_sq->ptr = mmap(nullptr, m_sq->size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+        if (m_sq->ptr == MAP_FAILED) {
+            m_sq->ptr = nullptr;
+            close(m_fd);
+            throw runtime_error(errmsg("mmap sq ring"));
+        }
+        if (single_mmap) {
+            m_cq->ptr = m_sq->ptr;
+        } else {
+            m_cq->ptr = mmap(nullptr, m_cq->size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+            if (m_cq->ptr == MAP_FAILED) {
+                munmap(m_sq->ptr, m_sq->size);
+                close(m_fd);
+                throw runtime_error(errmsg("mmap cq ring"));
+            }
+        }
+        m_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = (io_uring_sqe*)mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+        if (m_sqes == MAP_FAILED) {
+            if (m_cq->ptr != m_sq->ptr) munmap(m_cq->ptr, m_cq->size);
+            munmap(m_sq->ptr, m_sq->size);
+            close(m_fd);
+            throw runtime_error(errmsg("mmap sqes"));
+        }
+
+        char *sq = (char*)m_sq->ptr;
+        m_sq->head = (unsigned*)(sq + p.sq_off.head);
+        m_sq->tail = (unsigned*)(sq + p.sq_off.tail);
+        m_sq->array = (unsigned*)(sq + p.sq_off.array);
+        m_sq->mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+        m_sq->entries = *(unsigned*)(sq + p.sq_off.ring_entries);
+        char *cq = (char*)m_cq->ptr;
+        m_cq->head = (unsigned*)(cq + p.cq_off.head);
+        m_cq->tail = (unsigned*)(cq + p.cq_off.tail);
+        m_cq->cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+        m_cq->mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+
+        m_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (m_event_fd < 0) {
+            munmap(m_sqes, m_sqes_size);
+            if (m_cq->ptr != m_sq->ptr) munmap(m_cq->ptr, m_cq->size);
+            munmap(m_sq->ptr, m_sq->size);
+            close(m_fd);
+            throw runtime_error(errmsg("eventfd"));
+        }
+        arm_wakeup();
+    }
+
+    uring::~uring() {
+        // unregisters the buffer rings while the uring is still open.
+        m_groups.clear();
+        close(m_fd);
+        munmap(m_sqes, m_sqes_size);
+        if (m_cq->ptr != m_sq->ptr) munmap(m_cq->ptr, m_cq->size);
+        munmap(m_sq->ptr, m_sq->size);
+        close(m_event_fd);
+    }
+
+    bool uring::supported() {
+        static bool _supported = [] {
+            io_uring_params p;
+            memset(&p, 0, sizeof(p));
+            int fd = io_uring_setup(2, &p);
+            if (fd < 0) return false;
+            close(fd);
+            return true;
+        }();
+        return _supported;
+    }
+
+    uring::buffer_group::buffer_group(uring *u, uint16_t id, uint16_t count, size_t size)
+    : m_uring(u), m_id(id), m_count(count), m_buf_size(size), m_bufs(nullptr), m_ring(nullptr) {
+        m_ring_size = m_count * sizeof(io_uring_buf);
+        void *ring = mmap(nullptr, m_ring_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED) {
+            throw runtime_error(errmsg("mmap buffer ring"));
+        }
+        m_ring = (io_uring_buf_ring*)ring;
+        m_ring->tail = 0;
+
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (uint64_t)ring;
+        reg.ring_entries = (uint32_t)m_count;
+        reg.bgid = m_id;
+        if (io_uring_register(u->m_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            munmap(ring, m_ring_size);
+            throw runtime_error(errmsg("register buffer ring"));
+        }
+        m_bufs = new char[m_buf_size * m_count];
+        for (size_t i = 0; i < m_count; i ++) {
+            put((uint16_t)i);
+        }
+    }
+
+    uring::buffer_group::~buffer_group() {
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = m_id;
+        io_uring_register(m_uring->m_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        munmap(m_ring, m_ring_size);
+        delete [] m_bufs;
+    }
+
+    void uring::buffer_group::put(uint16_t bid) {
+        unique_lock<mutex> lock(m_mutex);
+        uint16_t tail = m_ring->tail;
+        // the ring is an array of io_uring_buf, bufs of the header
+        // doesn't start at 0 in C++, where an empty struct takes a byte.
+        auto& b = ((io_uring_buf*)m_ring)[tail & (m_count - 1)];
+        b.addr = (uint64_t)buf(bid);
+        b.len = (uint32_t)m_buf_size;
+        b.bid = bid;
+        __atomic_store_n(&m_ring->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+    }
+
+    uring::buffer_group* uring::add_buffer_group(uint16_t count, size_t size) {
+        uint16_t n = 1;
+        while (n < count && n < 0x8000) n <<= 1;
+        unique_ptr<buffer_group> g(new buffer_group(this, (uint16_t)m_groups.size(), n, size));
+        m_groups.push_back(move(g));
+        return m_groups.back().get();
+    }
+
+    uint16_t uring::buffer_id(uint32_t flags) {
+        return (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+    }
+
+    bool uring::more(uint32_t flags) {
+        return (flags & IORING_CQE_F_MORE) != 0;
+    }
+
+    io_uring_sqe* uring::get_sqe(op_id& id, handler&& fn) {
+        unsigned tail = *m_sq->tail;
+        while (tail - __atomic_load_n(m_sq->head, __ATOMIC_ACQUIRE) >= m_sq->entries) {
+            if (submit(0)) continue;
+            // the completion queue is full: set its entries aside
+            // for run, which makes room for the kernel to go on.
+            if (reap() == 0) {
+                throw runtime_error("io_uring: submission queue full");
+            }
+        }
+        unsigned idx = tail & m_sq->mask;
+        io_uring_sqe *sqe = &m_sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        m_sq->array[idx] = idx;
+        __atomic_store_n(m_sq->tail, tail + 1, __ATOMIC_RELEASE);
+        m_to_submit ++;
+
+        id = m_next_op ++;
+        m_ops[id].reset(new op(move(fn)));
+        sqe->user_data = id;
+        return sqe;
+    }
+
+    bool uring::submit(unsigned wait_nr) {
+        unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+        while (true) {
+            int r = io_uring_enter(m_fd, m_to_submit, wait_nr, flags);
+            if (r >= 0) {
+                m_to_submit -= (unsigned)r;
+                return r > 0;
+            }
+            if (errno == EINTR) continue;
+            // the completion queue is full, drain it before submitting.
+            if (errno == EBUSY || errno == EAGAIN) return false;
+            throw runtime_error(errmsg("io_uring_enter"));
+        }
+    }
+
+    size_t uring::reap() {
+        size_t n = 0;
+        unsigned head = *m_cq->head;
+        while (head != __atomic_load_n(m_cq->tail, __ATOMIC_ACQUIRE)) {
+            auto& cqe = m_cq->cqes[head & m_cq->mask];
+            m_reaped.push_back(completion{cqe.user_data, cqe.res, cqe.flags});
+            head ++;
+            n ++;
+        }
+        __atomic_store_n(m_cq->head, head, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    uring::op_id uring::recvmsg_multishot(int fd, buffer_group *g, handler fn, size_t control_len) {
+        op_id id;
+        auto sqe = get_sqe(id, move(fn));
+        auto& o = *m_ops[id];
+        o.multishot = true;
+        o.msg.msg_namelen = sizeof(sockaddr_in);
+        o.msg.msg_controllen = control_len;
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)&o.msg;
+        sqe->len = 1;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = g->id();
+        return id;
+    }
+
+    uring::message uring::parse(const buffer_group *g, int res, uint32_t flags, size_t control_len) {
+        message m;
+        memset(&m, 0, sizeof(m));
+        if (res <= 0 || (flags & IORING_CQE_F_BUFFER) == 0) return m;
+        char *buf = (char*)g->buf(buffer_id(flags));
+        auto out = (const io_uring_recvmsg_out*)buf;
+        size_t off = sizeof(io_uring_recvmsg_out);
+        if (out->namelen >= sizeof(sockaddr_in)) {
+            m.from = (const sockaddr_in*)(buf + off);
+        }
+        off += sizeof(sockaddr_in);
+        m.control = buf + off;
+        m.control_len = out->controllen;
+        off += control_len;
+        m.payload = buf + off;
+        m.len = out->payloadlen;
+        if (off + m.len > (size_t)res) m.len = (size_t)res - off;
+        m.room = g->buf_size() - off - m.len;
+        m.truncated = (out->flags & MSG_TRUNC) != 0;
+        return m;
+    }
+
+    uring::op_id uring::recv_multishot(int fd, buffer_group *g, handler fn) {
+        op_id id;
+        auto sqe = get_sqe(id, move(fn));
+        m_ops[id]->multishot = true;
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = fd;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = g->id();
+        return id;
+    }
+
+    uring::op_id uring::accept_multishot(int fd, handler fn) {
+        op_id id;
+        auto sqe = get_sqe(id, move(fn));
+        m_ops[id]->multishot = true;
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = fd;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        return id;
+    }
+
+    uring::op_id uring::send(int fd, const void *buf, size_t len, handler fn) {
+        op_id id;
+        auto sqe = get_sqe(id, move(fn));
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)buf;
+        sqe->len = (uint32_t)len;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        return id;
+    }
+
+    uring::op_id uring::sendmsg(int fd, const iovec *iov, size_t iovcnt, const sockaddr_in *to, handler fn) {
+        op_id id;
+        auto sqe = get_sqe(id, move(fn));
+        auto& o = *m_ops[id];
+        o.iov.assign(iov, iov + iovcnt);
+        o.msg.msg_iov = o.iov.data();
+        o.msg.msg_iovlen = o.iov.size();
+        if (to != nullptr) {
+            o.addr = *to;
+            o.msg.msg_name = &o.addr;
+            o.msg.msg_namelen = sizeof(o.addr);
+        }
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)&o.msg;
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        return id;
+    }
+
+    uring::op_id uring::timeout(uint64_t ms, handler fn) {
+        op_id id;
+        auto sqe = get_sqe(id, move(fn));
+        auto& o = *m_ops[id];
+        o.ts.tv_sec = (int64_t)(ms / 1000);
+        o.ts.tv_nsec = (long long)(ms % 1000) * 1000000;
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t)&o.ts;
+        sqe->len = 1;
+        return id;
+    }
+
+    void uring::cancel(op_id target) {
+        op_id id;
+        auto sqe = get_sqe(id, [] (int, uint32_t) { });
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = target;
+    }
+
+    void uring::post(function<void()> fn) {
+        {
+            unique_lock<mutex> lock(m_post_mutex);
+            m_posted.push_back(move(fn));
+        }
+        uint64_t one = 1;
+        if (write(m_event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            throw runtime_error(errmsg("eventfd write"));
+        }
+    }
+
+    void uring::stop() {
+        m_stopping = true;
+        uint64_t one = 1;
+        if (write(m_event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            throw runtime_error(errmsg("eventfd write"));
+        }
+    }
+
+    void uring::arm_wakeup() {
+        op_id id;
+        auto sqe = get_sqe(id, [this] (int, uint32_t flags) {
+            uint64_t val;
+            while (read(m_event_fd, &val, sizeof(val)) > 0) { }
+            if ((flags & IORING_CQE_F_MORE) == 0) arm_wakeup();
+        });
+        m_ops[id]->multishot = true;
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = m_event_fd;
+        sqe->poll32_events = POLLIN;
+        sqe->len = IORING_POLL_ADD_MULTI;
+    }
+
+    void uring::run_posted() {
+        vector<function<void()>> posted;
+        {
+            unique_lock<mutex> lock(m_post_mutex);
+            posted.swap(m_posted);
+        }
+        for (auto& fn : posted) fn();
+    }
+
+    void uring::run() {
+        while (!m_stopping.load()) {
+            run_posted();
+            // doesn't wait with completions set aside by get_sqe.
+            submit(m_reaped.empty() ? 1 : 0);
+            reap();
+            // handlers may set more aside.
+            while (!m_reaped.empty()) {
+                completion c = m_reaped.front();
+                m_reaped.pop_front();
+                complete(c);
+            }
+        }
+        run_posted();
+    }
+
+    void uring::complete(const completion& c) {
+        auto it = m_ops.find(c.id);
+        if (it == m_ops.end()) return;
+        if (it->second->multishot && (c.flags & IORING_CQE_F_MORE) != 0) {
+            // the handler may start operations, which rehash m_ops.
+            op *o = it->second.get();
+            o->fn(c.res, c.flags);
+            return;
+        }
+        unique_ptr<op> o(move(it->second));
+        m_ops.erase(it);
+        o->fn(c.res, c.flags);
+    }
+}
@@ -0,0 +1,96 @@
+#include <string>
+#include <vector>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "gtest/gtest.h"
+
+#include "dp/util/uring.h"
+
+namespace dp {
+    using namespace std;
+
+    static int udp_socket(sockaddr_in& addr) {
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(fd, (sockaddr*)&addr, sizeof(addr));
+        socklen_t len = sizeof(addr);
+        getsockname(fd, (sockaddr*)&addr, &len);
+        return fd;
+    }
+
+    TEST(UringTest, PostStop) {
+        if (!uring::supported()) return;
+        uring u;
+        int n = 0;
+        thread t([&] { u.run(); });
+        for (int i = 0; i < 10; i ++) u.post([&] { n ++; });
+        u.post([&] { u.stop(); });
+        t.join();
+        EXPECT_EQ(10, n);
+    }
+
+    TEST(UringTest, Timeout) {
+        if (!uring::supported()) return;
+        uring u;
+        int res = 0;
+        u.timeout(10, [&] (int r, uint32_t) { res = r; u.stop(); });
+        u.run();
+        EXPECT_EQ(-ETIME, res);
+    }
+
+    TEST(UringTest, FullQueues) {
+        if (!uring::supported()) return;
+        // far more than the queues take, completing right away.
+        uring u(4);
+        int n = 0;
+        u.post([&] {
+            for (int i = 0; i < 200; i ++) {
+                u.timeout(0, [&] (int, uint32_t) {
+                    if (++ n == 200) u.stop();
+                });
+            }
+        });
+        u.run();
+        EXPECT_EQ(200, n);
+    }
+
+    TEST(UringTest, RecvmsgMultishot) {
+        if (!uring::supported()) return;
+        sockaddr_in addr;
+        int rx = udp_socket(addr);
+        int tx = socket(AF_INET, SOCK_DGRAM, 0);
+        uring u;
+        auto g = u.add_buffer_group(3, 256);
+        EXPECT_EQ(4, g->count());
+        int received = 0;
+        string last;
+        u.recvmsg_multishot(rx, g, [&] (int res, uint32_t flags) {
+            ASSERT_GT(res, 0);
+            auto m = uring::parse(g, res, flags);
+            ASSERT_NE(nullptr, m.from);
+            EXPECT_FALSE(m.truncated);
+            last.assign((const char*)m.payload, m.len);
+            g->put(uring::buffer_id(flags));
+            if (++ received == 10) u.stop();
+        });
+        thread t([&] { u.run(); });
+        vector<string> msgs;
+        for (int i = 0; i < 10; i ++) msgs.push_back("msg" + to_string(i));
+        for (auto& msg : msgs) {
+            iovec iov = { (void*)msg.data(), msg.size() };
+            u.post([&u, tx, iov, &addr] {
+                u.sendmsg(tx, &iov, 1, &addr, [] (int, uint32_t) { });
+            });
+            this_thread::sleep_for(chrono::milliseconds(2));
+        }
+        t.join();
+        EXPECT_EQ(10, received);
+        EXPECT_EQ("msg9", last);
+        close(tx);
+        close(rx);
+    }
+}
@@ -1,12 +1,19 @@
 #include <exception>
 #include <iostream>
 #include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "dp/graph.h"
 #include "dp/graph_def.h"
 #include "dp/operators.h"
+#include "dp/ingress/pcap.h"
+#include "dp/ingress/tcp.h"
+#include "dp/ingress/replay.h"
+#include "dp/ingress/shm.h"
 #include "dp/ingress/udp.h"
 #include "dp/ingress/videocap.h"
 #include "mqtt/operators.h"
@@ -15,6 +22,13 @@
 using namespace std;
 using namespace dp;
 
+DEFINE_int32(frames, 1, "frames in flight per graph");
+DEFINE_int32(queue, 0, "frames waiting for a free graph");
+DEFINE_string(overflow, "block", "when the queue is full: block, drop-newest, drop-oldest, latest");
+DEFINE_int32(max_graphs, 1, "graph instances to grow to under load, 0 for the number of cores");
+DEFINE_bool(multiplex, false, "run the ingresses which support it on a single epoll thread");
+DEFINE_int32(latency_report, 0, "seconds between logging frame latency percentiles and ingress counters, 0 disables");
+
 class app {
 public:
     app(int argc, char* argv[]) {
@@ -33,11 +47,55 @@ public:
 
     void run() {
         exec_env env;
-        m_def.build_env(env, {}).run();
+        if (FLAGS_frames > 1) env.frames = (size_t)FLAGS_frames;
+        if (FLAGS_queue > 0) env.queue_size = (size_t)FLAGS_queue;
+        env.overflow = parse_overflow_policy(FLAGS_overflow);
+        if (FLAGS_max_graphs > 0) {
+            env.max_graphs = (size_t)FLAGS_max_graphs;
+        } else {
+            env.max_graphs = thread::hardware_concurrency();
+        }
+        env.multiplex = FLAGS_multiplex;
+        m_def.build_env(env, {});
+
+        mutex report_mutex;
+        condition_variable report_cv;
+        bool done = false;
+        thread reporter;
+        if (FLAGS_latency_report > 0) {
+            reporter = thread([&] {
+                unique_lock<mutex> lock(report_mutex);
+                while (!report_cv.wait_for(lock, chrono::seconds(FLAGS_latency_report), [&] { return done; })) {
+                    report(env.dispatcher.latency());
+                    for (auto& in : env.ingresses) {
+                        auto line = in->stats_line();
+                        if (!line.empty()) LOG(INFO) << "ingress " << in->input_var() << ": " << line;
+                    }
+                }
+            });
+        }
+        env.run();
+        if (reporter.joinable()) {
+            {
+                unique_lock<mutex> lock(report_mutex);
+                done = true;
+            }
+            report_cv.notify_all();
+            reporter.join();
+        }
     }
 
 private:
     graph_def m_def;
+
+    static void report(const latency_stats& st) {
+        LOG(INFO) << "latency ingress: " << st.ingress.summary();
+        LOG(INFO) << "latency wait: " << st.wait.summary();
+        LOG(INFO) << "latency exec: " << st.exec.summary();
+        LOG(INFO) << "latency order: " << st.order.summary();
+        LOG(INFO) << "latency finalize: " << st.finalize.summary();
+        LOG(INFO) << "latency total: " << st.total.summary();
+    }
 };
 
 int main(int argc, char* argv[]) {
@@ -45,6 +103,10 @@ int main(int argc, char* argv[]) {
     google::InstallFailureSignalHandler();
     gflags::ParseCommandLineFlags(&argc, &argv, true);
 
+    dp::in::pcap::register_factory();
+    dp::in::tcp::register_factory();
+    dp::in::replay::register_factory();
+    dp::in::shm::register_factory();
     dp::in::udp::register_factory();
     dp::in::video_capture::register_factory();
     dp::op::register_factories();
@@ -60,17 +60,28 @@ namespace movidius::op {
                 T(ent.graph)(ctx);
             };
         }
+
+        dp::graph::op_sig signature(const string& type,
+            const dp::graph_def::params& args) {
+            return T::signature();
+        }
     };
 
     struct wrap_op_factory : public dp::graph_def::op_factory {
         using create_op_func = function<dp::graph::op_func(const dp::graph_def::params&)>;
         create_op_func func;
-        wrap_op_factory(create_op_func f) : func(f) { }
+        dp::graph::op_sig sig;
+        wrap_op_factory(create_op_func f, const dp::graph::op_sig& s = dp::graph::op_sig())
+        : func(f), sig(s) { }
         dp::graph::op_func create_op(
             const string& name, const string& type,
             const dp::graph_def::params& params) {
             return func(params);
         };
+        dp::graph::op_sig signature(const string& type,
+            const dp::graph_def::params& params) {
+            return sig;
+        }
     };
 
     static wrap_op_factory _cropfp16_factory(
@@ -85,7 +96,7 @@ namespace movidius::op {
         return [cx, cy] (dp::graph::ctx ctx) {
             crop_fp16(cx, cy)(ctx);
         };
-    });
+    }, crop_fp16::signature());
 
     static graph_op_factory<exec> _exec_factory;
     static graph_op_factory<ssd_mobilenet> _ssd_mobilenet_factory;
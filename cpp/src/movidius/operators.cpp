@@ -8,7 +8,7 @@ namespace movidius::op {
     using namespace std;
 
     void exec::operator() (dp::graph::ctx ctx) {
-        const cv::Mat& m = ctx.in(0)->as<cv::Mat>();
+        const cv::Mat& m = ctx.in<cv::Mat>(0);
         graph->exec(m.data, m.rows * m.cols * 6, [ctx] (const void* out, size_t len) {
             len >>= 1;
             vector<float> fp(len);
@@ -46,7 +46,7 @@ namespace movidius::op {
     }
 
     void crop_fp16::operator() (dp::graph::ctx ctx) {
-        const cv::Mat& m = ctx.in(0)->as<cv::Mat>();
+        const cv::Mat& m = ctx.in<cv::Mat>(0);
         ctx.out(0)->set<cv::Mat>(crop(m));
     }
 
@@ -10,7 +10,7 @@ namespace movidius::op {
     using namespace std;
 
     void ssd_mobilenet::operator() (dp::graph::ctx ctx) {
-        cv::Mat m = ctx.in(0)->as<cv::Mat>();
+        cv::Mat m = ctx.in<cv::Mat>(0);
         int s = max(m.rows, m.cols);
         if (s != net_imagesz) {
             cv::Mat d;
@@ -20,7 +20,7 @@ namespace movidius::op {
         }
         cv::Mat m16 = crop_fp16::crop(m, net_imagesz, net_imagesz);
         graph->exec(m16.data, m16.total() * 6, [ctx] (const void* out, size_t len) {
-            const cv::Mat& m = ctx.in(0)->as<cv::Mat>();
+            const cv::Mat& m = ctx.in<cv::Mat>(0);
             ctx.out(0)->set<vector<dp::detect_box>>(
                 move(to_detect_boxes(out, len, dp::image_size(m.cols, m.rows))));
         });
@@ -47,6 +47,11 @@ namespace mqtt::op {
                 T(client, topic)(ctx);
             };
         }
+
+        dp::graph::op_sig signature(const string& type,
+            const dp::graph_def::params& args) {
+            return T::signature();
+        }
     };
 
     void register_factories() {
@@ -4,6 +4,6 @@ namespace mqtt::op {
     using namespace std;
 
     void pub::operator() (dp::graph::ctx ctx) {
-        client->publish(topic, ctx.in(0)->as<string>());
+        client->publish(topic, ctx.in<string>(0));
     }
 }
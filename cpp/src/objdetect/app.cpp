@@ -2,11 +2,18 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <signal.h>
+#include <pthread.h>
+#include <string.h>
 #include <exception>
 #include <iostream>
 #include <thread>
 #include <atomic>
+#include <chrono>
 #include <vector>
+#include <list>
+#include <memory>
+#include <unordered_map>
 #include <string>
 #include <functional>
 #include <condition_variable>
@@ -21,6 +28,8 @@
 #include "dp/ingress/udp.h"
 #include "dp/ingress/videocap.h"
 #include "dp/util/error.h"
+#include "dp/util/uring.h"
+#include "dp/util/chunk.h"
 #include "mqtt/mqtt.h"
 #include "movidius/ncs.h"
 #include "movidius/ssd_mobilenet.h"
@@ -32,6 +41,9 @@ static constexpr int http_port = 2052;
 static constexpr int cast_port = 2053;
 
 DEFINE_int32(port, in::udp::default_port, "listening port");
+DEFINE_int32(udp_threads, 1, "receiving sockets and threads on the port");
+DEFINE_int32(udp_batch, 1, "datagrams received per syscall");
+DEFINE_string(io, "threads", "socket I/O: threads, or uring to drive sockets from io_uring loops");
 DEFINE_string(mqtt_host, "127.0.0.1", "MQTT server address");
 DEFINE_int32(mqtt_port, mqtt::client::default_port, "MQTT server port");
 DEFINE_string(mqtt_client_id, "", "MQTT client ID");
@@ -40,12 +52,18 @@ DEFINE_string(model, "graph", "Model name");
 DEFINE_string(http_addr, "", "image server listening address");
 DEFINE_int32(http_port, http_port, "image server listening port");
 DEFINE_int32(stream_port, cast_port, "TCP streaming port");
-
-struct pub_op {
+DEFINE_int32(cast_chunk, 0, "chunk UDP casts into datagrams of this size, 0 chunks only frames over 64KB");
+DEFINE_int32(frames, 1, "frames in flight per compute stick");
+DEFINE_int32(queue, 0, "frames waiting for a free compute stick");
+DEFINE_string(overflow, "block", "when the queue is full: block, drop-newest, drop-oldest, latest");
+DEFINE_int32(order_window, 0, "publish results in per-source order, holding up to this many frames");
+DEFINE_int32(order_timeout, 200, "milliseconds a frame waits for earlier ones");
+
+struct pub_op : graph::typed_op<graph::inputs<string>, graph::outputs<>> {
     mqtt::client *client;
     pub_op(mqtt::client* c) : client(c) { }
     void operator() (graph::ctx ctx) {
-        const auto& str = ctx.in(0)->as<string>();
+        const auto& str = ctx.in<string>(0);
         client->publish(FLAGS_mqtt_topic, str);
     }
 };
@@ -78,7 +96,9 @@ struct image_buffer {
     size_t size;
     image_id id;
 
-    static constexpr size_t max_buf_size = 0x10000;
+    // readers may hold ptr while the next image is written,
+    // so the buffer never reallocates.
+    static constexpr size_t max_buf_size = max_frame_size;
 
     image_buffer() : data(max_buf_size), size(0) { }
 
@@ -95,25 +115,83 @@ struct image_buffer {
 };
 
 class image_handler;
+
+// frame is a snapshot of an image_buffer shared by all the sends
+// of a cast, prefixed by the 16-bit size for streams.
+// With chunk_size, it's also encoded as chunks for datagrams.
+struct frame {
+    vector<unsigned char> data;
+    size_t prefix;
+    vector<uint8_t> chunks;
+    size_t chunk_size;
+    size_t chunk_count;
+
+    frame(const image_buffer* buf, uint32_t id = 0, size_t _chunk_size = 0)
+    : data(buf->size + max_stream_prefix), chunk_size(_chunk_size), chunk_count(0) {
+        prefix = encode_stream_prefix(buf->size, &data[0]);
+        data.resize(prefix + buf->size);
+        memcpy(&data[prefix], buf->ptr(), buf->size);
+        if (chunk_size > 0) {
+            chunk_count = encode_chunks(id, buf->ptr(), buf->size, chunk_size, chunks);
+        }
+    }
+
+    const unsigned char* payload() const { return &data[prefix]; }
+    size_t payload_size() const { return data.size() - prefix; }
+};
+
+// feeder hands every new image to a uring loop until destroyed.
+class feeder {
+public:
+    feeder(const image_handler* images, uring* io, function<void(shared_ptr<frame>)> cast,
+        function<size_t(size_t)> chunk_size = nullptr);
+    ~feeder();
+
+private:
+    const image_handler* m_images;
+    atomic<bool> m_stopping;
+    thread m_thread;
+};
+
 typedef ::boost::network::http::server<image_handler> http_server_t;
 
 class image_handler {
 public:
-    image_handler() : m_images(2), m_current_buf(0) { }
+    image_handler() : m_images(2), m_current_buf(0), m_version(0), m_closed(false) { }
 
     void set_image(const void *buf, size_t size, const image_id& id) {
         int write_buf = 1 - m_current_buf.load();
         m_images[write_buf].update(buf, size, id);
         atomic_exchange(&m_current_buf, write_buf);
+        unique_lock<mutex> lock(m_set_image_mux);
+        m_version ++;
         m_set_image_cv.notify_all();
     }
 
-    const image_buffer* wait() const {
+    // waits for the next image, nullptr once closed or cancel is set.
+    const image_buffer* wait(const atomic<bool>* cancel = nullptr) const {
         unique_lock<mutex> lock(m_set_image_mux);
-        m_set_image_cv.wait(lock);
+        uint64_t seen = m_version;
+        while (m_version == seen && !m_closed && !(cancel != nullptr && cancel->load())) {
+            m_set_image_cv.wait(lock);
+        }
+        if (m_closed || (cancel != nullptr && cancel->load())) return nullptr;
         return &m_images[m_current_buf.load()];
     }
 
+    // wakes up waiters to check their cancel flag.
+    void wake() const {
+        unique_lock<mutex> lock(m_set_image_mux);
+        m_set_image_cv.notify_all();
+    }
+
+    // ends every wait, for shutdown.
+    void close() {
+        unique_lock<mutex> lock(m_set_image_mux);
+        m_closed = true;
+        m_set_image_cv.notify_all();
+    }
+
     void operator() (http_server_t::request const& request, http_server_t::connection_ptr conn) {
         VLOG(4) << request.method << " " << request.destination;
         boost::network::uri::uri uri("http://localhost:80"+request.destination);
@@ -159,6 +237,9 @@ private:
     vector<image_buffer> m_images;
     atomic_int m_current_buf;
 
+    // guarded by m_set_image_mux.
+    uint64_t m_version;
+    bool m_closed;
     mutable mutex m_set_image_mux;
     mutable condition_variable m_set_image_cv;
 
@@ -195,9 +276,31 @@ private:
     }
 };
 
+feeder::feeder(const image_handler* images, uring* io, function<void(shared_ptr<frame>)> cast,
+    function<size_t(size_t)> chunk_size)
+: m_images(images), m_stopping(false) {
+    m_thread = thread([this, images, io, cast, chunk_size] {
+        const image_buffer* buf;
+        uint32_t id = 0;
+        while ((buf = images->wait(&m_stopping)) != nullptr) {
+            size_t sz = chunk_size ? chunk_size(buf->size) : 0;
+            shared_ptr<frame> f(new frame(buf, ++ id, sz));
+            io->post([cast, f] { cast(f); });
+        }
+    });
+}
+
+// the loop must outlive it.
+feeder::~feeder() {
+    m_stopping = true;
+    m_images->wake();
+    m_thread.join();
+}
+
 class socket_listener {
 public:
-    socket_listener(int type, int port) : m_socket(-1) {
+    socket_listener(int type, int port)
+    : m_stopping(false), m_socket(-1), m_images(nullptr), m_io(nullptr) {
         try {
             m_socket = socket(PF_INET, type, 0);
             if (m_socket < 0) {
@@ -238,8 +341,42 @@ public:
 
     int socket_fd() const { return m_socket; }
 
+    // makes run return, safe from any thread.
+    void stop() {
+        unique_lock<mutex> lock(m_stop_mutex);
+        m_stopping = true;
+        if (m_images != nullptr) m_images->wake();
+        if (m_io != nullptr) {
+            m_io->stop();
+        } else {
+            // wakes up a blocking accept or recvfrom.
+            shutdown(m_socket, SHUT_RDWR);
+        }
+    }
+
+protected:
+    atomic<bool> m_stopping;
+
+    // registers what stop wakes up while running,
+    // false if stopped already.
+    bool attach(const image_handler* images, uring* io = nullptr) {
+        unique_lock<mutex> lock(m_stop_mutex);
+        m_images = images;
+        m_io = io;
+        return !m_stopping.load();
+    }
+
+    void detach() {
+        unique_lock<mutex> lock(m_stop_mutex);
+        m_images = nullptr;
+        m_io = nullptr;
+    }
+
 private:
     int m_socket;
+    mutex m_stop_mutex;
+    const image_handler* m_images;
+    uring* m_io;
 };
 
 class streamer : public socket_listener {
@@ -248,26 +385,33 @@ public:
     : socket_listener(SOCK_STREAM, port) {
     }
 
-    void run(const image_handler* images) {
+    void run(const image_handler* images, bool use_uring = false) {
+        if (use_uring) {
+            run_uring(images);
+            return;
+        }
+        if (!attach(images)) return;
         while (true) {
             sockaddr_in sa;
             socklen_t salen = sizeof(sa);
             int conn = accept(socket_fd(), (sockaddr*)&sa, &salen);
             if (conn < 0) {
-                LOG(ERROR) << errmsg("accept");
+                if (!m_stopping.load()) LOG(ERROR) << errmsg("accept");
                 break;
             }
             thread client([this, conn, images] { stream_to(conn, images); });
             client.detach();
         }
+        detach();
     }
 
 private:
     void stream_to(int conn, const image_handler* images) {
         const image_buffer* buf;
         while ((buf = images->wait()) != nullptr) {
-            uint16_t sz = (uint16_t)buf->size;
-            int r = send(conn, &sz, sizeof(sz), MSG_NOSIGNAL);
+            uint8_t prefix[max_stream_prefix];
+            size_t len = encode_stream_prefix(buf->size, prefix);
+            int r = send(conn, prefix, len, MSG_NOSIGNAL);
             if (r > 0) {
                 r = send(conn, buf->ptr(), buf->size, MSG_NOSIGNAL);
             }
@@ -278,26 +422,91 @@ private:
         }
         close(conn);
     }
+
+    // connections which are sending a frame, on the loop thread.
+    unordered_map<int, bool> m_busy;
+
+    // serves all clients from one loop, a client still sending
+    // the previous frame skips the new one.
+    void run_uring(const image_handler* images) {
+        uring io;
+        if (!attach(images, &io)) return;
+        accept_clients(&io);
+        {
+            feeder feed(images, &io, [this, &io] (shared_ptr<frame> f) {
+                for (auto& c : m_busy) {
+                    if (c.second) continue;
+                    c.second = true;
+                    send_frame(&io, c.first, f, 0);
+                }
+            });
+            io.run();
+        }
+        detach();
+        for (auto& c : m_busy) close(c.first);
+        m_busy.clear();
+    }
+
+    void accept_clients(uring* io) {
+        io->accept_multishot(socket_fd(), [this, io] (int res, uint32_t flags) {
+            if (res >= 0) {
+                m_busy[res] = false;
+            } else {
+                LOG(ERROR) << "accept: " << strerror(-res);
+                io->stop();
+                return;
+            }
+            if (!uring::more(flags)) accept_clients(io);
+        });
+    }
+
+    void send_frame(uring* io, int conn, shared_ptr<frame> f, size_t off) {
+        io->send(conn, &f->data[off], f->data.size() - off, [this, io, conn, f, off] (int res, uint32_t) {
+            if (res <= 0) {
+                LOG(ERROR) << "send: " << strerror(res < 0 ? -res : EPIPE);
+                close(conn);
+                m_busy.erase(conn);
+            } else if (off + (size_t)res < f->data.size()) {
+                send_frame(io, conn, f, off + (size_t)res);
+            } else {
+                m_busy[conn] = false;
+            }
+        });
+    }
 };
 
+// udp_caster sends a frame per datagram, or as chunks when it doesn't
+// fit one. With chunk_size, frames over it are always chunked.
 class udp_caster : public socket_listener {
 public:
-    udp_caster(int port = cast_port)
-    : socket_listener(SOCK_DGRAM, port) {
+    udp_caster(int port = cast_port, size_t chunk_size = 0)
+    : socket_listener(SOCK_DGRAM, port), m_chunk_size(chunk_size), m_frame(0) {
+        if (chunk_size > 0 && chunk_size <= chunk_header::size) {
+            throw invalid_argument("chunk size too small: " + sz2str(chunk_size));
+        }
     }
 
-    void run(const image_handler* images) {
+    void run(const image_handler* images, bool use_uring = false) {
+        if (use_uring) {
+            run_uring(images);
+            return;
+        }
+        if (!attach(images)) return;
         thread listener_thread([this] { run_listener(); });
         run_caster(images);
         listener_thread.join();
+        detach();
     }
 
 private:
     struct subscriber {
         sockaddr_in addr;
         int failures;
+        // datagrams in flight, and whether one of the frame failed.
+        size_t sending;
+        bool failed;
 
-        subscriber(const sockaddr_in& sa) : failures(0) {
+        subscriber(const sockaddr_in& sa) : failures(0), sending(0), failed(false) {
             memcpy(&addr, &sa, sizeof(addr));
         }
     
@@ -320,17 +529,20 @@ private:
 
     list<subscriber> m_subscribers;
     mutex m_lock;
+    size_t m_chunk_size;
+    uint32_t m_frame;
+    vector<uint8_t> m_chunks;
 
     static constexpr int max_failures = 5;
 
     void run_listener() {
         char buf[4];
-        while (true) {
+        while (!m_stopping.load()) {
             sockaddr_in sa;
             socklen_t salen = sizeof(sa);            
             int r = recvfrom(socket_fd(), buf, sizeof(buf), 0, (sockaddr*)&sa, &salen);
             if (r < 0) {
-                LOG(ERROR) << errmsg("recvfrom");
+                if (!m_stopping.load()) LOG(ERROR) << errmsg("recvfrom");
                 break;
             }
             if (r == 0) continue;
@@ -348,20 +560,39 @@ private:
 
     void run_caster(const image_handler* images) {
         const image_buffer* buf;
-        while ((buf = images->wait()) != nullptr) {
-            uint16_t sz = (uint16_t)buf->size;
+        while ((buf = images->wait(&m_stopping)) != nullptr) {
             cast(buf);
         }
     }
 
+    // 0 if the frame goes as a single datagram.
+    size_t chunk_size(size_t size) const {
+        if (m_chunk_size > 0) {
+            return size + chunk_header::size > m_chunk_size ? m_chunk_size : 0;
+        }
+        return size > max_datagram_size ? default_chunk_size : 0;
+    }
+
     void cast(const image_buffer* buf) {
+        size_t chunk = chunk_size(buf->size);
+        if (chunk > 0) {
+            encode_chunks(++ m_frame, buf->ptr(), buf->size, chunk, m_chunks);
+        }
         unique_lock<mutex> lock(m_lock);
         list<subscriber>::iterator it = m_subscribers.begin();
         while (it != m_subscribers.end()) {
             auto cur = it;
             it ++;
-            int r = sendto(socket_fd(), buf->ptr(), buf->size, MSG_NOSIGNAL, 
-                (sockaddr*)&cur->addr, sizeof(cur->addr));
+            int r = 0;
+            if (chunk == 0) {
+                r = sendto(socket_fd(), buf->ptr(), buf->size, MSG_NOSIGNAL,
+                    (sockaddr*)&cur->addr, sizeof(cur->addr));
+            }
+            for (size_t off = 0; chunk > 0 && off < m_chunks.size() && r >= 0; off += chunk) {
+                size_t len = m_chunks.size() - off < chunk ? m_chunks.size() - off : chunk;
+                r = sendto(socket_fd(), &m_chunks[off], len, MSG_NOSIGNAL,
+                    (sockaddr*)&cur->addr, sizeof(cur->addr));
+            }
             if (r < 0) {
                 LOG(ERROR) << cur->str() << ": " << errmsg("sendto");
                 cur->failures ++;
@@ -373,6 +604,97 @@ private:
         }
     }
 
+    static constexpr uint16_t control_bufs = 8;
+    static constexpr size_t control_buf_size = 64;
+
+    // listens and casts from one loop, a subscriber still sending
+    // the previous frame skips the new one.
+    void run_uring(const image_handler* images) {
+        uring io;
+        if (!attach(images, &io)) return;
+        auto group = io.add_buffer_group(control_bufs, control_buf_size);
+        listen_uring(&io, group);
+        {
+            feeder feed(images, &io, [this, &io] (shared_ptr<frame> f) {
+                cast_uring(&io, f);
+            }, [this] (size_t size) { return chunk_size(size); });
+            io.run();
+        }
+        detach();
+    }
+
+    void listen_uring(uring* io, uring::buffer_group* group) {
+        io->recvmsg_multishot(socket_fd(), group, [this, io, group] (int res, uint32_t flags) {
+            auto msg = uring::parse(group, res, flags);
+            if (msg.payload != nullptr) {
+                if (msg.len > 0 && msg.from != nullptr) {
+                    switch (*(const char*)msg.payload) {
+                    case '+':
+                        add_subscriber(*msg.from);
+                        break;
+                    case '-':
+                        del_subscriber(*msg.from);
+                        break;
+                    }
+                }
+                group->put(uring::buffer_id(flags));
+            }
+            if (uring::more(flags)) return;
+            if (res < 0 && res != -ENOBUFS) {
+                LOG(ERROR) << "recvmsg: " << strerror(-res);
+                io->stop();
+                return;
+            }
+            listen_uring(io, group);
+        });
+    }
+
+    void cast_uring(uring* io, shared_ptr<frame> f) {
+        vector<iovec> iovs;
+        if (f->chunk_count == 0) {
+            iovec iov;
+            iov.iov_base = (void*)f->payload();
+            iov.iov_len = f->payload_size();
+            iovs.push_back(iov);
+        }
+        for (size_t off = 0; f->chunk_count > 0 && off < f->chunks.size(); off += f->chunk_size) {
+            iovec iov;
+            iov.iov_base = &f->chunks[off];
+            iov.iov_len = f->chunks.size() - off < f->chunk_size ? f->chunks.size() - off : f->chunk_size;
+            iovs.push_back(iov);
+        }
+        unique_lock<mutex> lock(m_lock);
+        for (auto& sub : m_subscribers) {
+            if (sub.sending > 0) continue;
+            sub.sending = iovs.size();
+            sub.failed = false;
+            sockaddr_in sa = sub.addr;
+            for (auto& iov : iovs) {
+                io->sendmsg(socket_fd(), &iov, 1, &sa, [this, f, sa] (int res, uint32_t) {
+                    sent_uring(sa, res);
+                });
+            }
+        }
+    }
+
+    void sent_uring(const sockaddr_in& sa, int res) {
+        unique_lock<mutex> lock(m_lock);
+        auto it = find_if(m_subscribers.begin(), m_subscribers.end(), subscriber::if_same(sa));
+        if (it == m_subscribers.end()) return;
+        if (res < 0 && !it->failed) {
+            LOG(ERROR) << it->str() << ": sendmsg: " << strerror(-res);
+            it->failed = true;
+        }
+        // a subscriber added again may see completions of earlier sends.
+        if (it->sending > 0) it->sending --;
+        if (it->sending > 0 || !it->failed) return;
+        it->failures ++;
+        if (it->failures > max_failures) {
+            LOG(WARNING) << "remove " << it->str() << " due to too many failures";
+            m_subscribers.erase(it);
+        }
+    }
+
     void add_subscriber(const sockaddr_in& sa) {
         unique_lock<mutex> lock(m_lock);
         list<subscriber>::iterator it = find_if(m_subscribers.begin(), m_subscribers.end(), subscriber::if_same(sa));
@@ -391,7 +713,7 @@ private:
 
 class app {
 public:
-    app() {
+    app() : m_stopped(false) {
         mqtt::initialize();
 
         http_server_t::options options(m_imghandler);
@@ -420,13 +742,29 @@ public:
             g->add_op("decode", {"input"}, {"pixels", "size"}, op::decode_image());
             g->add_op("detect", {"pixels"}, {"objects"}, movidius::op::ssd_mobilenet(model.get()));
             g->add_op("json", {"size", "id", "objects"}, {"result"}, op::detect_boxes_json());
-            g->add_op("publish", {"result"}, {}, pub_op(m_mqtt_client.get()));
+            // ordered results are published when the dispatcher completes them.
+            if (FLAGS_order_window <= 0) {
+                g->add_op("publish", {"result"}, {}, pub_op(m_mqtt_client.get()));
+            }
             g->add_op("imagesrv", {"input", "id"}, {}, m_imghandler.op());
-            m_dispatcher.add_graph(g.get());
+            m_dispatcher.add_graph(g.get(), FLAGS_frames > 1 ? (size_t)FLAGS_frames : 1);
             m_ncs.push_back(move(stick));
             m_models.push_back(move(model));
             m_graphs.push_back(move(g));
         }
+        m_dispatcher.set_queue(FLAGS_queue > 0 ? (size_t)FLAGS_queue : 0,
+            parse_overflow_policy(FLAGS_overflow));
+        if (FLAGS_order_window > 0) {
+            m_dispatcher.set_order((size_t)FLAGS_order_window,
+                chrono::milliseconds(FLAGS_order_timeout));
+            auto client = m_mqtt_client.get();
+            m_dispatcher.set_completion([client] (graph *g) {
+                auto result = g->var("result");
+                if (result->is_set()) {
+                    client->publish(FLAGS_mqtt_topic, result->as<string>());
+                }
+            });
+        }
     }
 
     ~app() {
@@ -435,14 +773,49 @@ public:
 
     void run() {
         LOG(INFO) << "Run!";
-        in::udp udp((uint16_t)FLAGS_port);
+        in::udp udp((uint16_t)FLAGS_port, 8,
+            FLAGS_udp_threads > 1 ? (size_t)FLAGS_udp_threads : 1,
+            FLAGS_udp_batch > 1 ? (size_t)FLAGS_udp_batch : 1,
+            use_uring());
+        unique_ptr<streamer> strm;
+        unique_ptr<udp_caster> caster;
+        if (FLAGS_stream_port != 0) {
+            strm.reset(new streamer(FLAGS_stream_port));
+            caster.reset(new udp_caster(FLAGS_stream_port,
+                FLAGS_cast_chunk > 0 ? (size_t)FLAGS_cast_chunk : 0));
+        }
+        {
+            unique_lock<mutex> lock(m_stop_mutex);
+            if (m_stopped) return;
+            m_stop = [this, &udp, &strm, &caster] {
+                udp.stop();
+                if (strm) strm->stop();
+                if (caster) caster->stop();
+                m_imghandler.close();
+                m_httpsrv->stop();
+            };
+        }
+        bool io_uring = use_uring();
         thread httpsrv_thread([this] { m_httpsrv->run(); });
-        thread streamer_thread([this] { run_streamer(); });
-        thread caster_thread([this] { run_caster(); });
+        thread streamer_thread([this, &strm, io_uring] {
+            if (strm) strm->run(&m_imghandler, io_uring);
+        });
+        thread caster_thread([this, &caster, io_uring] {
+            if (caster) caster->run(&m_imghandler, io_uring);
+        });
         udp.run(&m_dispatcher);
         httpsrv_thread.join();
         caster_thread.join();
         streamer_thread.join();
+        unique_lock<mutex> lock(m_stop_mutex);
+        m_stop = nullptr;
+    }
+
+    // makes run return, safe from any thread.
+    void stop() {
+        unique_lock<mutex> lock(m_stop_mutex);
+        m_stopped = true;
+        if (m_stop) m_stop();
     }
 
 private:
@@ -454,20 +827,17 @@ private:
     image_handler m_imghandler;
     unique_ptr<http_server_t> m_httpsrv;
 
-    void run_streamer() {
-        if (FLAGS_stream_port == 0) {
-            return;
-        }
-        streamer strm(FLAGS_stream_port);
-        strm.run(&m_imghandler);
-    }
-
-    void run_caster() {
-        if (FLAGS_stream_port == 0) {
-            return;
-        }
-        udp_caster caster(FLAGS_stream_port);
-        caster.run(&m_imghandler);
+    mutex m_stop_mutex;
+    bool m_stopped;
+    // stops what run is running.
+    function<void()> m_stop;
+
+    static bool use_uring() {
+        if (FLAGS_io == "threads") return false;
+        if (FLAGS_io != "uring") throw invalid_argument("invalid io: " + FLAGS_io);
+        if (uring::supported()) return true;
+        LOG(WARNING) << "io_uring not available, serving sockets with threads";
+        return false;
     }
 };
 
@@ -476,7 +846,21 @@ int main(int argc, char* argv[]) {
     google::InstallFailureSignalHandler();
     gflags::ParseCommandLineFlags(&argc, &argv, true);
 
+    // every thread inherits the mask, so only sigwait sees them.
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+
     app app;
+    thread signals([&app, sigs] {
+        int sig = 0;
+        sigwait(&sigs, &sig);
+        LOG(INFO) << "Stop on signal " << sig;
+        app.stop();
+    });
+    signals.detach();
     app.run();
     return 0;
 }